@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "arena.h"
+#include "utils.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_MIN 4096
+#define ARENA_CHUNK_MAX (256 * 1024)
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+/* the arena of a block of arena_malloc is stored before it */
+#define ARENA_OWNER_SIZE ARENA_ALIGN
+
+static arena_t arena_root;
+arena_t *arena_current = &arena_root;
+
+/**
+ * the chunks of an arena grow from ARENA_CHUNK_MIN to ARENA_CHUNK_MAX, so
+ * that a small function does not reserve a large chunk for itself
+ */
+static
+arena_chunk_t *arena_new_chunk (arena_t *arena, size_t size)
+{
+  size_t chunk_size = ARENA_CHUNK_MIN << (arena->chunk_count < 6 ? arena->chunk_count : 6);
+  if (chunk_size > ARENA_CHUNK_MAX)
+    chunk_size = ARENA_CHUNK_MAX;
+  chunk_size -= sizeof(arena_chunk_t);
+  if (chunk_size < size)
+    chunk_size = size;
+
+  arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + chunk_size);
+  if (!chunk) {
+    printf("Out of memory (%zu bytes requested). exiting.\n", size);
+    exit(1);
+  }
+  chunk->size = chunk_size;
+  chunk->used = 0;
+  arena->chunk_count++;
+  return chunk;
+}
+
+static
+int arena_class (size_t size)
+{
+  size_t class = size / ARENA_ALIGN - 1;
+  return class < ARENA_FREE_CLASSES ? (int)class : -1;
+}
+
+void *arena_alloc (arena_t *arena, size_t size)
+{
+  assert(arena != NULL);
+  size = ARENA_ROUND(size ? size : 1);
+
+  int class = arena_class(size);
+  if (class >= 0 && arena->free_lists[class]) {
+    void *ptr = arena->free_lists[class];
+    arena->free_lists[class] = *(void **)ptr;
+    arena->bytes_used += size;
+    return ptr;
+  }
+
+  arena_chunk_t *chunk = arena->chunks;
+  if (!chunk || chunk->size - chunk->used < size) {
+    arena_chunk_t *fresh = arena_new_chunk(arena, size);
+    /* a block bigger than a regular chunk gets its own chunk, behind the
+     * current one, so the free space of the current one is not lost */
+    if (chunk && fresh->size == size && chunk->size - chunk->used > size / 2) {
+      fresh->next = chunk->next;
+      chunk->next = fresh;
+      chunk = fresh;
+    }
+    else {
+      fresh->next = chunk;
+      arena->chunks = chunk = fresh;
+    }
+  }
+
+  void *ptr = &chunk->data[chunk->used];
+  chunk->used += size;
+  arena->bytes_used += size;
+  return ptr;
+}
+
+/**
+ * gives back a block allocated in arena, only the small blocks are reused
+ */
+void arena_free (arena_t *arena, void *ptr, size_t size)
+{
+  if (!ptr) return;
+  size = ARENA_ROUND(size ? size : 1);
+  int class = arena_class(size);
+  if (class < 0) return;
+
+  *(void **)ptr = arena->free_lists[class];
+  arena->free_lists[class] = ptr;
+  arena->bytes_used -= size;
+}
+
+static
+void arena_unlink (arena_t *arena)
+{
+  arena_t **curr = &arena->parent->children;
+  while (*curr && *curr != arena)
+    curr = &(*curr)->sibling;
+  if (*curr)
+    *curr = arena->sibling;
+}
+
+/**
+ * Releases every chunk of arena and of its sub-arenas, in one call.
+ * A sub-arena is detached from its parent, the root arena stays usable
+ */
+void arena_release (arena_t *arena)
+{
+  assert(arena != NULL);
+  while (arena->children)
+    arena_release(arena->children);
+
+  arena_chunk_t *chunk = arena->chunks;
+  while (chunk) {
+    arena_chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+
+  arena_t *parent = arena->parent;
+  if (arena_current == arena)
+    arena_current = parent ? parent : arena;
+
+  if (parent) {
+    arena_unlink(arena);
+    arena_free(parent, arena, sizeof(arena_t));
+  }
+  else
+    memset(arena, 0, sizeof(arena_t));
+}
+
+arena_t *arena_push ()
+{
+  arena_t *arena = arena_alloc(arena_current, sizeof(arena_t));
+  memset(arena, 0, sizeof(arena_t));
+  arena->parent = arena_current;
+  arena->sibling = arena_current->children;
+  arena_current->children = arena;
+  arena_current = arena;
+  return arena;
+}
+
+void arena_pop ()
+{
+  assert(arena_current->parent != NULL);
+  arena_current = arena_current->parent;
+}
+
+/**
+ * The block remembers its arena: arena_current can have changed when it is
+ * given back, and a block put on the free list of another arena would be
+ * handed out again after its own arena is released
+ */
+void *arena_malloc (size_t size)
+{
+  char *block = arena_alloc(arena_current, ARENA_OWNER_SIZE + size);
+  *(arena_t **)block = arena_current;
+  return block + ARENA_OWNER_SIZE;
+}
+
+void arena_dispose (void *ptr, size_t size)
+{
+  if (!ptr) return;
+  char *block = (char *)ptr - ARENA_OWNER_SIZE;
+  arena_free(*(arena_t **)block, block, ARENA_OWNER_SIZE + size);
+}
+
+/**
+ * sums the usage of arena and of its sub-arenas in stats
+ */
+void arena_stats (arena_t *arena, arena_stats_t *stats)
+{
+  stats->bytes_used += arena->bytes_used;
+  stats->chunk_count += arena->chunk_count;
+  stats->arena_count++;
+  for (arena_chunk_t *chunk = arena->chunks; chunk; chunk = chunk->next)
+    stats->bytes_reserved += chunk->size;
+  for (arena_t *child = arena->children; child; child = child->sibling)
+    arena_stats(child, stats);
+}
+
+void arena_print_stats (arena_t *arena)
+{
+  arena_stats_t stats = { 0 };
+  arena_stats(arena, &stats);
+  printf(COLOR_BLUE "arena:" COLOR_DEFAULT
+      " %zu bytes used, %zu bytes reserved in %zu chunks, %zu arenas\n",
+      stats.bytes_used,
+      stats.bytes_reserved,
+      stats.chunk_count,
+      stats.arena_count);
+}
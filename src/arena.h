@@ -0,0 +1,59 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+#define ARENA_FREE_CLASSES 8
+
+typedef struct arena_chunk_t {
+  struct arena_chunk_t *next;
+  size_t size; // usable bytes in data
+  size_t used;
+  char data[];
+} arena_chunk_t;
+
+/**
+ * Bump allocator: memory is taken from large chunks and is only given back
+ * to the system when the whole arena is released.
+ * An arena can have sub-arenas (one per function for example), they are
+ * released with their parent, or before it with arena_release.
+ * Small blocks given back with arena_free are kept in free lists (one per
+ * size class) and reused by the next allocations of the same size
+ */
+typedef struct arena_t {
+  arena_chunk_t *chunks; // the first one is the current chunk
+  size_t chunk_count;
+  size_t bytes_used;
+  void *free_lists[ARENA_FREE_CLASSES];
+  struct arena_t *parent;
+  struct arena_t *children;
+  struct arena_t *sibling;
+} arena_t;
+
+typedef struct arena_stats_t {
+  size_t bytes_used;
+  size_t bytes_reserved;
+  size_t chunk_count;
+  size_t arena_count;
+} arena_stats_t;
+
+/** the arena used by the allocations of the compiler (ast, symbols, ...) **/
+extern arena_t *arena_current;
+
+void  *arena_alloc (arena_t *arena, size_t size);
+void   arena_free (arena_t *arena, void *ptr, size_t size);
+void   arena_release (arena_t *arena);
+void   arena_stats (arena_t *arena, arena_stats_t *stats);
+void   arena_print_stats (arena_t *arena);
+
+/** creates a sub-arena of arena_current, and makes it current **/
+arena_t *arena_push ();
+/** makes the parent of arena_current current again, nothing is released **/
+void     arena_pop ();
+
+/** allocates from arena_current, the block is given back to the arena it
+ * was allocated from, see arena_malloc. Blocks never given back (ast) can
+ * use arena_alloc(arena_current, ...) **/
+void  *arena_malloc (size_t size);
+void   arena_dispose (void *ptr, size_t size);
+
+#endif /* ifndef ARENA_H */
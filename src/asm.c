@@ -5,18 +5,22 @@
 #include <stdbool.h>
 #include <limits.h>
 #include "utils.h"
-#include "asm_sym.h"
 #include "asm.h"
-#include "buffer.h"
-#include "lexer.h"
+#include "tac.h"
+#include "regalloc.h"
+#include "peephole.h"
+#include "intern.h"
+#include "options.h"
 
 /**
  * The ASM module converts TAC representation into real Intel ASM x86_64
+ * It reads the instructions of each function (tac_function_t) one by one
  * We are only using a subset of the x86_64 asm language.
  * The subset we use is the following.
  *
  * Argument parameters can be one of:
- *  - stack variable, with a memory offset relative to $rbp
+ *  - stack variable, with a memory offset relative to %rbp (or %rsp with
+ *    --omit-frame-pointer, see asm_frame_init)
  *  - immediate value, known at compile-time (like 1, 2, etc.) starting with a '$' symbol
  *  - CPU register
  *
@@ -36,6 +40,10 @@
  *     > We don't have to manage this by ourselves
  * There are also General Purpose registers, which are useful as temporary variables
  *   %rax, %rbx, %r10, %r11, %r12, %r13, %r14, %r15
+ *   > the tmps are given these registers by the register allocator (regalloc.c),
+ *     and the argument registers below when no call or division needs them
+ *   > %r11 is kept as scratch register, for the operations x86_64 can't do in
+ *     one instruction, like moving a variable into another one
  * And then there are registers which are used to store the arguments of a function which is going to be called:
  *   %rdi, %rsi, %rdx, %rcx, %r8, %r9
  *
@@ -71,430 +79,664 @@
  *                                          # of a register and store it into
  *                                          # the second operand
  *  > ex: addq %rax, %rbx           # add %rax to %rbx and store the result into %rbx
- * subq/divq/mulq # substract, divide, multiply
+ * subq/imulq                      # substract, multiply
+ * salq $<IMMEDIATE>, <REGISTER>   # shift left, multiply by a power of 2
+ * leaq (<REG>,<REG>,<2/4/8>), <REGISTER> # computes REG + REG * 2/4/8, without
+ *                                  # touching the flags
+ * sarq/shrq $<IMMEDIATE>, <REGISTER> # shift right, keeping the sign or not
+ * negq <REGISTER>                  # opposite of the value
+ * imulq <REGISTER>                 # signed %rax * REGISTER into %rdx:%rax
+ * cqto                             # extends %rax to the 128 bits %rdx:%rax
+ * idivq <REGISTER/RELATIVE>        # divides %rdx:%rax, the quotient goes to
+ *                                  # %rax and the remainder to %rdx
+ * cmovl <REGISTER/RELATIVE>, <REGISTER> # copies if lower than in the last
+ *                                  # comparison, like jl (cmovle, cmovg...)
+ * .p2align 4,,10                   # aligns the next label on 16 bytes, when
+ *                                  # it takes at most 10 bytes of padding
  * 
  */
 
 
 #ifdef WIN32
 char call_registers[6][5] = { "%rcx", "%rdx", "%r8", "%r9" };
+#define RED_ZONE 0
 #else
 char call_registers[6][5] = { "%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9" };
+/* bytes below %rsp a function can use without moving it, see asm_frame_init */
+#define RED_ZONE 128
 #endif
-char general_purpose_registers[8][5] = {
-  "%rax", "%rbx", "%r10", "%r11", "%r12", "%r13", "%r14", "%r15"
-};
+/* the scratch registers are never given to a tmp, see regalloc.h
+ * %rcx is a call register, free outside of the PARAM ... CALL sequences */
+#define SCRATCH "%r11"
+#define SCRATCH2 "%rcx"
 
 /**
- * Checks whether a string represents a logical label
+ * The frame of the function being translated, see asm_frame_init
  */
-bool is_internal_label (char *label)
+typedef struct asm_frame_t {
+  const char *base; // register the slots are addressed from
+  long offset; // from the base register to the top of the slots
+  size_t size; // bytes substracted from %rsp by the prolog
+} asm_frame_t;
+
+static asm_frame_t frame = { "%rbp", 0, 0 };
+
+/**
+ * Gives the assembly form of an operand:
+ *  - immediate value: $1
+ *  - argument or local variable: its address relative to %rbp, like -8(%rbp)
+ *    the slot n is at -8 * (n + 1), the first 8 bytes are for the saved %rbp.
+ *    With --omit-frame-pointer it is relative to %rsp, like 24(%rsp)
+ *  - register: %rax, the tmps are replaced by registers or slots before the
+ *    translation, see regalloc_function
+ * out is only used when the form has to be built
+ */
+char *asm_operand (tac_operand_t *operand, asm_operand_t out)
 {
-  return label[0] == 'L' && label[1] >= '0' && label[1] <= '9';
+  switch (operand->kind) {
+  case TAC_OPND_IMM:
+    snprintf(out, sizeof(asm_operand_t), "$%ld", operand->value);
+    return out;
+  case TAC_OPND_LOCAL:
+    snprintf(out, sizeof(asm_operand_t), "%ld(%s)",
+             frame.offset - 8 * (operand->value + 1), frame.base);
+    return out;
+  case TAC_OPND_REG:
+    return (char *)reg_names[operand->value];
+  default:
+    printf("asm: Expected an immediate value, a variable or a register. exiting.\n");
+    print_backtrace();
+    exit(1);
+  }
 }
 
 /**
- * Checks whether a string represents a tmp variable
- * These variables will be stored in CPU registers
+ * Copies a string to a field of an asm_line_t, NULL gives an empty string
  */
-bool is_tmp_var (char *tmp)
+static
+void asm_copy (char *out, size_t size, const char *text)
 {
-  return tmp[0] == 't' && tmp[1] == 'm' && tmp[2] == 'p' &&
-    tmp[3] >= '0' && tmp[3] <= '9';
+  if (!text)
+    text = "";
+  size_t length = strlen(text);
+  if (length >= size)
+    length = size - 1;
+  memcpy(out, text, length);
+  out[length] = '\0';
 }
 
 /**
- * Converts an immediate value representation to a 'long' integer
- * Direct values always start with a '$' symbol
+ * Adds an instruction to the code of the function, src and dst are
+ * optional (NULL). A call gives the function name in name instead
  */
-long asm_getimmediatevalue (buffer_t *buffer)
+asm_line_t *asm_emit (asm_code_t *code, const char *op, const char *src, const char *dst)
 {
-  char next = buf_getchar_after_blank(buffer);
-  assert(next == '$');
-  char *lexem = lexer_getnumber(buffer);
-
-  char *invalid = NULL;
-  long value = strtol(lexem, &invalid, 10);
-
-  if (invalid && *invalid != '\0') {
-    printf("Direct value should only contain digits. exiting. \n");
-    exit(1);
-  }
+  if (code->count == code->capacity) {
+    code->capacity = code->capacity ? code->capacity * 2 : 256;
+    code->lines = realloc(code->lines, code->capacity * sizeof(asm_line_t));
+  }
+  asm_line_t *line = &code->lines[code->count++];
+  asm_copy(line->op, sizeof(line->op), op);
+  asm_copy(line->src, sizeof(asm_operand_t), src);
+  asm_copy(line->dst, sizeof(asm_operand_t), dst);
+  line->name = NULL;
+  return line;
+}
 
-  free(lexem);
-  return value;
+/**
+ * Adds a label, a function name or a numbered label (.L<number>)
+ */
+void asm_label (asm_code_t *code, const char *name, long number)
+{
+  asm_operand_t label;
+  snprintf(label, sizeof(asm_operand_t), ".L%ld", number);
+  asm_line_t *line = asm_emit(code, "", name ? NULL : label, NULL);
+  line->name = name;
 }
 
 /**
- * Parses a stack offset (relative position of a variable depending of the current
- * base pointer)
- * It verifies that the offset is neither negative or bigger than a INT value
+ * Writes the code of a function in the text form of the assembler
  */
-unsigned int asm_getoffset (buffer_t *buffer)
+void asm_code_print (asm_code_t *code, FILE *outfile)
 {
-  long value = asm_getimmediatevalue(buffer);
-  if (value < 0 || value > INT_MAX) {
-    printf("Stack offset should not be negative nor > to INT_MAX. exiting\n");
-    exit(1);
+  for (size_t i = 0; i < code->count; i++) {
+    asm_line_t *line = &code->lines[i];
+    if (!line->op[0])
+      fprintf(outfile, "%s:\n", line->name ? line->name : line->src);
+    else if (line->name)
+      fprintf(outfile, "\t%s\t%s\n", line->op, line->name);
+    else if (line->dst[0])
+      fprintf(outfile, "\t%s\t%s, %s\n", line->op, line->src, line->dst);
+    else if (line->src[0])
+      fprintf(outfile, "\t%s\t%s\n", line->op, line->src);
+    else
+      fprintf(outfile, "\t%s\n", line->op);
   }
-
-  return (unsigned int)value;
 }
 
 /**
- * these functions are only convenience functions to generate the appropriate
- * instructions in assembly
+ * adds an instruction with two operands
+ * In Intel x86_64, binary operators always save the result into the 2nd operand,
+ * except for the cmp operator.
  */
-void asm_instr_register_to_var (char *op, char *reg, asm_symbol_t *symbol, FILE *outfile)
-{ fprintf(outfile, "\t%s\t%s, -%u(%%rbp)\n", op, reg, symbol->pos); }
-
-void asm_instr_immediate_to_var (char *op, long val, asm_symbol_t *symbol, FILE *outfile)
-{ fprintf(outfile, "\t%s\t$%ld, -%u(%%rbp)\n", op, val, symbol->pos); }
-
-void asm_instr_register_to_register (char *op, char *reg, char *reg2, FILE *outfile)
-{ /* don't copy a register to itself */
-  if (strcmp(reg, reg2)) fprintf(outfile, "\t%s\t%s, %s\n", op, reg, reg2);
+void asm_instr (asm_code_t *code, const char *op, const char *src, const char *dst)
+{
+  /* don't copy a register to itself */
+  if (!strcmp(op, "movq") && !strcmp(src, dst))
+    return;
+  asm_emit(code, op, src, dst);
 }
 
-void asm_instr_immediate_to_register (char *op, long val, char *reg, FILE *outfile)
-{ fprintf(outfile, "\t%s\t$%ld, %s\n", op, val, reg); }
-
-void asm_instr_var_to_register (char *op, asm_symbol_t *symbol, char *reg, FILE *outfile)
-{ fprintf(outfile, "\t%s\t-%u(%%rbp), %s\n", op, symbol->pos, reg); }
+bool asm_is_memory (tac_operand_t *operand)
+{
+  return operand->kind == TAC_OPND_LOCAL;
+}
 
 /**
- * Parses a local variable based on its name
+ * An immediate value is encoded on 32 bits, except in a movq to a register
  */
-asm_symbol_t *asm_getvar (buffer_t *buffer, asm_symbol_t *table)
+bool asm_is_imm64 (tac_operand_t *operand)
 {
-  char *var = lexer_getalphanum(buffer);
-  if (!var) {
-    printf("asm_getvar: Expected a second operand. exiting.\n");
-    exit(1);
-  }
-  asm_symbol_t *symbol = asm_sym_search(table, var);
-  free(var);
-  if (!symbol) {
-    printf("asm_getvar: Assignment before declaration. exiting.\n");
-    print_backtrace();
-    exit(1);
-  }
-  return symbol;
+  return operand->kind == TAC_OPND_IMM &&
+         (operand->value < INT_MIN || operand->value > INT_MAX);
 }
 
 /**
- * Gets a temporary variable and returns its associated register name
- * tmp0 => %rax
- * tmp1 => %rbx
- * see the general_purpose_registers array for the full list
+ * Gives the assembly form of a source operand, a 64 bits immediate value is
+ * first loaded into the scratch register
  */
-char *asm_get_tmp_reg (char *tmp)
+char *asm_source (tac_operand_t *operand, asm_operand_t out, char *scratch, asm_code_t *code)
 {
-  if (!tmp) {
-    printf("Expected two operands. exiting.\n");
-    exit(1);
-  }
-  if (!is_tmp_var(tmp)) {
-    printf("Expected a temporary variable in the form tmp[0-9]+. exiting. (%s)\n", tmp);
-    print_backtrace();
-    exit(1);
-  }
-  char *invalid = NULL;
-  long reg_nbr = strtol(&tmp[3], &invalid, 10);
-
-  if (invalid && *invalid != '\0') {
-    printf("tmp name should only contain digits after 'tmp' (%s). exiting. \n", tmp);
-    exit(1);
-  }
-  if (reg_nbr >= MAX_GP_REGS) {
-    printf("Exhaustion of General Purpose registers. exiting. \n");
-    exit(1);
-  }
-  return general_purpose_registers[reg_nbr];
+  if (!asm_is_imm64(operand))
+    return asm_operand(operand, out);
+  asm_instr(code, "movq", asm_operand(operand, out), scratch);
+  return scratch;
 }
 
 /**
- * Moves the %rsp stack pointer to add space into the stack
- * It's needed to keep the stack positions consistent between function calls
- * the stack goes downwards, that's why we substract `size` instead of adding it
+ * The callee-saved registers used by the function are saved after the
+ * variables and the spilled tmps, gives the slot of the register reg
  */
-void asm_add_stack (buffer_t *buffer, FILE *outfile)
+tac_operand_t asm_saved_slot (tac_function_t *fn, int reg)
 {
-  if (DEBUG) printf("asm_add_stack\n");
-  unsigned int size = asm_getoffset(buffer);
-  asm_instr_immediate_to_register("subq", size, "%rsp", outfile);
+  size_t slot = fn->slot_count;
+  for (int i = 0; i < reg; i++)
+    if (fn->saved_regs & REG_BIT(i))
+      slot++;
+  return tac_local(slot);
 }
 
 /**
- * Add a local symbol to the symbol list (local variable)
- * The symbol is attached to an offset to %rsp
+ * Lays out the frame of a function: the slots of the variables in memory,
+ * of the spilled tmps and of the saved registers (fn->slot_count, see
+ * regalloc_function), and %rsp aligned on 16 bytes at the calls.
+ *  - the prolog pushes %rbp below the return address, then the slots are
+ *    below %rbp: the size is rounded to 16 bytes
+ *  - with --omit-frame-pointer, %rbp is not pushed and the slots are above
+ *    %rsp: the size is 8 bytes more than a multiple of 16, the return
+ *    address taking the 8 other ones
+ * A leaf function (it calls no function) keeps its slots in the red zone
+ * when they fit: the bytes below %rsp that the System V ABI keeps for it,
+ * signal handlers don't touch them. %rsp does not move at all
  */
-void asm_decl_local (buffer_t *buffer, asm_symbol_t **table, FILE *outfile)
+void asm_frame_init (tac_function_t *fn)
 {
-  if (DEBUG) printf("asm_decl_local\n");
-  unsigned int pos = asm_getoffset(buffer);
-  char *name = lexer_getalphanum(buffer);
-  asm_symbol_t *symbol = asm_sym_new(pos, name);
-  asm_sym_add(table, symbol);
+  size_t bytes = 8 * (fn->slot_count + __builtin_popcount(fn->saved_regs));
+  bool leaf = true;
+  for (size_t i = 0; i < fn->count; i++)
+    if (fn->instrs[i].op == TAC_CALL)
+      leaf = false;
+
+  if (leaf && bytes <= RED_ZONE)
+    frame.size = 0;
+  else if (options.omit_frame_pointer)
+    frame.size = ((bytes + 8 + 15) & ~(size_t)15) - 8;
+  else
+    frame.size = (bytes + 15) & ~(size_t)15;
+  frame.base = options.omit_frame_pointer ? "%rsp" : "%rbp";
+  frame.offset = options.omit_frame_pointer ? (long)frame.size : 0;
 }
 
 /**
- * When we load a function argument, we add it to the symbol table, and we store
- * its value (which is first stored in a register) to the stack, with an attached offset
+ * This is the function prolog, storing the previous %rbp,
+ * and setting the new %rbp to the previous %rsp
+ * Which means: save the previous base address, and set the base address at
+ * the top of the stack, which is used to refer to local variables.
+ * Then the stack pointer is moved to add space for the variables (the stack
+ * goes downwards, that's why we substract the size instead of adding it),
+ * unless they are in the red zone. --omit-frame-pointer only moves %rsp,
+ * see asm_frame_init.
+ * and the arguments are stored from their registers to their slots, or to
+ * the registers they were given with --promote-locals (not at all when unused).
+ * The callee-saved registers given to tmps are saved too, see asm_epilog
  * All the arguments passed to a function are passed in specific registers, see
  * the call_registers list to know in which order
  */
-void asm_load_arg (buffer_t *buffer, asm_symbol_t **table, int *arg_count, FILE *outfile)
+void asm_prolog (tac_function_t *fn, bool is_main, asm_code_t *code)
 {
-  unsigned int pos = asm_getoffset(buffer);
-  char *name = lexer_getalphanum(buffer);
-  asm_symbol_t *symbol = asm_sym_new(pos, name);
-  asm_sym_add(table, symbol);
-  if (*arg_count >= MAX_CALL_ARGS) {
+  asm_operand_t size;
+  asm_label(code, is_main ? "real_main" : fn->name, 0);
+  if (!options.omit_frame_pointer) {
+    asm_emit(code, "pushq", "%rbp", NULL);
+    asm_emit(code, "movq", "%rsp", "%rbp");
+  }
+  snprintf(size, sizeof(asm_operand_t), "$%zu", frame.size);
+  if (frame.size > 0)
+    asm_emit(code, "subq", size, "%rsp");
+  for (int reg = 0; reg < REG_COUNT; reg++) {
+    asm_operand_t save;
+    tac_operand_t slot = asm_saved_slot(fn, reg);
+    if (fn->saved_regs & REG_BIT(reg))
+      asm_instr(code, "movq", reg_names[reg], asm_operand(&slot, save));
+  }
+
+  if (fn->param_count > MAX_CALL_ARGS) {
     printf("Too many arguments for the current function. exiting.\n");
     exit(1);
   }
-  asm_instr_register_to_var("movq", call_registers[*arg_count], symbol, outfile);
-  (*arg_count)++;
+  for (size_t slot = 0; slot < fn->param_count; slot++) {
+    asm_operand_t var;
+    if (fn->places[slot].kind != TAC_OPND_NONE)
+      asm_instr(code, "movq", call_registers[slot], asm_operand(&fn->places[slot], var));
+  }
 }
 
 /**
- * The return statement does two things:
- *  - if there is a return value, store it in the %rax register
- *  - then, call the 'leave' and 'ret' instructions which sets the %rsp and %rbp
- *    registers to their previous values
+ * Removes the frame of the function: restores the callee-saved registers of
+ * the caller, then calls the 'leave' instruction which sets the %rsp and
+ * %rbp registers to their previous values
  *    leave does:
  *      - movq %rbp, %rsp # erase %rsp with the current %rbp (base pointer)
  *      - pop %rbp        # remove the last value from the stack and put it into %rbp
+ * When %rsp was not moved, popq %rbp is enough. With --omit-frame-pointer,
+ * the size of the frame is added back to %rsp
+ */
+void asm_leave (tac_function_t *fn, asm_code_t *code)
+{
+  asm_operand_t size;
+  for (int reg = 0; reg < REG_COUNT; reg++) {
+    asm_operand_t save;
+    tac_operand_t slot = asm_saved_slot(fn, reg);
+    if (fn->saved_regs & REG_BIT(reg))
+      asm_instr(code, "movq", asm_operand(&slot, save), reg_names[reg]);
+  }
+  snprintf(size, sizeof(asm_operand_t), "$%zu", frame.size);
+  if (!options.omit_frame_pointer && frame.size > 0)
+    asm_emit(code, "leave", NULL, NULL);
+  else if (!options.omit_frame_pointer)
+    asm_emit(code, "popq", "%rbp", NULL);
+  else if (frame.size > 0)
+    asm_emit(code, "addq", size, "%rsp");
+}
+
+/**
+ * The function epilog removes the frame (asm_leave), then returns
  *    ret does:
  *      - pop %rip        # remove the last value from the stack and put it into %rip
  */
-void asm_return (buffer_t *buffer, asm_symbol_t *table, FILE *outfile)
+void asm_epilog (tac_function_t *fn, asm_code_t *code)
 {
-  char next = buf_getchar_rollback(buffer);
-  if (next == '$') {
-    long val = asm_getimmediatevalue(buffer);
-    asm_instr_immediate_to_register("movq", val, "%rax", outfile);
-    fprintf(outfile, "\tleave\n"
-                     "\tret\n");
-    return;
-  }
-
-  char *lexem = lexer_getalphanum_rollback(buffer);
-  if (!lexem) {
-    printf("no lexem. exiting.\n");
-    buf_print(buffer);
-    exit(1);
-  }
-
-  if (asm_sym_search(table, lexem)) {
-    asm_symbol_t *var = asm_getvar(buffer, table);
-    asm_instr_var_to_register("movq", var, "%rax", outfile);
-    fprintf(outfile, "\tleave\n"
-                     "\tret\n");
-    return;
-  }
+  asm_leave(fn, code);
+  asm_emit(code, "ret", NULL, NULL);
+}
 
-  char *tmp = lexer_getalphanum(buffer);
-  char *reg = asm_get_tmp_reg(tmp);
-  free(tmp);
+/**
+ * The return statement stores the return value, if there is one, in the
+ * %rax register, then leaves the function with the epilog
+ */
+void asm_return (tac_function_t *fn, tac_instr_t *instr, asm_code_t *code)
+{
+  asm_operand_t src;
+  if (instr->src1.kind != TAC_OPND_NONE)
+    asm_instr(code, "movq", asm_operand(&instr->src1, src), "%rax");
+  asm_epilog(fn, code);
+}
 
-  asm_instr_register_to_register("movq", reg, "%rax", outfile);
-  fprintf(outfile, "\tleave\n"
-                   "\tret\n");
+/**
+ * Copies a value, x86_64 can't move from memory to memory, nor a 64 bits
+ * immediate value to memory: these go through the scratch register
+ */
+void asm_assign (tac_instr_t *instr, asm_code_t *code)
+{
+  asm_operand_t dst, src;
+  char *value = asm_operand(&instr->src1, src);
+  if (asm_is_memory(&instr->dst) &&
+      (asm_is_memory(&instr->src1) || asm_is_imm64(&instr->src1))) {
+    asm_instr(code, "movq", value, SCRATCH);
+    value = SCRATCH;
+  }
+  asm_instr(code, "movq", value, asm_operand(&instr->dst, dst));
 }
 
 /**
- * In Intel x86_64, binary operators always save the result into the 2nd operand,
- * except for the cmp operator.
- * The choices are:
- * immediate to var
- * register to var
- * immediate to register
- * register to register
- *
- * This function recognizes the patterns and sets the right syntax
+ * COMPARE a b is translated to cmpq b, a: cmpq computes a - b, so the
+ * jump tests a <op> b
+ * a must be in a register when b is in memory, and can't be an immediate value
  */
-void asm_binary_op (buffer_t *buffer, asm_symbol_t *table, FILE *outfile, char *op)
+void asm_compare (tac_instr_t *instr, asm_code_t *code)
 {
-  if (DEBUG) printf("asm_binary_op\n");
-  bool in_immediatevalue = false;
-  long val;
-  char *reg = NULL;
+  asm_operand_t src1, src2;
+  char *left = asm_operand(&instr->src1, src1),
+       *right = asm_source(&instr->src2, src2, SCRATCH2, code);
+  if (instr->src1.kind == TAC_OPND_IMM ||
+      (asm_is_memory(&instr->src1) && asm_is_memory(&instr->src2))) {
+    asm_instr(code, "movq", left, SCRATCH);
+    left = SCRATCH;
+  }
+  asm_instr(code, "cmpq", right, left);
+}
 
-  /* first, we check it the first operand is an immediate value or a register */
-  if (buf_getchar_rollback(buffer) == '$') {
-    val = asm_getimmediatevalue(buffer);
-    in_immediatevalue = true;
-  }
-  else { // expect a temp variable
-    char *tmp = lexer_getalphanum(buffer);
-    reg = asm_get_tmp_reg(tmp);
-    free(tmp);
+/**
+ * Multiplies left by the constant factor into the register reg, with
+ * cheaper instructions than imulq when the factor allows it:
+ *  - 2^k: salq $k
+ *  - 3, 5, 9 times 2^k: leaq (r,r,2/4/8) then salq $k
+ *  - 2^k + 1, 2^k - 1: salq $k then addq/subq of left
+ *  - -1: negq
+ * Else imulq $factor, the 64 bits factors going through the scratch register
+ */
+void asm_multiply_constant (tac_operand_t *left, long factor, char *reg, asm_code_t *code)
+{
+  asm_operand_t src1, shift;
+  char *value = asm_operand(left, src1);
+  unsigned long magnitude = factor;
+  int k = magnitude ? __builtin_ctzl(magnitude) : 0;
+  unsigned long odd = magnitude >> k;
+  bool distinct = strcmp(value, reg) != 0 && left->kind != TAC_OPND_IMM;
+
+  if (factor == 0) {
+    asm_instr(code, "movq", "$0", reg);
+    return;
   }
-
-  /* we load the second operand into lexem */
-  char *lexem = lexer_getalphanum_rollback(buffer);
-  if (!lexem) {
-    printf("no lexem. exiting.\n");
-    buf_print(buffer);
-    exit(1);
+  if (factor == -1) {
+    asm_instr(code, "movq", value, reg);
+    asm_emit(code, "negq", reg, NULL);
+    return;
   }
-
-  /* then we check if the second operand is a stack variable */
-  if (asm_sym_search(table, lexem)) {
-    asm_symbol_t *var = asm_getvar(buffer, table);
-    if (in_immediatevalue)
-      asm_instr_immediate_to_var(op, val, var, outfile);
+  if (factor > 0 && (odd == 1 || odd == 3 || odd == 5 || odd == 9)) {
+    asm_operand_t address;
+    if (odd != 1) {
+      if (left->kind != TAC_OPND_REG) {
+        asm_instr(code, "movq", value, reg);
+        value = reg;
+      }
+      snprintf(address, sizeof(asm_operand_t), "(%s,%s,%lu)", value, value, odd - 1);
+      asm_instr(code, "leaq", address, reg);
+    }
     else
-      asm_instr_register_to_var(op, reg, var, outfile);
+      asm_instr(code, "movq", value, reg);
+    snprintf(shift, sizeof(asm_operand_t), "$%d", k);
+    if (k > 0)
+      asm_instr(code, "salq", shift, reg);
+    return;
   }
-  /* if it was not a stack variable, it must be a register */
-  else {
-    char *lexem_out = lexer_getalphanum(buffer);
-    char *reg_out = asm_get_tmp_reg(lexem_out);
-    free(lexem_out);
-    if (in_immediatevalue)
-      asm_instr_immediate_to_register(op, val, reg_out, outfile);
-    else
-      asm_instr_register_to_register(op, reg, reg_out, outfile);
+  bool add = ((magnitude - 1) & (magnitude - 2)) == 0,
+       sub = (magnitude & (magnitude + 1)) == 0;
+  if (factor > 2 && distinct && (add || sub)) {
+    snprintf(shift, sizeof(asm_operand_t), "$%d",
+             63 - __builtin_clzl(add ? magnitude - 1 : magnitude + 1));
+    asm_instr(code, "movq", value, reg);
+    asm_instr(code, "salq", shift, reg);
+    asm_instr(code, add ? "addq" : "subq", value, reg);
+    return;
   }
 
-  if (lexem) free(lexem);
+  asm_operand_t constant;
+  tac_operand_t imm = tac_imm(factor);
+  char *multiplier = asm_source(&imm, constant, SCRATCH2, code);
+  asm_instr(code, "movq", value, reg);
+  asm_instr(code, "imulq", multiplier, reg);
 }
 
 /**
- * Generic function that sets the correct instruction form, expecting the second operand to be a register
+ * Transforms a statement in the form tmpX = <op1> <operator> <op2> into two separate instructions
+ * movq op1, tmpX
+ * <operation> op2, tmpX
+ * When tmpX was spilled, the operation is done in the scratch register, then
+ * stored in its slot.
+ * When tmpX and op2 share their register, movq would erase op2: the operands
+ * are swapped if the operation allows it, else op2 is copied first
  */
-void asm_any_to_reg (buffer_t *buffer, asm_symbol_t *table, FILE *outfile,
-    char *op, char *reg)
+void asm_arithmetic (tac_instr_t *instr, asm_code_t *code)
 {
-  if (DEBUG) printf("asm_any_to_reg\n");
-
-  if (buf_getchar_rollback(buffer) == '$') {
-    long val = asm_getimmediatevalue(buffer);
-    asm_instr_immediate_to_register(op, val, reg, outfile);
+  static const char *ops[TAC_OPCODE_COUNT] = {
+    [TAC_ADD] = "addq",
+    [TAC_SUB] = "subq",
+    [TAC_MUL] = "imulq"
+  };
+  asm_operand_t dst, src1, src2;
+  tac_operand_t *left = &instr->src1, *right = &instr->src2;
+  char *reg = asm_is_memory(&instr->dst) ? SCRATCH : asm_operand(&instr->dst, dst);
+  if (instr->op == TAC_MUL && left->kind == TAC_OPND_IMM) {
+    left = &instr->src2;
+    right = &instr->src1;
+  }
+  if (instr->op == TAC_MUL && right->kind == TAC_OPND_IMM) {
+    asm_multiply_constant(left, right->value, reg, code);
+    if (asm_is_memory(&instr->dst))
+      asm_instr(code, "movq", reg, asm_operand(&instr->dst, dst));
     return;
   }
-
-  char *lexem = lexer_getalphanum_rollback(buffer);
-  if (asm_sym_search(table, lexem)) {
-    asm_symbol_t *var = asm_getvar(buffer, table);
-    asm_instr_var_to_register(op, var, reg, outfile);
+  if (!asm_is_memory(&instr->dst) &&
+      tac_operand_equals(&instr->dst, right) && !tac_operand_equals(&instr->dst, left) &&
+      (instr->op == TAC_ADD || instr->op == TAC_MUL)) {
+    left = &instr->src2;
+    right = &instr->src1;
   }
-  else {
-    char *lexem_in = lexer_getalphanum(buffer);
-    char *reg_in = asm_get_tmp_reg(lexem_in);
-    free(lexem_in);
-    asm_instr_register_to_register(op, reg_in, reg, outfile);
+
+  char *value = asm_source(right, src2, SCRATCH2, code);
+  if (!asm_is_memory(&instr->dst) &&
+      tac_operand_equals(&instr->dst, right) && !tac_operand_equals(&instr->dst, left)) {
+    asm_instr(code, "movq", value, SCRATCH2);
+    value = SCRATCH2;
   }
-  if (lexem) free(lexem);
+  asm_instr(code, "movq", asm_operand(left, src1), reg);
+  asm_instr(code, ops[instr->op], value, reg);
+  if (asm_is_memory(&instr->dst))
+    asm_instr(code, "movq", reg, asm_operand(&instr->dst, dst));
 }
 
 /**
- * Generic function that sets the correct instruction form, expecting the first operand to be a register
+ * The magic number of a signed division by the constant divisor (not 0,
+ * 1, -1 or a power of 2): x / divisor is the high half of magic * x,
+ * corrected then shifted right by shift, see asm_divide_constant.
+ * From Granlund and Montgomery, "Division by Invariant Integers using
+ * Multiplication", as computed in Hacker's Delight (10-1)
  */
-void asm_reg_to_any (buffer_t *buffer, asm_symbol_t *table, FILE *outfile,
-    char *op, char *reg)
+void asm_division_magic (long divisor, long *magic, int *shift)
 {
-  if (DEBUG) printf("asm_reg_to_any\n");
-  char *lexem = lexer_getalphanum_rollback(buffer);
-  if (asm_sym_search(table, lexem)) {
-    asm_symbol_t *var = asm_getvar(buffer, table);
-    asm_instr_register_to_var(op, reg, var, outfile);
-  }
-  else {
-    char *lexem_out = lexer_getalphanum(buffer);
-    char *reg_out = asm_get_tmp_reg(lexem_out);
-    free(lexem_out);
-    asm_instr_register_to_register(op, reg, reg_out, outfile);
-  }
-  if (lexem) free(lexem);
+  const unsigned long two63 = 1ul << 63;
+  unsigned long ad = divisor < 0 ? -(unsigned long)divisor : (unsigned long)divisor;
+  unsigned long t = two63 + ((unsigned long)divisor >> 63);
+  unsigned long anc = t - 1 - t % ad; // absolute value of nc
+  unsigned long q1 = two63 / anc, r1 = two63 - q1 * anc;
+  unsigned long q2 = two63 / ad, r2 = two63 - q2 * ad;
+  unsigned long delta;
+  int p = 63;
+  do {
+    p++;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= anc) {
+      q1++;
+      r1 -= anc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= ad) {
+      q2++;
+      r2 -= ad;
+    }
+    delta = ad - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+
+  *magic = (long)(q2 + 1);
+  if (divisor < 0)
+    *magic = -*magic;
+  *shift = p - 64;
 }
 
 /**
- * Transforms a statement in the form tmpX = <op1> <operator> <op2> into two separate instructions
- * movq op1, tmpX
- * movq op2, tmpY
- * <operation> tmpY, tmpX
+ * Division by a constant, without the slow idivq:
+ *  - 1, -1: a copy, negq
+ *  - a power of 2, 2^k: an arithmetic shift by k. It rounds towards minus
+ *    infinity, a negative dividend gets 2^k - 1 added first (the bias) to
+ *    round towards 0, then the result is negated for a negative divisor
+ *  - else the magic number: the high half of magic * x from imulq (in
+ *    %rdx), plus or minus x when the signs of magic and of the divisor
+ *    differ, shifted right, plus 1 when it is negative
+ * imulq uses %rax and %rdx like idivq, see asm_division
  */
-void asm_arithmetic (buffer_t *buffer, asm_symbol_t *table, char *lexem, FILE *outfile)
+void asm_divide_constant (tac_instr_t *instr, asm_code_t *code)
 {
-  if (DEBUG) printf("asm_arithmetic\n");
-  char *reg = asm_get_tmp_reg(lexem);
-  lexer_assert_equalsign(buffer, "Expected a '=' after a 'tmp' variable");
-  
-  asm_any_to_reg(buffer, table, outfile, "movq", reg);
-
-  buf_lock(buffer);
-  char next = buf_getchar(buffer);
-  if (next == '\n') {
-    buf_rollback_and_unlock(buffer, 1);
+  asm_operand_t dst, src1, constant;
+  long divisor = instr->src2.value;
+  unsigned long magnitude = divisor < 0 ? -(unsigned long)divisor : (unsigned long)divisor;
+  char *dividend = asm_operand(&instr->src1, src1);
+
+  if (magnitude == 1 || (magnitude & (magnitude - 1)) == 0) {
+    int k = __builtin_ctzl(magnitude);
+    char *reg = asm_is_memory(&instr->dst) ? SCRATCH : asm_operand(&instr->dst, dst);
+    asm_instr(code, "movq", dividend, reg);
+    if (k > 0) {
+      asm_operand_t bias, shift;
+      snprintf(bias, sizeof(asm_operand_t), "$%d", 64 - k);
+      snprintf(shift, sizeof(asm_operand_t), "$%d", k);
+      asm_instr(code, "movq", reg, SCRATCH2);
+      asm_instr(code, "sarq", "$63", SCRATCH2);
+      asm_instr(code, "shrq", bias, SCRATCH2);
+      asm_instr(code, "addq", SCRATCH2, reg);
+      asm_instr(code, "sarq", shift, reg);
+    }
+    if (divisor < 0)
+      asm_emit(code, "negq", reg, NULL);
+    if (asm_is_memory(&instr->dst))
+      asm_instr(code, "movq", reg, asm_operand(&instr->dst, dst));
     return;
   }
 
-  buf_unlock(buffer);
-  if (next != ' ') {
-    printf("Expected a space or a '\\n' after an assignment. exiting.\n");
-    exit(1);
-  }
+  long magic;
+  int shift;
+  asm_division_magic(divisor, &magic, &shift);
+  bool in_rax = instr->dst.kind == TAC_OPND_REG && instr->dst.value == REG_RAX;
+  asm_instr(code, "movq", dividend, SCRATCH2);
+  if (!in_rax)
+    asm_instr(code, "movq", "%rax", SCRATCH);
+  snprintf(constant, sizeof(asm_operand_t), "$%ld", magic);
+  asm_instr(code, "movq", constant, "%rax");
+  asm_emit(code, "imulq", SCRATCH2, NULL);
+  if (divisor > 0 && magic < 0)
+    asm_instr(code, "addq", SCRATCH2, "%rdx");
+  else if (divisor < 0 && magic > 0)
+    asm_instr(code, "subq", SCRATCH2, "%rdx");
+  if (shift > 0) {
+    snprintf(constant, sizeof(asm_operand_t), "$%d", shift);
+    asm_instr(code, "sarq", constant, "%rdx");
+  }
+  asm_instr(code, "movq", "%rdx", SCRATCH2);
+  asm_instr(code, "shrq", "$63", SCRATCH2);
+  asm_instr(code, "addq", SCRATCH2, "%rdx");
+  asm_instr(code, "movq", "%rdx", asm_operand(&instr->dst, dst));
+  if (!in_rax)
+    asm_instr(code, "movq", SCRATCH, "%rax");
+}
 
-  next = buf_getchar(buffer);
-  char *op = NULL;
-  switch (next) {
-  case '+': op = "addq"; break;
-  case '-': op = "subq"; break;
-  case '/': op = "divq"; break;
-  case '*': op = "mulq"; break;
-  default:
-    printf("Unknown arithmetic operator. exiting.\n");
-    exit(1);
+/**
+ * idivq divides %rdx:%rax by its operand, the quotient goes to %rax and the
+ * remainder to %rdx, the dividend is extended to %rdx:%rax by cqto.
+ * %rdx is not given to a tmp alive at a division (see regalloc.c), but %rax
+ * is: when it is not the destination, its value is kept in the scratch
+ * register meanwhile.
+ * The divisor can't be an immediate value, nor %rax which gets the dividend
+ * A constant divisor other than 0 avoids idivq, see asm_divide_constant
+ */
+void asm_division (tac_instr_t *instr, asm_code_t *code)
+{
+  asm_operand_t dst, src1, src2;
+  bool in_rax = instr->dst.kind == TAC_OPND_REG && instr->dst.value == REG_RAX;
+  if (instr->src2.kind == TAC_OPND_IMM && instr->src2.value != 0) {
+    asm_divide_constant(instr, code);
+    return;
+  }
+  char *divisor = asm_operand(&instr->src2, src2);
+  if (instr->src2.kind == TAC_OPND_IMM ||
+      (instr->src2.kind == TAC_OPND_REG && instr->src2.value == REG_RAX)) {
+    asm_instr(code, "movq", divisor, SCRATCH2);
+    divisor = SCRATCH2;
+  }
+  if (!in_rax)
+    asm_instr(code, "movq", "%rax", SCRATCH);
+  asm_instr(code, "movq", asm_operand(&instr->src1, src1), "%rax");
+  asm_emit(code, "cqto", NULL, NULL);
+  asm_emit(code, "idivq", divisor, NULL);
+  if (!in_rax) {
+    asm_instr(code, "movq", "%rax", asm_operand(&instr->dst, dst));
+    asm_instr(code, "movq", SCRATCH, "%rax");
   }
-  asm_any_to_reg(buffer, table, outfile, op, reg);
 }
 
 /**
  * Transforms a JUMP instruction into its correct intel x86_64 form
  */
-void asm_jump (buffer_t *buffer, char *lexem, FILE *outfile)
-{
-  char *op = NULL;
-  if (!strcmp(lexem, "JUMP"))
-    op = "jmp";
-  else if (!strcmp(lexem, "JUMP_LT"))
-    op = "jl";
-  else if (!strcmp(lexem, "JUMP_LTE"))
-    op = "jle";
-  else if (!strcmp(lexem, "JUMP_GT"))
-    op = "jg";
-  else if (!strcmp(lexem, "JUMP_GTE"))
-    op = "jge";
-  else if (!strcmp(lexem, "JUMP_NEQ"))
-    op = "jne";
-  else if (!strcmp(lexem, "JUMP_EQ"))
-    op = "je";
-  else {
-    printf("asm_jump: Unknown JUMP Operator. exiting.\n");
-    exit(1);
-  }
+void asm_jump (tac_instr_t *instr, asm_code_t *code)
+{
+  static const char *ops[TAC_OPCODE_COUNT] = {
+    [TAC_JUMP] = "jmp",
+    [TAC_JUMP_LT] = "jl",
+    [TAC_JUMP_LTE] = "jle",
+    [TAC_JUMP_GT] = "jg",
+    [TAC_JUMP_GTE] = "jge",
+    [TAC_JUMP_NEQ] = "jne",
+    [TAC_JUMP_EQ] = "je"
+  };
+  asm_operand_t label;
+  snprintf(label, sizeof(asm_operand_t), ".L%ld", instr->dst.value);
+  asm_emit(code, ops[instr->op], label, NULL);
+}
 
-  char *label = lexer_getalphanum(buffer);
-  fprintf(outfile, "\t%s\t.%s\n", op, label);
-  free(label);
+/**
+ * CMOV_<CMP> is a cmov<cc>, which only copies when the flags of the last
+ * cmpq give <CMP>. Its destination is a register, its source can't be an
+ * immediate value: they go through the scratch registers, movq does not
+ * change the flags
+ */
+void asm_conditional_move (tac_instr_t *instr, asm_code_t *code)
+{
+  static const char *ops[TAC_OPCODE_COUNT] = {
+    [TAC_CMOV_LT] = "cmovl",
+    [TAC_CMOV_LTE] = "cmovle",
+    [TAC_CMOV_GT] = "cmovg",
+    [TAC_CMOV_GTE] = "cmovge",
+    [TAC_CMOV_NEQ] = "cmovne",
+    [TAC_CMOV_EQ] = "cmove"
+  };
+  asm_operand_t dst, src;
+  char *value = asm_operand(&instr->src1, src);
+  char *reg = asm_is_memory(&instr->dst) ? SCRATCH : asm_operand(&instr->dst, dst);
+  if (instr->src1.kind == TAC_OPND_IMM) {
+    asm_instr(code, "movq", value, SCRATCH2);
+    value = SCRATCH2;
+  }
+  if (asm_is_memory(&instr->dst))
+    asm_instr(code, "movq", asm_operand(&instr->dst, dst), reg);
+  asm_instr(code, ops[instr->op], value, reg);
+  if (asm_is_memory(&instr->dst))
+    asm_instr(code, "movq", reg, asm_operand(&instr->dst, dst));
 }
 
 /**
  * Tranforms a PARAM instruction into a movq instruction to the correct parameter
  * based on the call_registers array
  */
-void asm_param (buffer_t *buffer, asm_symbol_t *table, int *param_count, FILE *outfile)
+void asm_param (tac_instr_t *instr, int *param_count, asm_code_t *code)
 {
+  asm_operand_t src;
   if (*param_count >= MAX_CALL_ARGS) {
     printf("asm_param: Too many parameters for a function. exiting.\n");
     exit(1);
   }
 
-  asm_any_to_reg(buffer, table, outfile, "movq", call_registers[*param_count]);
+  asm_instr(code, "movq", asm_operand(&instr->src1, src), call_registers[*param_count]);
   (*param_count)++;
 }
 
@@ -503,67 +745,98 @@ void asm_param (buffer_t *buffer, asm_symbol_t *table, int *param_count, FILE *o
  * the return value if applicable.
  * The return value of a function is always the %rax register
  */
-void asm_call (buffer_t *buffer, asm_symbol_t *table, int *param_count, FILE *outfile)
+void asm_call (tac_instr_t *instr, int *param_count, asm_code_t *code)
 {
+  asm_operand_t dst;
   *param_count = 0;
-  char *fnname = lexer_getalphanum(buffer);
-  if (!fnname) {
-    printf("Expected a function name after CALL. exiting.\n");
-    exit(1);
-  }
-  fprintf(outfile, "\tcall\t%s\n", fnname);
-  free(fnname);
-  char next = buf_getchar_rollback(buffer);
-  if (next == '\n') return;
-  asm_reg_to_any(buffer, table, outfile, "movq", "%rax");
+  asm_emit(code, "call", NULL, NULL)->name = instr->src1.name;
+  if (instr->dst.kind != TAC_OPND_NONE)
+    asm_instr(code, "movq", "%rax", asm_operand(&instr->dst, dst));
 }
 
 /**
- * There are two types of labels:
- *  - function labels, which are just the name of a function.
- *    > When we start a function, we need to set the function prolog,
- *      which is the definition of %rsp and %rbp registers.
- *      Both registers are needed to define the current function' address space
- *  - a simple numbered label, which is only useful for JUMP instructions
+ * Tells whether the instruction at pos is a tail call: a CALL whose value
+ * is returned right away, or a CALL followed by a RETURN without value
  */
-void asm_label (buffer_t *buffer, FILE *outfile, int *arg_count, bool *is_main)
+bool asm_is_tail_call (tac_function_t *fn, size_t pos)
 {
-  if (DEBUG) printf("asm_label\n");
-  char *label = lexer_getalphanum(buffer);
-  assert(label != NULL);
-  lexer_assert_twopoints(buffer, "expected a ':' after a label");
-  lexer_assert_newline(buffer, "expected a '\\n' after a label");
+  tac_instr_t *call = &fn->instrs[pos], *ret = &fn->instrs[pos + 1];
+  return call->op == TAC_CALL && pos + 1 < fn->count && ret->op == TAC_RETURN &&
+         (ret->src1.kind == TAC_OPND_NONE || tac_operand_equals(&ret->src1, &call->dst));
+}
 
-  if (is_internal_label(label)) {
-    fprintf(outfile, ".%s:\n", label);
-  }
-  else {
-    if (strcmp(label, "main") == 0) {
-      fprintf(outfile,
-        "real_main:\n"
-        "\tpushq\t%%rbp\n"
-        "\tmovq\t%%rsp, %%rbp\n");
-      *is_main = true;
-    }
-    else {
-      *is_main = false;
-      *arg_count = 0;
-      /* 
-      * This is the function prolog, storing the previous %rbp,
-      * and setting the new %rbp to the previous %rsp
-      * Which means: save the previous base address, and set the base address at the top of the stack, which is used to refer to local variables.
-      */
-      fprintf(outfile,
-          "%s:\n"
-          "\tpushq\t%%rbp\n"
-          "\tmovq\t%%rsp, %%rbp\n",
-          label);
-    }
+/**
+ * A tail call does not come back to the function: its frame is removed
+ * first, then the called function is jumped to, it returns to our caller
+ * with its value in %rax. The arguments are already in their registers,
+ * asm_leave does not touch them, and the stack is as it was when we were
+ * called
+ */
+void asm_tail_call (tac_function_t *fn, tac_instr_t *instr, int *param_count, asm_code_t *code)
+{
+  *param_count = 0;
+  asm_leave(fn, code);
+  asm_emit(code, "jmp", NULL, NULL)->name = instr->src1.name;
+}
+
+/**
+ * Translates one instruction
+ * The numbered labels are prefixed by a '.', they are local to the file
+ */
+void asm_instruction (tac_function_t *fn, tac_instr_t *instr, int *param_count, asm_code_t *code)
+{
+
+  switch (instr->op) {
+  case TAC_LABEL:
+    asm_label(code, NULL, instr->dst.value);
+    break;
+  case TAC_JUMP:
+  case TAC_JUMP_LT:
+  case TAC_JUMP_LTE:
+  case TAC_JUMP_GT:
+  case TAC_JUMP_GTE:
+  case TAC_JUMP_NEQ:
+  case TAC_JUMP_EQ:
+    asm_jump(instr, code);
+    break;
+  case TAC_COMPARE:
+    asm_compare(instr, code);
+    break;
+  case TAC_ASSIGN:
+    asm_assign(instr, code);
+    break;
+  case TAC_ADD:
+  case TAC_SUB:
+  case TAC_MUL:
+    asm_arithmetic(instr, code);
+    break;
+  case TAC_DIV:
+    asm_division(instr, code);
+    break;
+  case TAC_PARAM:
+    asm_param(instr, param_count, code);
+    break;
+  case TAC_CALL:
+    asm_call(instr, param_count, code);
+    break;
+  case TAC_RETURN:
+    asm_return(fn, instr, code);
+    break;
+  case TAC_CMOV_LT:
+  case TAC_CMOV_LTE:
+  case TAC_CMOV_GT:
+  case TAC_CMOV_GTE:
+  case TAC_CMOV_NEQ:
+  case TAC_CMOV_EQ:
+    asm_conditional_move(instr, code);
+    break;
+  default:
+    printf("asm: Unknown instruction. exiting.\n");
+    exit(1);
   }
-  free(label);
 }
 
-void asm_program_arguments (buffer_t *buffer, FILE *outfile, int arg_count)
+void asm_program_arguments (FILE *outfile, int arg_count)
 {
   fprintf(outfile, ".LC0:\n");
   fprintf(outfile, "\t.string \"%%d\\n\"\n");
@@ -617,69 +890,101 @@ void asm_program_arguments (buffer_t *buffer, FILE *outfile, int arg_count)
 }
 
 /**
- * Generates intel x64 assembly from TAC instructions
+ * Finds the loop headers of a function, the labels a jump after them goes
+ * back to. The result is indexed by their distance to the first label, see
+ * tac_label_range
  */
-void asm_generator (buffer_t *buffer, FILE *outfile)
+bool *asm_loop_headers (tac_function_t *fn, long *first)
 {
-  int arg_count = 0;
-  int param_count = 0;
-  bool is_main = false;
-  bool was_main = false;
-  bool main_created = false;
-  fprintf(outfile, "\t.globl\tmain\n");
-  asm_symbol_t *table = NULL;
-  do {
-    buf_lock(buffer);
-    char next = buf_getchar(buffer);
-    buf_rollback_and_unlock(buffer, 1);
-    if (next != '\t') {
-      if (was_main == true && is_main == false) {
-        main_created = true;
-        asm_program_arguments(buffer, outfile, arg_count);
-      }
-      was_main = is_main;
-      asm_label(buffer, outfile, &arg_count, &is_main);
-      continue;
-    }
-
-    char *lexem = lexer_getalphanum(buffer);
-    if (!strcmp(lexem, "ADD_STACK"))
-      asm_add_stack(buffer, outfile);
-
-    else if (!strcmp(lexem, "DECL_LOCAL"))
-      asm_decl_local(buffer, &table, outfile);
-
-    else if (!strcmp(lexem, "LOAD_ARG"))
-      asm_load_arg(buffer, &table, &arg_count, outfile);
-
-    else if (!strcmp(lexem, "ASSIGN"))
-      asm_binary_op(buffer, table, outfile, "movq");
-
-    else if (!strcmp(lexem, "COMPARE"))
-      asm_binary_op(buffer, table, outfile, "cmpq");
-
-    else if (!strcmp(lexem, "PARAM"))
-      asm_param(buffer, table, &param_count, outfile);
+  size_t label_count;
+  tac_label_range(fn, first, &label_count);
+  bool *seen = calloc(label_count + 1, sizeof(bool)),
+       *headers = calloc(label_count + 1, sizeof(bool));
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (instr->op == TAC_LABEL)
+      seen[instr->dst.value - *first] = true;
+    else if (TAC_IS_JUMP(instr->op) && seen[instr->dst.value - *first])
+      headers[instr->dst.value - *first] = true;
+  }
+  free(seen);
+  return headers;
+}
 
-    else if (!strcmp(lexem, "CALL"))
-      asm_call(buffer, table, &param_count, outfile);
+/* number of arguments of main, needed by the program entry point */
+static int main_arg_count = 0;
+/* the code of the function being translated, reused by each function */
+static asm_code_t function_code = { 0 };
 
-    else if (!strcmp(lexem, "RETURN"))
-      asm_return(buffer, table, outfile);
+/**
+ * Starts the assembly output
+ */
+void asm_begin (FILE *outfile)
+{
+  main_arg_count = 0;
+  fprintf(outfile, "\t.globl\tmain\n");
+}
 
-    else if (!strncmp(lexem, "JUMP", 4))
-      asm_jump(buffer, lexem, outfile);
+/**
+ * Generates intel x64 assembly from the TAC instructions of one function
+ * The tmps are first given their registers and the frame is laid out, then
+ * we set the function prolog, and a function which does not end with a return statement gets an epilog too
+ * The loop headers are aligned, so that the first instructions of the loop
+ * are fetched together at each iteration.
+ * The instructions are kept in function_code until the peephole optimizer
+ * has gone through them, then they are written
+ */
+void asm_function (tac_function_t *fn, FILE *outfile)
+{
+  int param_count = 0;
+  long first_label;
+  bool is_main = fn->name == intern("main");
+  asm_code_t *code = &function_code;
+  if (is_main)
+    main_arg_count = fn->param_count;
+
+  regalloc_function(fn);
+  asm_frame_init(fn);
+  code->count = 0;
+  asm_prolog(fn, is_main, code);
+  bool *headers = asm_loop_headers(fn, &first_label);
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (instr->op == TAC_LABEL && headers[instr->dst.value - first_label])
+      asm_emit(code, ".p2align", "4,,10", NULL);
+    if (asm_is_tail_call(fn, i))
+      asm_tail_call(fn, &fn->instrs[i++], &param_count, code);
+    else
+      asm_instruction(fn, &fn->instrs[i], &param_count, code);
+  }
+  free(headers);
 
-    else if (!strncmp(lexem, "tmp", 3))
-      asm_arithmetic(buffer, table, lexem, outfile);
+  if (fn->count == 0 || fn->instrs[fn->count - 1].op != TAC_RETURN)
+    asm_epilog(fn, code);
 
-    lexer_assert_newline(buffer, 
-        "asm_instruction: Instruction should end with a '\\n'. exiting.\n");
-    free(lexem);
-  } while (!buf_eof_strict(buffer));
+  peephole_function(code);
+  asm_code_print(code, outfile);
+}
 
-  if (!main_created) {
-    asm_program_arguments(buffer, outfile, arg_count);
-  }
+/**
+ * Ends the assembly output with the program entry point, which calls main
+ */
+void asm_end (FILE *outfile)
+{
+  asm_program_arguments(outfile, main_arg_count);
+  if (options.report & REPORT_PEEPHOLE)
+    peephole_report();
+  free(function_code.lines);
+  function_code = (asm_code_t){ 0 };
 }
 
+/**
+ * Generates intel x64 assembly from TAC instructions
+ */
+void asm_generator (tac_function_t *functions, FILE *outfile)
+{
+  asm_begin(outfile);
+  for (tac_function_t *fn = functions; fn; fn = fn->next)
+    asm_function(fn, outfile);
+  asm_end(outfile);
+}
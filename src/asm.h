@@ -1,14 +1,48 @@
 #ifndef ASM_H
 #define ASM_H
-#include "buffer.h"
+#include <stdio.h>
+#include "tac.h"
 
 #ifdef WIN32
 #define MAX_CALL_ARGS 4
 #else
 #define MAX_CALL_ARGS 6
 #endif
-#define MAX_GP_REGS 8
 
-void asm_generator (buffer_t *buffer, FILE *outfile);
+/* an operand in its assembly form, see asm_operand */
+typedef char asm_operand_t[32];
+
+/**
+ * One line of assembly: an instruction with up to two operands, or a label
+ * (empty op). Labels and calls to functions use name, the other ones src
+ */
+typedef struct asm_line_t {
+  char op[16];
+  asm_operand_t src;
+  asm_operand_t dst;
+  const char *name; // interned
+} asm_line_t;
+
+/**
+ * The assembly of a function, before it is written
+ */
+typedef struct asm_code_t {
+  asm_line_t *lines;
+  size_t count;
+  size_t capacity;
+} asm_code_t;
+
+asm_line_t *asm_emit (asm_code_t *code, const char *op, const char *src, const char *dst);
+void asm_code_print (asm_code_t *code, FILE *outfile);
+char *asm_operand (tac_operand_t *operand, asm_operand_t out);
+/** division by a constant, checked by --bench=division **/
+void asm_division_magic (long divisor, long *magic, int *shift);
+void asm_divide_constant (tac_instr_t *instr, asm_code_t *code);
+
+void asm_generator (tac_function_t *functions, FILE *outfile);
+/** asm_generator in steps, asm_function is called once per function **/
+void asm_begin (FILE *outfile);
+void asm_function (tac_function_t *fn, FILE *outfile);
+void asm_end (FILE *outfile);
 
 #endif /* ifndef ASM_H */
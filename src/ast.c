@@ -9,10 +9,11 @@
 #include "parser.h"
 #include "ast.h"
 #include "utils.h"
+#include "arena.h"
 
 ast_t *ast_new_integer (long val)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_INTEGER;
   ast->integer = val;
   return ast;
@@ -20,7 +21,7 @@ ast_t *ast_new_integer (long val)
 
 ast_t *ast_new_binary (ast_binary_e op, ast_t *left, ast_t *right)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_BINARY;
   ast->binary.op = op;
   ast->binary.left = left;
@@ -29,16 +30,16 @@ ast_t *ast_new_binary (ast_binary_e op, ast_t *left, ast_t *right)
 }
 
 ast_t *ast_new_variable (char *name, int type) {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_VARIABLE;
-  ast->var.name = copy_name(name);
+  ast->var.name = name;
   ast->var.type = type;
   return ast;
 }
 
 ast_t *ast_new_unary (ast_unary_e op, ast_t *operand)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_UNARY;
   ast->unary.op = op;
   ast->unary.operand = operand;
@@ -47,27 +48,28 @@ ast_t *ast_new_unary (ast_unary_e op, ast_t *operand)
 
 ast_t *ast_new_function (char *name, int return_type, ast_list_t *params, ast_list_t *stmts)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_FUNCTION;
-  ast->function.name = copy_name(name);
+  ast->function.name = name;
   ast->function.return_type = return_type;
   ast->function.params = params;
   ast->function.stmts = stmts;
+  ast->function.arena = NULL;
   return ast;
 }
 
 ast_t *ast_new_fncall (char *name, ast_list_t *args)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_FNCALL;
-  ast->call.name = copy_name(name);
+  ast->call.name = name;
   ast->call.args = args;
   return ast;
 }
 
 ast_t *ast_new_comp_stmt (ast_list_t *stmts)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_COMPOUND_STATEMENT;
   ast->compound_stmt.stmts = stmts;
   return ast;
@@ -75,7 +77,7 @@ ast_t *ast_new_comp_stmt (ast_list_t *stmts)
 
 ast_t *ast_new_declaration (ast_t *lvalue, ast_t *rvalue)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_DECLARATION;
   ast->assignment.lvalue = lvalue;
   ast->assignment.rvalue = rvalue;
@@ -84,7 +86,7 @@ ast_t *ast_new_declaration (ast_t *lvalue, ast_t *rvalue)
 
 ast_t *ast_new_assignment (ast_t *lvalue, ast_t *rvalue)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_ASSIGNMENT;
   ast->assignment.lvalue = lvalue;
   ast->assignment.rvalue = rvalue;
@@ -93,7 +95,7 @@ ast_t *ast_new_assignment (ast_t *lvalue, ast_t *rvalue)
 
 ast_t *ast_new_branch (ast_t *condition, ast_t *valid, ast_t *invalid)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_BRANCH;
   ast->branch.condition = condition;
   ast->branch.valid = valid;
@@ -103,7 +105,7 @@ ast_t *ast_new_branch (ast_t *condition, ast_t *valid, ast_t *invalid)
 
 ast_t *ast_new_loop (ast_t *condition, ast_t *stmt)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_LOOP;
   ast->loop.condition = condition;
   ast->loop.stmt = stmt;
@@ -112,7 +114,7 @@ ast_t *ast_new_loop (ast_t *condition, ast_t *stmt)
 
 ast_t *ast_new_return (ast_t *expr)
 {
-  ast_t * ast = malloc(sizeof(ast_t));
+  ast_t * ast = arena_alloc(arena_current, sizeof(ast_t));
   ast->type = AST_RETURN;
   ast->ret.expr = expr;
   return ast;
@@ -139,7 +141,7 @@ char *ast_get_ret_type (ast_t *ast) {
 
 ast_list_t *ast_list_new_node (ast_t *elem)
 {
-  ast_list_t *node = malloc(sizeof(ast_list_t));
+  ast_list_t *node = arena_alloc(arena_current, sizeof(ast_list_t));
   node->elem = elem;
   node->next = NULL;
   return node;
@@ -161,8 +163,12 @@ int ast_binary_priority (ast_t *ast)
 {
   if (ast == NULL) return 0;
   if (ast->type != AST_BINARY) return 100;
+  return ast_op_priority(ast->binary.op);
+}
 
-  switch (ast->binary.op) {
+int ast_op_priority (ast_binary_e op)
+{
+  switch (op) {
     case AST_BIN_OR: return 10;
     case AST_BIN_AND: return 10;
     case AST_BIN_GTE: return 20;
@@ -42,6 +42,10 @@ typedef enum {
   AST_UN_PAREN
 } ast_unary_e;
 
+/**
+ * All the names (variables, functions) are interned pointers, see intern.h
+ * so they can be compared by identity
+ */
 typedef struct ast_t {
   ast_node_type_e type;
   union {
@@ -68,6 +72,7 @@ typedef struct ast_t {
       int return_type;
       struct ast_list_t *params;
       struct ast_list_t *stmts;
+      struct arena_t *arena; // where the body is allocated, see parse_function
     } function;
     struct {
       struct ast_list_t *stmts;
@@ -117,6 +122,7 @@ ast_t       *ast_new_return (ast_t *expr);
 char        *ast_get_var_type (ast_t *ast);
 char        *ast_binary_to_string (ast_binary_e op);
 int          ast_binary_priority (ast_t *ast);
+int          ast_op_priority (ast_binary_e op);
 ast_list_t  *ast_list_new_node (ast_t *elem);
 ast_list_t  *ast_list_add (ast_list_t **list, ast_t *elem);
 ast_t       *ast_list_getlast (ast_list_t **list);
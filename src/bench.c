@@ -0,0 +1,536 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include "symbol.h"
+#include "buffer.h"
+#include "lexer.h"
+#include "parser.h"
+#include "scan.h"
+#include "intern.h"
+#include "utils.h"
+#include "arena.h"
+#include "tac.h"
+#include "asm.h"
+#include "regalloc.h"
+#include "bench.h"
+#include "options.h"
+
+#define BENCH_MAX_SYMBOLS 10000
+#define BENCH_SYMBOLS_ROUNDS 20
+#define BENCH_LEXER_SIZE (32 * 1024 * 1024)
+#define BENCH_LEXER_ROUNDS 5
+#define BENCH_MAX_TERMS 100000
+#define BENCH_DIVIDENDS 1000 // random dividends of each divisor
+
+extern sym_table_t *global_table;
+
+static
+double bench_elapsed (clock_t start)
+{
+  return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static
+char **bench_names (const char *prefix, size_t n)
+{
+  char **names = malloc(n * sizeof(char *));
+  char name[32];
+  for (size_t i = 0; i < n; i++) {
+    snprintf(name, sizeof(name), "%s%zu", prefix, i);
+    names[i] = intern(name);
+  }
+  return names;
+}
+
+/**
+ * A function declaring n locals: each declaration is checked with
+ * sym_search before sym_add (like parse_declaration), then every local
+ * is used once, through the scoped lookup (like parse_known_symbol)
+ */
+static
+double bench_locals (sym_table_t *global, char **names, size_t n)
+{
+  clock_t start = clock();
+  sym_table_t *table = sym_table_new(global);
+
+  for (size_t i = 0; i < n; i++) {
+    if (sym_search(table, names[i])) {
+      printf("bench: duplicated symbol. exiting.\n");
+      exit(1);
+    }
+    sym_add(&table, sym_new(names[i], SYM_VAR, NULL));
+  }
+  for (size_t i = 0; i < n; i++) {
+    if (!sym_lookup(table, names[n - i - 1])) {
+      printf("bench: symbol not found. exiting.\n");
+      exit(1);
+    }
+  }
+
+  double elapsed = bench_elapsed(start);
+  sym_table_delete(table);
+  return elapsed;
+}
+
+/**
+ * A module of n functions with 2 parameters each, every function calls
+ * the previous one: the call is resolved from the function scope
+ */
+static
+double bench_functions (char **names, char **params, size_t n)
+{
+  clock_t start = clock();
+  sym_table_t *global = sym_table_new(NULL);
+
+  for (size_t i = 0; i < n; i++) {
+    sym_table_t *table = sym_table_new(global);
+    sym_add(&table, sym_new(params[0], SYM_PARAM, NULL));
+    sym_add(&table, sym_new(params[1], SYM_PARAM, NULL));
+    if (i > 0 && !sym_lookup(table, names[i - 1])) {
+      printf("bench: function not found. exiting.\n");
+      exit(1);
+    }
+    sym_lookup(table, params[1]);
+    sym_add(&global, sym_new_function(names[i], SYM_FUNCTION, NULL, table));
+  }
+
+  double elapsed = bench_elapsed(start);
+  for (symbol_t *sym = sym_first(global); sym; sym = sym->next)
+    sym_table_delete(sym->function_table);
+  sym_table_delete(global);
+  return elapsed;
+}
+
+/**
+ * Declaring n symbols should scale linearly: the number of probes per
+ * symbol stays the same when n doubles. The time per symbol still grows
+ * with n, outside of the hash table: malloc gives the large blocks (the
+ * chunks of the arena, the slots of a large table) back to the system
+ * when a round releases them, the next round faults their pages in again.
+ * And the table of a large function does not fit in the L1 cache and the
+ * TLB, each lookup reads a random slot of it.
+ * The best of some rounds is kept, a single one only takes a fraction of
+ * a millisecond
+ */
+void bench_symbols ()
+{
+  char **locals = bench_names("local", BENCH_MAX_SYMBOLS);
+  char **functions = bench_names("function", BENCH_MAX_SYMBOLS);
+  char **params = bench_names("param", 2);
+  sym_table_t *global = sym_table_new(NULL);
+
+  printf("%10s %14s %12s %14s %12s\n",
+      "symbols", "locals (ms)", "ns/local", "functions (ms)", "ns/function");
+  for (size_t n = BENCH_MAX_SYMBOLS / 8; n <= BENCH_MAX_SYMBOLS; n *= 2) {
+    double locals_time = 0, functions_time = 0;
+    for (int round = 0; round < BENCH_SYMBOLS_ROUNDS; round++) {
+      double time = bench_locals(global, locals, n);
+      if (round == 0 || time < locals_time)
+        locals_time = time;
+      time = bench_functions(functions, params, n);
+      if (round == 0 || time < functions_time)
+        functions_time = time;
+      /* the symbols of this round are not needed anymore */
+      arena_release(arena_current);
+    }
+    printf("%10zu %14.3f %12.1f %14.3f %12.1f\n", n,
+        locals_time * 1e3, locals_time * 1e9 / n,
+        functions_time * 1e3, functions_time * 1e9 / n);
+  }
+
+  free(locals);
+  free(functions);
+  free(params);
+}
+
+/**
+ * Generates about size bytes of source code: indented functions with long
+ * identifiers and numbers, like a (verbose) hand written program
+ */
+static
+char *bench_lexer_input (size_t size, size_t *length)
+{
+  char *input = malloc(size + 1024);
+  size_t len = 0;
+  for (size_t i = 0; len < size; i++) {
+    len += sprintf(&input[len],
+        "fonction calcul_intermediaire_%zu (entier premier_parametre, entier second_parametre) : entier {\n"
+        "        entier variable_locale_%zu = premier_parametre * %zu + second_parametre;\n"
+        "        tantque (variable_locale_%zu >= 1000000) {\n"
+        "                variable_locale_%zu = variable_locale_%zu / 10;\n"
+        "        }\n"
+        "        si (variable_locale_%zu != 0 ET second_parametre < 42) {\n"
+        "                retourner calcul_intermediaire_%zu(variable_locale_%zu, 1);\n"
+        "        }\n"
+        "        retourner variable_locale_%zu;\n"
+        "}\n\n",
+        i, i % 97, i * 7919, i % 97, i % 97, i % 97, i % 97, i ? i - 1 : 0, i % 97, i % 97);
+  }
+  *length = len;
+  return input;
+}
+
+/**
+ * Only the character scanning of lexer_tokenize: blanks, identifiers and
+ * numbers are skipped, anything else is one character
+ */
+static
+size_t bench_scan (const char *curr, const char *end)
+{
+  size_t count = 0;
+  while (curr < end) {
+    unsigned char class = scan_classes[(unsigned char)*curr];
+    if (class & SCAN_BLANK) {
+      curr = scan_blanks(curr, end);
+      continue;
+    }
+    if (class & SCAN_DIGIT)
+      curr = scan_digits(curr, end);
+    else if (class & SCAN_IDENT)
+      curr = scan_identifier(curr, end);
+    else
+      curr++;
+    count++;
+  }
+  return count;
+}
+
+/**
+ * Tokenizes a large generated input with each implementation of the
+ * character scanning supported by the cpu, the best of some rounds is kept.
+ * The scan column is the throughput of the scanning alone
+ */
+void bench_lexer ()
+{
+  size_t length;
+  char *input = bench_lexer_input(BENCH_LEXER_SIZE, &length);
+  scan_impl_e best = scan_best_impl(), supported = scan_supported_impl();
+
+  printf("%10s %10s %12s %10s %14s %16s\n",
+      "impl", "size (MB)", "tokens", "MB/s", "Mtokens/s", "scan (MB/s)");
+  for (scan_impl_e impl = SCAN_SCALAR; impl <= supported; impl++) {
+    double elapsed = 0, scan_elapsed = 0;
+    size_t count = 0;
+    scan_set_impl(impl);
+    for (int round = 0; round < BENCH_LEXER_ROUNDS; round++) {
+      clock_t start = clock();
+      if (bench_scan(input, input + length) == 0)
+        printf("bench: empty input.\n");
+      double time = bench_elapsed(start);
+      if (round == 0 || time < scan_elapsed)
+        scan_elapsed = time;
+    }
+    for (int round = 0; round < BENCH_LEXER_ROUNDS; round++) {
+      buffer_t buffer;
+      token_stream_t stream;
+      buf_init_memory(&buffer, input, length);
+      clock_t start = clock();
+      lexer_tokenize(&stream, &buffer);
+      double time = bench_elapsed(start);
+      if (round == 0 || time < elapsed)
+        elapsed = time;
+      count = stream.count;
+      lexer_release(&stream);
+      buf_release(&buffer);
+    }
+    printf("%10s %10.1f %12zu %10.1f %14.1f %16.1f\n", scan_impl_name(impl),
+        length / 1e6, count, length / 1e6 / elapsed, count / 1e6 / elapsed,
+        length / 1e6 / scan_elapsed);
+  }
+  scan_set_impl(best);
+  free(input);
+}
+
+/**
+ * One expression of n terms, with all the priorities mixed
+ */
+static
+char *bench_expression_input (size_t n, size_t *length)
+{
+  static const char *ops[] = { "+", "*", "-", "/", "<", "ET", "==", "OU" };
+  char *input = malloc(n * 16 + 256);
+  size_t len = sprintf(input, "fonction main (entier a, entier b) : entier {\n"
+      "  entier v = a");
+  for (size_t i = 1; i < n; i++)
+    len += sprintf(&input[len], " %s %s", ops[i % 8], i % 3 ? "b" : "7");
+  len += sprintf(&input[len], ";\n  retourner 0;\n}\n");
+  *length = len;
+  return input;
+}
+
+/**
+ * Parsing an expression should be linear in its number of terms
+ * The symbols of the parsed function are not printed
+ */
+void bench_expressions ()
+{
+  double times[4];
+  size_t i = 0;
+  bool quiet = options.quiet;
+  options.quiet = true;
+  for (size_t n = BENCH_MAX_TERMS / 8; n <= BENCH_MAX_TERMS; n *= 2, i++) {
+    size_t length;
+    char *input = bench_expression_input(n, &length);
+    buffer_t buffer;
+    buf_init_memory(&buffer, input, length);
+
+    clock_t start = clock();
+    parse(&buffer);
+    times[i] = bench_elapsed(start);
+
+    global_table = NULL;
+    arena_release(arena_current);
+    free(input);
+  }
+  options.quiet = quiet;
+
+  printf("%10s %14s %12s\n", "terms", "parse (ms)", "ns/term");
+  i = 0;
+  for (size_t n = BENCH_MAX_TERMS / 8; n <= BENCH_MAX_TERMS; n *= 2, i++)
+    printf("%10zu %14.3f %12.1f\n", n, times[i] * 1e3, times[i] * 1e9 / n);
+}
+
+/**
+ * The quotient computed from the magic number like the code of
+ * asm_divide_constant does
+ */
+static
+long bench_magic_quotient (long x, long divisor, long magic, int shift)
+{
+  long q = (long)(((__int128)magic * x) >> 64);
+  if (divisor > 0 && magic < 0)
+    q = (unsigned long)q + x;
+  else if (divisor < 0 && magic > 0)
+    q = (unsigned long)q - x;
+  q >>= shift;
+  return (unsigned long)q + ((unsigned long)q >> 63);
+}
+
+/* the value of %rax before the division, it must be kept */
+#define BENCH_RAX 0x5a5a5a5a5a5a5a5aL
+
+/* a function running the division of the dividend x, it stores the value of
+ * %rax after the division in rax, see bench_division_function */
+typedef long (*bench_division_fn)(long x, long *rax);
+
+/**
+ * Writes the function bench_division_<index>, which runs the code of one
+ * division, the dividend in %rdi. The frame has the slot of
+ * tac_local(0) (-8(%rbp)), %rbx is saved
+ */
+static
+void bench_division_function (FILE *outfile, size_t index, tac_instr_t *instr, asm_code_t *code)
+{
+  asm_operand_t src, dst;
+  fprintf(outfile, "\t.globl\tbench_division_%zu\n", index);
+  fprintf(outfile, "bench_division_%zu:\n", index);
+  fprintf(outfile, "\tpushq\t%%rbp\n\tmovq\t%%rsp, %%rbp\n\tsubq\t$32, %%rsp\n");
+  fprintf(outfile, "\tmovq\t%%rbx, -16(%%rbp)\n\tmovq\t%%rsi, -24(%%rbp)\n");
+  fprintf(outfile, "\tmovabsq\t$%ld, %%rax\n", BENCH_RAX);
+  fprintf(outfile, "\tmovq\t%%rdi, %s\n", asm_operand(&instr->src1, src));
+  asm_code_print(code, outfile);
+  fprintf(outfile, "\tmovq\t-24(%%rbp), %%rsi\n\tmovq\t%%rax, (%%rsi)\n");
+  fprintf(outfile, "\tmovq\t%s, %%rax\n", asm_operand(&instr->dst, dst));
+  fprintf(outfile, "\tmovq\t-16(%%rbp), %%rbx\n\tleave\n\tret\n");
+}
+
+/**
+ * Assembles the file source into the shared library library with the C
+ * compiler, and loads it
+ */
+static
+void *bench_division_load (const char *source, const char *library)
+{
+  char command[2 * PATH_MAX + 64];
+  snprintf(command, sizeof(command), "cc -shared -o %s %s", library, source);
+  if (system(command) != 0) {
+    printf("bench: '%s' failed. exiting.\n", command);
+    exit(1);
+  }
+  void *handle = dlopen(library, RTLD_NOW);
+  if (!handle) {
+    printf("bench: %s. exiting.\n", dlerror());
+    exit(1);
+  }
+  return handle;
+}
+
+/**
+ * Runs one division on each dividend, exits on a mismatch
+ */
+static
+void bench_check_division (bench_division_fn division, tac_instr_t *instr,
+    long *dividends, size_t count)
+{
+  long divisor = instr->src2.value;
+  bool in_rax = instr->dst.kind == TAC_OPND_REG && instr->dst.value == REG_RAX;
+  bool from_rax = instr->src1.kind == TAC_OPND_REG && instr->src1.value == REG_RAX;
+  for (size_t i = 0; i < count; i++) {
+    long x = dividends[i], rax;
+    /* LONG_MIN / -1 overflows, it has no expected value */
+    if (x == LONG_MIN && divisor == -1)
+      continue;
+    long quotient = division(x, &rax);
+    bool rax_kept = in_rax || rax == (from_rax ? x : BENCH_RAX);
+    if (quotient != x / divisor || !rax_kept) {
+      printf("bench: %ld / %ld gives %ld instead of %ld%s. exiting.\n", x, divisor,
+             quotient, x / divisor, rax_kept ? "" : ", %rax is lost");
+      exit(1);
+    }
+  }
+}
+
+/**
+ * Checks the divisions by a constant of asm.c against the division of C:
+ * the divisors around the powers of 2 of both signs, the small ones, the
+ * extreme ones and a few large primes, each with the dividends around 0,
+ * around the divisor and at the extremes, and random ones.
+ * For each divisor, the quotient is computed from the magic number
+ * (asm_division_magic). Then the code asm_divide_constant emits, for
+ * several places of the dividend and of the result, is assembled by the C
+ * compiler (cc) into a shared library, which is loaded and run
+ */
+void bench_division ()
+{
+  long divisors[3 * 2 * 64 + 401 + 8];
+  size_t divisor_count = 0;
+  for (int k = 0; k < 63; k++) {
+    long power = 1L << k;
+    long around[] = { power, power + 1, power - 1, -power, -power - 1, -power + 1 };
+    for (size_t i = 0; i < 6; i++)
+      if (around[i] != 0)
+        divisors[divisor_count++] = around[i];
+  }
+  for (long d = -200; d <= 200; d++)
+    if (d != 0)
+      divisors[divisor_count++] = d;
+  long extremes[] = { LONG_MIN, LONG_MIN + 1, LONG_MAX, 641, -641, 6700417,
+                      1000000007, -1000000007 };
+  for (size_t i = 0; i < sizeof(extremes) / sizeof(extremes[0]); i++)
+    divisors[divisor_count++] = extremes[i];
+
+  /* dividend -> result: registers, %rax which idivq and imulq use, a slot */
+  tac_operand_t r10 = { .kind = TAC_OPND_REG, .value = REG_R10 },
+                rbx = { .kind = TAC_OPND_REG, .value = REG_RBX },
+                rax = { .kind = TAC_OPND_REG, .value = REG_RAX },
+                slot = tac_local(0);
+  tac_operand_t places[][2] = {
+    { r10, rbx }, { r10, rax }, { rax, r10 }, { rbx, rbx }, { slot, slot }, { r10, slot }
+  };
+  size_t place_count = sizeof(places) / sizeof(places[0]);
+
+  char directory[] = "/tmp/bench-division-XXXXXX";
+  char source[PATH_MAX], library[PATH_MAX];
+  if (!mkdtemp(directory)) {
+    printf("bench: can't create a directory in /tmp. exiting.\n");
+    exit(1);
+  }
+  snprintf(source, sizeof(source), "%s/division.S", directory);
+  snprintf(library, sizeof(library), "%s/division.so", directory);
+  FILE *outfile = fopen(source, "w");
+  if (!outfile) {
+    printf("bench: can't write %s. exiting.\n", source);
+    exit(1);
+  }
+  fprintf(outfile, "\t.text\n");
+
+  asm_code_t code = { 0 };
+  for (size_t d = 0; d < divisor_count; d++) {
+    long divisor = divisors[d];
+    unsigned long magnitude = divisor < 0 ? -(unsigned long)divisor : (unsigned long)divisor;
+    if ((magnitude & (magnitude - 1)) != 0) {
+      long magic;
+      int shift;
+      asm_division_magic(divisor, &magic, &shift);
+      if (shift < 0 || shift > 63) {
+        printf("bench: shift %d of the divisor %ld. exiting.\n", shift, divisor);
+        exit(1);
+      }
+    }
+    for (size_t p = 0; p < place_count; p++) {
+      tac_instr_t instr = { .op = TAC_DIV, .dst = places[p][1], .src1 = places[p][0],
+                            .src2 = tac_imm(divisor) };
+      code.count = 0;
+      asm_divide_constant(&instr, &code);
+      bench_division_function(outfile, d * place_count + p, &instr, &code);
+    }
+  }
+  fprintf(outfile, "\t.section\t.note.GNU-stack,\"\",@progbits\n");
+  fclose(outfile);
+  free(code.lines);
+  void *handle = bench_division_load(source, library);
+
+  unsigned long random = 88172645463325252UL;
+  size_t checked = 0;
+  for (size_t d = 0; d < divisor_count; d++) {
+    long divisor = divisors[d];
+    unsigned long magnitude = divisor < 0 ? -(unsigned long)divisor : (unsigned long)divisor;
+    long dividends[BENCH_DIVIDENDS + 16] = {
+      0, 1, -1, 2, -2, divisor, divisor + 1, divisor - 1, -divisor, -divisor + 1,
+      -divisor - 1, LONG_MIN, LONG_MIN + 1, LONG_MAX, LONG_MAX - 1, 2 * divisor
+    };
+    for (size_t i = 16; i < BENCH_DIVIDENDS + 16; i++) {
+      random ^= random << 13;
+      random ^= random >> 7;
+      random ^= random << 17;
+      /* small ones too, the rounding of the negative ones matters */
+      dividends[i] = i % 2 ? (long)random : (long)random >> (random % 64);
+    }
+
+    if ((magnitude & (magnitude - 1)) != 0) {
+      long magic;
+      int shift;
+      asm_division_magic(divisor, &magic, &shift);
+      for (size_t i = 0; i < BENCH_DIVIDENDS + 16; i++) {
+        long x = dividends[i];
+        if (!(x == LONG_MIN && divisor == -1) &&
+            bench_magic_quotient(x, divisor, magic, shift) != x / divisor) {
+          printf("bench: the magic number %ld >> %d of %ld gives a wrong quotient "
+                 "of %ld. exiting.\n", magic, shift, divisor, x);
+          exit(1);
+        }
+      }
+    }
+    for (size_t p = 0; p < place_count; p++) {
+      char name[64];
+      tac_instr_t instr = { .op = TAC_DIV, .dst = places[p][1], .src1 = places[p][0],
+                            .src2 = tac_imm(divisor) };
+      snprintf(name, sizeof(name), "bench_division_%zu", d * place_count + p);
+      bench_division_fn division = (bench_division_fn)dlsym(handle, name);
+      if (!division) {
+        printf("bench: %s not found. exiting.\n", name);
+        exit(1);
+      }
+      bench_check_division(division, &instr, dividends, BENCH_DIVIDENDS + 16);
+    }
+    checked += (BENCH_DIVIDENDS + 16) * place_count;
+  }
+
+  dlclose(handle);
+  remove(source);
+  remove(library);
+  rmdir(directory);
+  printf("division: %zu divisors, %zu divisions run, no mismatch\n",
+         divisor_count, checked);
+}
+
+int bench_run (const char *name)
+{
+  if (strcmp(name, "symbols") == STREQUAL)
+    bench_symbols();
+  else if (strcmp(name, "lexer") == STREQUAL)
+    bench_lexer();
+  else if (strcmp(name, "expressions") == STREQUAL)
+    bench_expressions();
+  else if (strcmp(name, "division") == STREQUAL)
+    bench_division();
+  else {
+    printf("Unknown benchmark '%s'. exiting.\n", name);
+    return 1;
+  }
+  return 0;
+}
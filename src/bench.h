@@ -0,0 +1,14 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/**
+ * Benchmarks of the compiler internals, launched with --bench=<name>
+ * each one prints its measures on stdout
+ */
+int bench_run (const char *name);
+void bench_symbols ();
+void bench_lexer ();
+void bench_expressions ();
+void bench_division ();
+
+#endif /* ifndef BENCH_H */
@@ -4,26 +4,139 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "buffer.h"
 #include "utils.h"
 
+#define BUF_READ_CHUNK 65536
+
+/**
+ * Reads the whole content of fd at once, used when the input cannot be mapped
+ * (pipes, special files, or systems without mmap)
+ */
+static
+void buf_read_all (buffer_t *buffer)
+{
+  size_t capacity = BUF_READ_CHUNK;
+  size_t cnt;
+  buffer->content = malloc(capacity);
+  buffer->size = 0;
+  assert(buffer->content != NULL);
+
+  while ((cnt = fread(&buffer->content[buffer->size], 1,
+          capacity - buffer->size, buffer->fd)) > 0) {
+    buffer->size += cnt;
+    if (buffer->size == capacity) {
+      capacity *= 2;
+      buffer->content = realloc(buffer->content, capacity);
+      assert(buffer->content != NULL);
+    }
+  }
+}
+
+#ifndef WIN32
+/**
+ * Maps a regular file in memory, returns false if fd can't be mapped
+ */
+static
+bool buf_map (buffer_t *buffer)
+{
+  struct stat st;
+  int fileno_ = fileno(buffer->fd);
+  if (fstat(fileno_, &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+
+  buffer->size = st.st_size;
+  if (buffer->size == 0) {
+    buffer->content = NULL;
+    return true;
+  }
+
+  void *content = mmap(NULL, buffer->size, PROT_READ, MAP_PRIVATE, fileno_, 0);
+  if (content == MAP_FAILED)
+    return false;
+
+  madvise(content, buffer->size, MADV_SEQUENTIAL);
+  buffer->content = content;
+  buffer->ismapped = true;
+  return true;
+}
+#endif /* WIN32 */
+
 void buf_init (buffer_t *buffer, FILE* fd)
 {
-  memset(buffer->content, 0, BUF_SIZE);
   buffer->fd = fd;
+  buffer->content = NULL;
+  buffer->size = 0;
   buffer->it = 0;
-  buffer->end = 0;
   buffer->lock = 0;
   buffer->islocked = false;
-  buffer->avail = 0;
-  buffer->bytesread = 0;
-  buffer->bytesreadsincelock = 0;
-  buffer->currchar = 0;
-  buffer->eof = false;
+  buffer->ismapped = false;
+  buffer->discarded = 0;
+
+#ifndef WIN32
+  if (buf_map(buffer))
+    return;
+#endif
+  buf_read_all(buffer);
+}
+
+void buf_init_memory (buffer_t *buffer, char *content, size_t size)
+{
+  buffer->fd = NULL;
+  buffer->content = content;
+  buffer->size = size;
+  buffer->it = 0;
+  buffer->lock = 0;
+  buffer->islocked = false;
+  buffer->discarded = 0;
+  /* nothing to free, like a mapped file */
+  buffer->ismapped = true;
+}
+
+/**
+ * Releases the memory of the input, fd can be closed before or after this call
+ */
+void buf_release (buffer_t *buffer)
+{
+  if (buffer->ismapped) {
+#ifndef WIN32
+    if (buffer->fd)
+      munmap(buffer->content, buffer->size);
+#endif
+    buffer->content = NULL;
+    return;
+  }
+  free(buffer->content);
+  buffer->content = NULL;
+}
+
+/**
+ * The input before offset will not be read again (except by buf_print):
+ * the pages of a mapped file are given back to the system, they are read
+ * from the file again if needed
+ */
+void buf_discard (buffer_t *buffer, size_t offset)
+{
+#ifndef WIN32
+  if (!buffer->ismapped || !buffer->fd)
+    return;
+  size_t page = sysconf(_SC_PAGESIZE);
+  offset -= offset % page;
+  if (offset > buffer->discarded) {
+    madvise(&buffer->content[buffer->discarded], offset - buffer->discarded,
+        MADV_DONTNEED);
+    buffer->discarded = offset;
+  }
+#endif
 }
 
 bool buf_eof_strict (buffer_t *buffer) {
-  return buffer->avail == 0 && buffer->eof == true;
+  return buffer->it >= buffer->size;
 }
 
 bool buf_eof (buffer_t *buffer) {
@@ -36,7 +149,6 @@ void buf_lock (buffer_t *buffer) {
     fprintf(stderr, "Warning: lock was already set.\n");
     print_backtrace();
   }
-  buffer->bytesreadsincelock = 0;
   buffer->lock = buffer->it;
   buffer->islocked = true;
 }
@@ -46,91 +158,19 @@ void buf_unlock (buffer_t *buffer) {
     fprintf(stderr, "Warning: lock was not set.\n");
     print_backtrace();
   }
-  buffer->bytesreadsincelock = 0;
   buffer->islocked = false;
 }
 
-static
-size_t buf_fread (buffer_t *buffer, size_t offset, size_t n)
-{
-  // printf("read %lu bytes\n", n);
-  size_t cnt = fread(&(buffer->content[offset]), 1, n, buffer->fd);
-  if (cnt < n) {
-    buffer->eof = true;
-  }
-  buffer->bytesread += cnt;
-  if (buffer->islocked) {
-    buffer->bytesreadsincelock += cnt;
-  }
-  return cnt;
-}
-
-static
-void buf_mod (size_t *val, size_t toadd)
-{
-  *val = (*val + toadd) % BUF_SIZE;
-}
-
-static
-void buf_mod_backwards (size_t *val, size_t tosub)
-{
-  *val = (*val - tosub) % BUF_SIZE;
-}
-
-static
-void buf_move_it (buffer_t *buffer, size_t cnt) {
-  buf_mod(&buffer->it, cnt);
-  buffer->currchar += cnt;
-}
-
-static
-void buf_move_it_bw (buffer_t *buffer, size_t cnt) {
-  buf_mod_backwards(&buffer->it, cnt);
-  buffer->currchar -= cnt;
-}
-
+/**
+ * Reading after the end of input returns '\0', the iterator is still moved
+ * so that a rollback after the end always puts it back where it was
+ */
 char buf_getchar (buffer_t *buffer)
 {
-  size_t end;
-  if (buffer->avail == 0) {
-    if (buffer->islocked) {
-      // on doit charger le max de caractères
-      // on commence par la fin de la chaîne entre end et lock
-      if (buffer->end >= buffer->lock) {
-        if (buffer->end < BUF_SIZE - 1) {
-          end = buf_fread(buffer, buffer->end, BUF_SIZE - buffer->end);
-        } else {
-          end = 0;
-        }
-        end += buf_fread(buffer, 0, buffer->lock);
-        if (end == 0)
-          goto fail;
-      } else if (buffer->bytesreadsincelock >= BUF_SIZE) {
-        printf("Can't lock more than %d chars.", BUF_SIZE);
-        print_backtrace();
-        exit(1);
-      } else {
-        end = buf_fread(buffer, buffer->end, buffer->lock - buffer->end);
-      }
-      buf_mod(&buffer->end, end);
-    } else {
-      if ((end = buf_fread(buffer, 0, BUF_SIZE)) == 0) {
-        goto fail;
-      }
-      buffer->end = end - 1;
-    }
-    buffer->avail = end;
-  }
-
-  char ret = buffer->content[buffer->it];
-  buf_move_it(buffer, 1);
-  buffer->avail -= 1;
-  return ret;
-fail:
-  buffer->avail = 0;
-  buffer->end = 0;
-  buffer->it = 0;
-  return '\0';
+  size_t it = buffer->it++;
+  if (it >= buffer->size)
+    return '\0';
+  return buffer->content[it];
 }
 
 char buf_getchar_after_blank (buffer_t *buffer) {
@@ -140,50 +180,17 @@ char buf_getchar_after_blank (buffer_t *buffer) {
 
 void buf_getnchar (buffer_t *buffer, char *out, size_t n)
 {
-  char *outcurs = out;
-  size_t cnt, max;
-  char *content = buffer->content;
- 
-  while (n) {
-    // number of chars that can be read w/o going back to 0
-    size_t currpos = !buffer->islocked ? buffer->it : buffer->lock;
-
-    size_t nmax = BUF_SIZE - currpos < n
-      ? BUF_SIZE - currpos
-      : n;
-    // if the current number of buffered items is not enough
-    if (buffer->avail < nmax) {
-      // if |xxxxx]------[xxxxx| then |xxxxxxxxxxx][xxxxx|
-      if (buffer->end < currpos)
-        max = currpos - buffer->end;
-      // if |-----[xxxxxx]-----| then |-----[xxxxxxxxxxx]|
-      else
-        max = BUF_SIZE - buffer->end;
-
-      cnt = buf_fread(buffer, buffer->end, max);
-      buf_mod(&buffer->end, cnt);
-      buffer->avail += cnt;
-    }
-
-    if (buffer->avail < nmax) {
-      out[0] = '\0';
-      return;
-    }
-
-    memcpy(outcurs, &content[currpos], nmax);
-    buffer->avail -= nmax;
-    buf_move_it(buffer, nmax);
-    if (n <= nmax)
-      break;
-    outcurs += nmax;
-    n -= nmax;
+  if (buf_remaining(buffer) < n) {
+    out[0] = '\0';
+    return;
   }
+  memcpy(out, &buffer->content[buffer->it], n);
+  buffer->it += n;
 }
 
 void buf_forward (buffer_t *buffer, size_t n)
 {
-  buf_move_it(buffer, n);
-  buffer->avail -= n;
+  buffer->it += n;
 }
 
 void buf_rollback (buffer_t *buffer, size_t n)
@@ -192,8 +199,8 @@ void buf_rollback (buffer_t *buffer, size_t n)
     fprintf(stderr, "Warning: rollback without lock.\n");
     print_backtrace();
   }
-  buf_move_it_bw(buffer, n);
-  buffer->avail += n;
+  assert(n <= buffer->it);
+  buffer->it -= n;
 }
 
 void buf_rollback_and_unlock (buffer_t *buffer, size_t n)
@@ -204,76 +211,78 @@ void buf_rollback_and_unlock (buffer_t *buffer, size_t n)
 
 size_t buf_skipblank (buffer_t *buffer)
 {
-  bool waslocked = false;
-  if (!buffer->islocked) {
-    buf_lock(buffer);
-  } else {
-    waslocked = true;
-  }
-  size_t count = 0;
-  char next = buf_getchar(buffer);
-  while (ISBLANK(next)) {
-    next = buf_getchar(buffer);
-    count++;
-  }
-  buf_rollback(buffer, 1);
-  if (!waslocked)
-    buf_unlock(buffer);
-
-  if (next == '\0') {
-    buffer->avail = 0;
-  }
-  return count;
+  size_t start = buffer->it;
+  if (start >= buffer->size)
+    return 0;
+  const char *end = &buffer->content[buffer->size];
+  buffer->it = scan_blanks(&buffer->content[start], end) - buffer->content;
+  return buffer->it - start;
 }
 
 
 char buf_getchar_rollback (buffer_t *buffer)
 {
-  bool waslocked = true;
   buf_skipblank(buffer);
-  if (!buffer->islocked) {
-    buf_lock(buffer);
-    waslocked = false;
-  }
-  char next = buf_getchar(buffer);
-  buf_rollback(buffer, 1);
-  if (!waslocked)
-    buf_unlock(buffer);
-  return next;
+  if (buffer->it >= buffer->size)
+    return '\0';
+  return buffer->content[buffer->it];
+}
+
+const char *buf_ptr (buffer_t *buffer)
+{
+  return &buffer->content[buffer->it];
 }
 
+size_t buf_remaining (buffer_t *buffer)
+{
+  return buffer->it < buffer->size ? buffer->size - buffer->it : 0;
+}
+
+/**
+ * Prints the line on which the iterator currently is, and highlights the
+ * current character (green) and the lock position (blue)
+ */
 void buf_print (buffer_t *buffer)
 {
+  size_t it = buffer->it < buffer->size ? buffer->it : buffer->size;
+  size_t line = 1, start = 0, end = it;
+  for (size_t i = 0; i < it; i++) {
+    if (buffer->content[i] == '\n') {
+      line++;
+      start = i + 1;
+    }
+  }
+  while (end < buffer->size && buffer->content[end] != '\n')
+    end++;
+
   printf(COLOR_BLUE "#### <buffer> ####\n" COLOR_DEFAULT);
 #ifdef WIN32
-  printf(COLOR_GREEN "it: %u\nend: %u\navail: %u\nlock: %u\n" COLOR_DEFAULT,
+  printf(COLOR_GREEN "line: %u\nit: %u\nsize: %u\nlock: %u\n" COLOR_DEFAULT,
+      line,
       buffer->it,
-      buffer->end,
-      buffer->avail,
+      buffer->size,
       buffer->lock);
 #else
-  printf(COLOR_GREEN "it: %zu\nend: %zu\navail: %zu\nlock: %zu\n" COLOR_DEFAULT,
+  printf(COLOR_GREEN "line: %zu\nit: %zu\nsize: %zu\nlock: %zu\n" COLOR_DEFAULT,
+      line,
       buffer->it,
-      buffer->end,
-      buffer->avail,
+      buffer->size,
       buffer->lock);
 #endif
-  char *color = NULL;
-  for (size_t i = 0; i < BUF_SIZE; i++) {
-    if (buffer->it != i && buffer->end != i && (!buffer->islocked || buffer->lock != i)) {
-      printf("%c", buffer->content[i]);
-      continue;
-    }
-    if (buffer->it == i)
+  for (size_t i = start; i <= end && i < buffer->size; i++) {
+    char *color = NULL;
+    if (i == buffer->it)
       color = COLOR_BG_GREEN;
-    else if (buffer->end == i)
-      color = COLOR_BG_RED;
     else if (buffer->islocked && buffer->lock == i)
       color = COLOR_BG_BLUE;
-    if (buffer->content[i] == '\n')
-      printf("%s %s\n", color, COLOR_DEFAULT);
+
+    if (!color)
+      printf("%c", buffer->content[i]);
+    else if (buffer->content[i] == '\n')
+      printf("%s %s", color, COLOR_DEFAULT);
     else
       printf("%s%c" COLOR_DEFAULT, color, buffer->content[i]);
   }
+  printf("\n");
   printf(COLOR_BLUE "#### </buffer> ####\n" COLOR_DEFAULT);
 }
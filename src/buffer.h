@@ -2,27 +2,33 @@
 #ifndef BUFFER_H
 #include <stdio.h>
 #include <stdbool.h>
+#include "scan.h"
 
 #define LEXEM_SIZE 60
-#define BUF_SIZE 1024
-#define ISBLANK(chr) ((chr) == ' ' || (chr) == '\n' || (chr) == '\t')
+#define ISBLANK(chr) SCAN_IS(chr, SCAN_BLANK)
 
+/**
+ * The whole input is available in memory: it is either mmap'ed (regular
+ * files), or read at once (pipes, WIN32).
+ * Because nothing is ever overwritten, a rollback can go as far back as needed
+ */
 typedef struct buffer_t {
-  char content[BUF_SIZE];
+  char *content;
   FILE *fd;
+  size_t size; // number of bytes in content
   size_t it; // iterator
-  size_t end;
-  size_t avail; // available
-  size_t lock; // can't overwrite any char between lock and end, even if 'it' is moved
-  size_t bytesread;
-  size_t bytesreadsincelock;
-  size_t currchar;
+  size_t lock; // position of 'it' when buf_lock was called
+  size_t discarded; // bytes given back to the system, see buf_discard
   bool islocked;
-  bool eof;
+  bool ismapped;
 } buffer_t;
 
 void buf_print (buffer_t *buffer);
 void buf_init (buffer_t *buffer, FILE *fd);
+void buf_release (buffer_t *buffer);
+void buf_discard (buffer_t *buffer, size_t offset);
+/** the input is content itself, it is not released by buf_release **/
+void buf_init_memory (buffer_t *buffer, char *content, size_t size);
 bool buf_eof (buffer_t *buffer);
 bool buf_eof_strict (buffer_t *buffer);
 char buf_getchar (buffer_t *buffer);
@@ -36,5 +42,10 @@ void buf_unlock (buffer_t *buffer);
 void buf_rollback_and_unlock (buffer_t *buffer, size_t n);
 size_t buf_skipblank (buffer_t *buffer);
 
+/** direct access to the input, starting at the current position **/
+const char *buf_ptr (buffer_t *buffer);
+/** number of bytes between the current position and the end of input **/
+size_t buf_remaining (buffer_t *buffer);
+
 #define BUFFER_H
 #endif /* BUFFER_H */
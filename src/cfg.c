@@ -0,0 +1,504 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include "cfg.h"
+
+/**
+ * The control flow graph splits the instructions of a function into basic
+ * blocks, sequences of instructions always executed from the first to the
+ * last one. A block starts at a label (a jump can go there) or after a jump
+ * or a return (the execution does not simply continue there), and its
+ * successors are the blocks the execution can continue in:
+ *  - JUMP L: the block of L
+ *  - JUMP_<CMP> L: the next block and the block of L
+ *  - RETURN: none
+ *  - anything else: the next block
+ *
+ * The graph is built from the instruction array and is only valid as long
+ * as the array is not modified. The passes working on the graph mark the
+ * instructions to remove, then remove them with tac_remove_instrs.
+ */
+
+static
+bool cfg_ends_block (tac_opcode_e op)
+{
+  return TAC_IS_JUMP(op) || op == TAC_RETURN;
+}
+
+/**
+ * Gives the block starting at the label, CFG_NO_BLOCK if it is not a label
+ * of the function
+ */
+size_t cfg_label_block (cfg_t *cfg, long label)
+{
+  if (label < cfg->first_label || label >= cfg->first_label + (long)cfg->label_count)
+    return CFG_NO_BLOCK;
+  return cfg->label_blocks[label - cfg->first_label];
+}
+
+static
+void cfg_add_succ (cfg_block_t *block, size_t succ)
+{
+  if (succ == CFG_NO_BLOCK)
+    return;
+  /* a conditional jump to the next block has it twice */
+  if (block->succ_count == 1 && block->succs[0] == succ)
+    return;
+  block->succs[block->succ_count++] = succ;
+}
+
+/**
+ * Splits the function in blocks and links them
+ */
+cfg_t *cfg_build (tac_function_t *fn)
+{
+  cfg_t *cfg = calloc(1, sizeof(cfg_t));
+  cfg->fn = fn;
+  cfg->block_of = malloc((fn->count + 1) * sizeof(size_t));
+
+  tac_label_range(fn, &cfg->first_label, &cfg->label_count);
+  cfg->label_blocks = malloc((cfg->label_count + 1) * sizeof(size_t));
+  for (size_t l = 0; l < cfg->label_count; l++)
+    cfg->label_blocks[l] = CFG_NO_BLOCK;
+
+  /* leaders: the first instruction, the labels, and what follows a jump */
+  size_t capacity = 0;
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    bool leader = i == 0 || instr->op == TAC_LABEL ||
+                  cfg_ends_block(fn->instrs[i - 1].op);
+    if (leader) {
+      if (cfg->count == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        cfg->blocks = realloc(cfg->blocks, capacity * sizeof(cfg_block_t));
+      }
+      if (cfg->count > 0)
+        cfg->blocks[cfg->count - 1].end = i;
+      cfg->blocks[cfg->count++] = (cfg_block_t){ .first = i };
+    }
+    cfg->block_of[i] = cfg->count - 1;
+    if (instr->op == TAC_LABEL)
+      cfg->label_blocks[instr->dst.value - cfg->first_label] = cfg->count - 1;
+  }
+  if (cfg->count > 0)
+    cfg->blocks[cfg->count - 1].end = fn->count;
+
+  size_t edge_count = 0;
+  for (size_t b = 0; b < cfg->count; b++) {
+    cfg_block_t *block = &cfg->blocks[b];
+    tac_instr_t *last_instr = &fn->instrs[block->end - 1];
+    size_t next = b + 1 < cfg->count ? b + 1 : CFG_NO_BLOCK;
+    if (last_instr->op == TAC_JUMP)
+      cfg_add_succ(block, cfg_label_block(cfg, last_instr->dst.value));
+    else if (TAC_IS_COND_JUMP(last_instr->op)) {
+      cfg_add_succ(block, next);
+      cfg_add_succ(block, cfg_label_block(cfg, last_instr->dst.value));
+    }
+    else if (last_instr->op != TAC_RETURN)
+      cfg_add_succ(block, next);
+    edge_count += block->succ_count;
+  }
+
+  /* the predecessor lists share one array */
+  cfg->preds = malloc((edge_count + 1) * sizeof(size_t));
+  for (size_t b = 0; b < cfg->count; b++)
+    for (size_t s = 0; s < cfg->blocks[b].succ_count; s++)
+      cfg->blocks[cfg->blocks[b].succs[s]].pred_count++;
+  size_t *preds = cfg->preds;
+  for (size_t b = 0; b < cfg->count; b++) {
+    cfg->blocks[b].preds = preds;
+    preds += cfg->blocks[b].pred_count;
+    cfg->blocks[b].pred_count = 0;
+  }
+  for (size_t b = 0; b < cfg->count; b++) {
+    for (size_t s = 0; s < cfg->blocks[b].succ_count; s++) {
+      cfg_block_t *succ = &cfg->blocks[cfg->blocks[b].succs[s]];
+      succ->preds[succ->pred_count++] = b;
+    }
+  }
+  return cfg;
+}
+
+void cfg_release (cfg_t *cfg)
+{
+  free(cfg->blocks);
+  free(cfg->block_of);
+  free(cfg->label_blocks);
+  free(cfg->preds);
+  free(cfg->idom);
+  free(cfg->rpo_number);
+  if (cfg->dom_children)
+    free(cfg->dom_children[0]);
+  free(cfg->dom_children);
+  free(cfg->dom_child_count);
+  free(cfg);
+}
+
+/**
+ * Marks the blocks the execution can reach from the entry, with a depth
+ * first walk. The array is to be freed by the caller
+ */
+bool *cfg_reachable (cfg_t *cfg)
+{
+  bool *reachable = calloc(cfg->count + 1, sizeof(bool));
+  if (cfg->count == 0)
+    return reachable;
+
+  size_t *stack = malloc(cfg->count * sizeof(size_t));
+  size_t top = 0;
+  stack[top++] = 0;
+  reachable[0] = true;
+  while (top > 0) {
+    cfg_block_t *block = &cfg->blocks[stack[--top]];
+    for (size_t s = 0; s < block->succ_count; s++) {
+      if (!reachable[block->succs[s]]) {
+        reachable[block->succs[s]] = true;
+        stack[top++] = block->succs[s];
+      }
+    }
+  }
+  free(stack);
+  return reachable;
+}
+
+/**
+ * Immediate dominators, with the algorithm of Cooper, Harvey and Kennedy
+ * ("A Simple, Fast Dominance Algorithm"). A block d dominates b when every
+ * path from the entry to b goes through d, the immediate dominator of b is
+ * its closest dominator. The blocks are visited in reverse postorder, each
+ * one gets the common dominator of its processed predecessors, until
+ * nothing changes.
+ * Sets cfg->idom (the entry is its own immediate dominator, an unreachable
+ * block has CFG_NO_BLOCK), cfg->rpo_number and the dominator tree,
+ * cfg->dom_children
+ */
+void cfg_dominators (cfg_t *cfg)
+{
+  size_t count = cfg->count;
+  cfg->idom = malloc((count + 1) * sizeof(size_t));
+  cfg->rpo_number = malloc((count + 1) * sizeof(size_t));
+  cfg->dom_children = malloc((count + 1) * sizeof(size_t *));
+  cfg->dom_child_count = calloc(count + 1, sizeof(size_t));
+  cfg->dom_children[0] = NULL;
+  for (size_t b = 0; b < count; b++) {
+    cfg->idom[b] = CFG_NO_BLOCK;
+    cfg->rpo_number[b] = CFG_NO_BLOCK;
+  }
+  if (count == 0)
+    return;
+
+  /* postorder with an explicit stack: a block and its next successor */
+  size_t *order = malloc(count * sizeof(size_t));
+  size_t *stack = malloc(count * sizeof(size_t));
+  size_t *next_succ = calloc(count, sizeof(size_t));
+  bool *visited = calloc(count, sizeof(bool));
+  size_t order_count = 0, top = 0;
+  stack[top++] = 0;
+  visited[0] = true;
+  while (top > 0) {
+    cfg_block_t *block = &cfg->blocks[stack[top - 1]];
+    size_t *s = &next_succ[stack[top - 1]];
+    if (*s < block->succ_count) {
+      size_t succ = block->succs[(*s)++];
+      if (!visited[succ]) {
+        visited[succ] = true;
+        stack[top++] = succ;
+      }
+    }
+    else
+      order[order_count++] = stack[--top];
+  }
+  /* reverse it */
+  for (size_t i = 0; i < order_count / 2; i++) {
+    size_t tmp = order[i];
+    order[i] = order[order_count - 1 - i];
+    order[order_count - 1 - i] = tmp;
+  }
+  for (size_t i = 0; i < order_count; i++)
+    cfg->rpo_number[order[i]] = i;
+
+  cfg->idom[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 1; i < order_count; i++) {
+      cfg_block_t *block = &cfg->blocks[order[i]];
+      size_t new_idom = CFG_NO_BLOCK;
+      for (size_t p = 0; p < block->pred_count; p++) {
+        size_t pred = block->preds[p];
+        if (cfg->idom[pred] == CFG_NO_BLOCK)
+          continue;
+        if (new_idom == CFG_NO_BLOCK) {
+          new_idom = pred;
+          continue;
+        }
+        /* intersect: walk up from the deepest one until they meet */
+        size_t a = pred, b = new_idom;
+        while (a != b) {
+          while (cfg->rpo_number[a] > cfg->rpo_number[b])
+            a = cfg->idom[a];
+          while (cfg->rpo_number[b] > cfg->rpo_number[a])
+            b = cfg->idom[b];
+        }
+        new_idom = a;
+      }
+      if (cfg->idom[order[i]] != new_idom) {
+        cfg->idom[order[i]] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  /* the children of each block share one array */
+  for (size_t b = 1; b < count; b++)
+    if (cfg->idom[b] != CFG_NO_BLOCK)
+      cfg->dom_child_count[cfg->idom[b]]++;
+  size_t *children = malloc(count * sizeof(size_t));
+  for (size_t b = 0; b < count; b++) {
+    cfg->dom_children[b] = children;
+    children += cfg->dom_child_count[b];
+    cfg->dom_child_count[b] = 0;
+  }
+  for (size_t b = 1; b < count; b++)
+    if (cfg->idom[b] != CFG_NO_BLOCK)
+      cfg->dom_children[cfg->idom[b]][cfg->dom_child_count[cfg->idom[b]]++] = b;
+  free(visited);
+  free(next_succ);
+  free(stack);
+  free(order);
+}
+
+/**
+ * Tells whether dominator dominates block (a block dominates itself),
+ * cfg_dominators must have been called
+ */
+bool cfg_dominates (cfg_t *cfg, size_t dominator, size_t block)
+{
+  if (cfg->idom[block] == CFG_NO_BLOCK)
+    return false;
+  while (block != dominator && block != 0)
+    block = cfg->idom[block];
+  return block == dominator;
+}
+
+/**
+ * Finds the natural loops: an edge from a block to a block dominating it
+ * (the header) goes back to the start of a loop, its body is the header
+ * and the blocks which reach the source of the edge without going through
+ * the header. The loops with the same header are merged.
+ * Calls cfg_dominators, the array is released by cfg_release_loops
+ */
+cfg_loop_t *cfg_loops (cfg_t *cfg, size_t *count)
+{
+  cfg_dominators(cfg);
+  cfg_loop_t *loops = NULL;
+  size_t capacity = 0;
+  size_t *stack = malloc((cfg->count + 1) * sizeof(size_t));
+  *count = 0;
+  for (size_t b = 0; b < cfg->count; b++) {
+    for (size_t s = 0; s < cfg->blocks[b].succ_count; s++) {
+      size_t header = cfg->blocks[b].succs[s];
+      if (!cfg_dominates(cfg, header, b))
+        continue;
+
+      cfg_loop_t *loop = NULL;
+      for (size_t l = 0; l < *count; l++)
+        if (loops[l].header == header)
+          loop = &loops[l];
+      if (!loop) {
+        if (*count == capacity) {
+          capacity = capacity ? capacity * 2 : 4;
+          loops = realloc(loops, capacity * sizeof(cfg_loop_t));
+        }
+        loop = &loops[(*count)++];
+        loop->header = header;
+        loop->body = calloc(cfg->count, sizeof(bool));
+        loop->body[header] = true;
+        loop->size = 1;
+      }
+
+      size_t top = 0;
+      if (!loop->body[b]) {
+        loop->body[b] = true;
+        loop->size++;
+        stack[top++] = b;
+      }
+      while (top > 0) {
+        cfg_block_t *block = &cfg->blocks[stack[--top]];
+        for (size_t p = 0; p < block->pred_count; p++) {
+          size_t pred = block->preds[p];
+          if (!loop->body[pred] && cfg->idom[pred] != CFG_NO_BLOCK) {
+            loop->body[pred] = true;
+            loop->size++;
+            stack[top++] = pred;
+          }
+        }
+      }
+    }
+  }
+  free(stack);
+  return loops;
+}
+
+void cfg_release_loops (cfg_loop_t *loops, size_t count)
+{
+  for (size_t l = 0; l < count; l++)
+    free(loops[l].body);
+  free(loops);
+}
+
+/**
+ * A jump to the label right after it (labels can follow each other) does
+ * nothing. A conditional one is removed with its COMPARE
+ */
+static
+size_t cfg_mark_dead_jumps (tac_function_t *fn, bool *removed)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (removed[i] || !TAC_IS_JUMP(instr->op))
+      continue;
+    for (size_t next = i + 1; next < fn->count; next++) {
+      if (removed[next])
+        continue;
+      if (fn->instrs[next].op != TAC_LABEL)
+        break;
+      if (fn->instrs[next].dst.value == instr->dst.value) {
+        removed[i] = true;
+        count++;
+        if (TAC_IS_COND_JUMP(instr->op) && i > 0 &&
+            fn->instrs[i - 1].op == TAC_COMPARE && !removed[i - 1]) {
+          removed[i - 1] = true;
+          count++;
+        }
+        break;
+      }
+    }
+  }
+  return count;
+}
+
+/**
+ * Removes the blocks no path from the entry goes to, like the code after a
+ * return, then the jumps to the next instruction.
+ * Returns the number of removed instructions
+ */
+size_t cfg_remove_unreachable (tac_function_t *fn)
+{
+  if (fn->count == 0)
+    return 0;
+
+  cfg_t *cfg = cfg_build(fn);
+  bool *reachable = cfg_reachable(cfg);
+  bool *removed = calloc(fn->count, sizeof(bool));
+  size_t count = 0;
+  for (size_t b = 0; b < cfg->count; b++) {
+    if (reachable[b])
+      continue;
+    for (size_t i = cfg->blocks[b].first; i < cfg->blocks[b].end; i++)
+      removed[i] = true;
+    count += cfg->blocks[b].end - cfg->blocks[b].first;
+  }
+  count += cfg_mark_dead_jumps(fn, removed);
+
+  tac_remove_instrs(fn, removed);
+  free(removed);
+  free(reachable);
+  cfg_release(cfg);
+  return count;
+}
+
+/**
+ * The label a jump to label really ends at: the labels following each
+ * other are merged into the first one of the run (canonical), and a label
+ * followed by an unconditional jump is replaced by the jump target.
+ * positions gives the position of each label, a cycle of jumps stops the
+ * search
+ */
+static
+long cfg_jump_target (tac_function_t *fn, long first_label, size_t *positions,
+    long *canonical, size_t label_count, long label)
+{
+  for (size_t steps = 0; steps < label_count; steps++) {
+    size_t next = positions[label - first_label];
+    while (next < fn->count && fn->instrs[next].op == TAC_LABEL)
+      next++;
+    if (next == fn->count || fn->instrs[next].op != TAC_JUMP ||
+        fn->instrs[next].dst.value == label)
+      break;
+    label = fn->instrs[next].dst.value;
+  }
+  return canonical[label - first_label];
+}
+
+/**
+ * Jump threading:
+ *  - a jump to a jump goes directly to the final target:
+ *      JUMP_LT L1 ... L1: L2: JUMP L5  =>  JUMP_LT L5
+ *  - labels following each other are merged, the labels nothing jumps to are
+ *    removed
+ *  - a conditional jump over an unconditional one is inverted:
+ *      JUMP_LT L1; JUMP L5; L1:  =>  JUMP_GTE L5; L1:
+ *  - a jump to the label right after it is removed, see cfg_mark_dead_jumps
+ * Returns the number of removed instructions
+ */
+size_t cfg_thread_jumps (tac_function_t *fn)
+{
+  long first;
+  size_t label_count;
+  tac_label_range(fn, &first, &label_count);
+  if (label_count == 0)
+    return 0;
+
+  size_t *positions = malloc(label_count * sizeof(size_t));
+  long *canonical = malloc(label_count * sizeof(long));
+  size_t *references = calloc(label_count, sizeof(size_t));
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (instr->op != TAC_LABEL)
+      continue;
+    positions[instr->dst.value - first] = i;
+    bool follows = i > 0 && fn->instrs[i - 1].op == TAC_LABEL;
+    canonical[instr->dst.value - first] =
+      follows ? canonical[fn->instrs[i - 1].dst.value - first] : instr->dst.value;
+  }
+
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (TAC_IS_JUMP(instr->op))
+      instr->dst.value = cfg_jump_target(fn, first, positions, canonical,
+                                         label_count, instr->dst.value);
+  }
+
+  bool *removed = calloc(fn->count, sizeof(bool));
+  size_t count = 0;
+  for (size_t i = 0; i + 2 < fn->count; i++) {
+    tac_instr_t *cond = &fn->instrs[i], *jump = &fn->instrs[i + 1];
+    if (!TAC_IS_COND_JUMP(cond->op) || jump->op != TAC_JUMP ||
+        fn->instrs[i + 2].op != TAC_LABEL ||
+        canonical[fn->instrs[i + 2].dst.value - first] != cond->dst.value)
+      continue;
+    cond->op = tac_inv_jump(cond->op);
+    cond->dst = jump->dst;
+    removed[i + 1] = true;
+    count++;
+  }
+
+  count += cfg_mark_dead_jumps(fn, removed);
+  for (size_t i = 0; i < fn->count; i++)
+    if (!removed[i] && TAC_IS_JUMP(fn->instrs[i].op))
+      references[fn->instrs[i].dst.value - first]++;
+  for (size_t i = 0; i < fn->count; i++) {
+    if (fn->instrs[i].op == TAC_LABEL && !references[fn->instrs[i].dst.value - first]) {
+      removed[i] = true;
+      count++;
+    }
+  }
+
+  tac_remove_instrs(fn, removed);
+  free(removed);
+  free(references);
+  free(canonical);
+  free(positions);
+  return count;
+}
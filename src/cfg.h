@@ -0,0 +1,62 @@
+#ifndef CFG_H
+#define CFG_H
+#include <stdbool.h>
+#include "tac.h"
+
+#define CFG_NO_BLOCK ((size_t)-1)
+
+/**
+ * A basic block: the instructions [first, end) of the function. Only its
+ * first instruction can be a label, only its last one a jump or a return
+ */
+typedef struct cfg_block_t {
+  size_t first;
+  size_t end;
+  size_t succs[2]; // the jump target comes after the next block
+  size_t succ_count;
+  size_t *preds; // points into the preds array of the cfg
+  size_t pred_count;
+} cfg_block_t;
+
+/**
+ * Control flow graph of a function, blocks[0] is the entry.
+ * It describes fn->instrs as they were when it was built
+ */
+typedef struct cfg_t {
+  tac_function_t *fn;
+  cfg_block_t *blocks;
+  size_t count;
+  size_t *block_of; // block of each instruction
+  long first_label; // the labels are indexed from it, see tac_label_range
+  size_t label_count;
+  size_t *label_blocks; // block of each label, or CFG_NO_BLOCK
+  size_t *preds;
+  size_t *idom; // immediate dominator of each block, see cfg_dominators
+  size_t *rpo_number; // position of each block in the reverse postorder
+  size_t **dom_children; // blocks each block immediately dominates
+  size_t *dom_child_count;
+} cfg_t;
+
+/**
+ * A natural loop: the header, which dominates the body, and the blocks of
+ * the body (header included)
+ */
+typedef struct cfg_loop_t {
+  size_t header;
+  bool *body; // indexed by block
+  size_t size; // number of blocks
+} cfg_loop_t;
+
+cfg_t *cfg_build (tac_function_t *fn);
+void cfg_release (cfg_t *cfg);
+size_t cfg_label_block (cfg_t *cfg, long label);
+bool *cfg_reachable (cfg_t *cfg);
+void cfg_dominators (cfg_t *cfg);
+bool cfg_dominates (cfg_t *cfg, size_t dominator, size_t block);
+cfg_loop_t *cfg_loops (cfg_t *cfg, size_t *count);
+void cfg_release_loops (cfg_loop_t *loops, size_t count);
+
+size_t cfg_remove_unreachable (tac_function_t *fn);
+size_t cfg_thread_jumps (tac_function_t *fn);
+
+#endif /* ifndef CFG_H */
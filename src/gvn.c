@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "gvn.h"
+#include "cfg.h"
+
+/**
+ * Value numbering: common subexpression elimination
+ *
+ * An operation computing again the value of an earlier one, the same
+ * operator on the same operands, is replaced by a copy of the earlier tmp,
+ * and the uses of its result read the earlier tmp instead:
+ *
+ *   tmp0 = a + b                   tmp0 = a + b
+ *   tmp1 = a - b                   tmp1 = a - b
+ *   tmp2 = tmp0 * tmp1      =>     tmp2 = tmp0 * tmp1
+ *   tmp3 = b + a                   tmp5 = tmp2 + tmp2
+ *   tmp4 = a - b
+ *   tmp5 = tmp2 + tmp4             (tmp3, tmp4 and their product reuse
+ *                                   tmp0, tmp1 and tmp2)
+ * The copies nobody reads any more are removed, the earlier tmp lives
+ * longer and the register allocator keeps it in a register.
+ *
+ * An operand is the same value as long as it is not written again:
+ *  - the immediate values, the tmps written once (the result of the
+ *    earlier operation dominates the later one, it is alive there) and the
+ *    variables the function never writes (its unchanged arguments) keep
+ *    their value in the whole function: the operations on them are found
+ *    in the blocks the earlier one dominates (global numbering)
+ *  - the variables the function writes, and out of SSA form the tmps of the
+ *    phis, change: each write and each block gives them a new version, the
+ *    operations on them are only found later in the same block (local
+ *    numbering)
+ * ADD and MUL are commutative, their operands are sorted. A division found
+ * again is not executed twice: the earlier one would have failed first.
+ *
+ * The available operations are in a hash table, the blocks are visited in
+ * a preorder of the dominator tree (cfg_dominators): leaving a block
+ * removes the operations it added, which the next subtree does not see.
+ */
+
+#define GVN_NONE ((size_t)-1)
+
+/**
+ * An available operation, result = src1 op src2
+ */
+typedef struct gvn_value_t {
+  tac_opcode_e op;
+  tac_operand_t src1;
+  tac_operand_t src2;
+  long version1;
+  long version2;
+  tac_operand_t result;
+  size_t bucket;
+  size_t next; // in the bucket
+} gvn_value_t;
+
+typedef struct gvn_t {
+  tac_function_t *fn;
+  cfg_t *cfg;
+  size_t *buckets; // first value of each bucket, or GVN_NONE
+  size_t bucket_count; // power of 2
+  gvn_value_t *values; // stack, the last block adds the last ones
+  size_t value_count;
+  size_t value_capacity;
+  tac_operand_t *leaders; // operand replacing each tmp, or none
+  long *leader_log; // tmps given a leader, in order
+  size_t leader_count;
+  bool *changing; // the variables then the tmps written more than once
+  long *versions; // of the changing operands
+  size_t *version_blocks; // block which set the version
+  long last_version;
+} gvn_t;
+
+/**
+ * Index of an operand in changing, or -1 when it keeps its value
+ */
+static
+long gvn_changing (gvn_t *gvn, tac_operand_t *operand)
+{
+  long index = -1;
+  if (operand->kind == TAC_OPND_LOCAL)
+    index = operand->value;
+  else if (operand->kind == TAC_OPND_TMP)
+    index = gvn->fn->local_count + operand->value;
+  return index >= 0 && gvn->changing[index] ? index : -1;
+}
+
+/**
+ * Version of an operand in the block: 0 when it keeps its value, else a
+ * new one the first time the block reads it
+ */
+static
+long gvn_version (gvn_t *gvn, tac_operand_t *operand, size_t block)
+{
+  long index = gvn_changing(gvn, operand);
+  if (index < 0)
+    return 0;
+  if (gvn->version_blocks[index] != block) {
+    gvn->versions[index] = ++gvn->last_version;
+    gvn->version_blocks[index] = block;
+  }
+  return gvn->versions[index];
+}
+
+static
+size_t gvn_hash (gvn_value_t *value, size_t bucket_count)
+{
+  size_t hash = value->op;
+  hash = hash * 31 + value->src1.kind;
+  hash = hash * 31 + value->src1.value;
+  hash = hash * 31 + value->version1;
+  hash = hash * 31 + value->src2.kind;
+  hash = hash * 31 + value->src2.value;
+  hash = hash * 31 + value->version2;
+  return (hash ^ (hash >> 17)) & (bucket_count - 1);
+}
+
+/**
+ * Looks for the operation of instr, or adds it when it is not available.
+ * Returns the tmp holding its value, or none when it was added
+ */
+static
+tac_operand_t gvn_lookup (gvn_t *gvn, tac_instr_t *instr, size_t block)
+{
+  gvn_value_t value = {
+    .op = instr->op,
+    .src1 = instr->src1,
+    .src2 = instr->src2,
+    .version1 = gvn_version(gvn, &instr->src1, block),
+    .version2 = gvn_version(gvn, &instr->src2, block),
+    .result = instr->dst
+  };
+  if ((value.op == TAC_ADD || value.op == TAC_MUL) &&
+      (value.src1.kind > value.src2.kind ||
+       (value.src1.kind == value.src2.kind && value.src1.value > value.src2.value))) {
+    value.src1 = instr->src2;
+    value.src2 = instr->src1;
+    long version = value.version1;
+    value.version1 = value.version2;
+    value.version2 = version;
+  }
+  value.bucket = gvn_hash(&value, gvn->bucket_count);
+
+  for (size_t v = gvn->buckets[value.bucket]; v != GVN_NONE; v = gvn->values[v].next) {
+    gvn_value_t *found = &gvn->values[v];
+    if (found->op == value.op && found->version1 == value.version1 &&
+        found->version2 == value.version2 &&
+        tac_operand_equals(&found->src1, &value.src1) &&
+        tac_operand_equals(&found->src2, &value.src2))
+      return found->result;
+  }
+
+  if (gvn->value_count == gvn->value_capacity) {
+    gvn->value_capacity = gvn->value_capacity ? gvn->value_capacity * 2 : 64;
+    gvn->values = realloc(gvn->values, gvn->value_capacity * sizeof(gvn_value_t));
+  }
+  value.next = gvn->buckets[value.bucket];
+  gvn->buckets[value.bucket] = gvn->value_count;
+  gvn->values[gvn->value_count++] = value;
+  return tac_none();
+}
+
+static
+void gvn_set_leader (gvn_t *gvn, long tmp, tac_operand_t leader)
+{
+  gvn->leaders[tmp] = leader;
+  gvn->leader_log[gvn->leader_count++] = tmp;
+}
+
+/**
+ * Tells whether the operand has the same value everywhere its definition
+ * dominates, and can replace a tmp there
+ */
+static
+bool gvn_is_stable (gvn_t *gvn, tac_operand_t *operand)
+{
+  return (operand->kind == TAC_OPND_IMM || operand->kind == TAC_OPND_LOCAL ||
+          operand->kind == TAC_OPND_TMP) && gvn_changing(gvn, operand) < 0;
+}
+
+static
+void gvn_block (gvn_t *gvn, size_t b, bool *replaced)
+{
+  tac_function_t *fn = gvn->fn;
+  for (size_t i = gvn->cfg->blocks[b].first; i < gvn->cfg->blocks[b].end; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (instr->src1.kind == TAC_OPND_TMP && gvn->leaders[instr->src1.value].kind != TAC_OPND_NONE)
+      instr->src1 = gvn->leaders[instr->src1.value];
+    if (instr->src2.kind == TAC_OPND_TMP && gvn->leaders[instr->src2.value].kind != TAC_OPND_NONE)
+      instr->src2 = gvn->leaders[instr->src2.value];
+
+    long changing = gvn_changing(gvn, &instr->dst);
+    if (changing >= 0) {
+      gvn->versions[changing] = ++gvn->last_version;
+      gvn->version_blocks[changing] = b;
+      continue;
+    }
+    if (instr->dst.kind != TAC_OPND_TMP)
+      continue;
+
+    /* a copy of a stable value: its uses read the value itself */
+    if (instr->op == TAC_ASSIGN && gvn_is_stable(gvn, &instr->src1)) {
+      gvn_set_leader(gvn, instr->dst.value, instr->src1);
+      replaced[i] = true;
+    }
+    else if (TAC_IS_ARITHMETIC(instr->op)) {
+      tac_operand_t earlier = gvn_lookup(gvn, instr, b);
+      if (earlier.kind == TAC_OPND_NONE)
+        continue;
+      *instr = (tac_instr_t){ .op = TAC_ASSIGN, .dst = instr->dst, .src1 = earlier };
+      gvn_set_leader(gvn, instr->dst.value, earlier);
+      replaced[i] = true;
+    }
+  }
+}
+
+/**
+ * Replaces the operations of a function computing a value already
+ * available by the tmp holding it.
+ * Returns the number of removed instructions
+ */
+size_t gvn_function (tac_function_t *fn)
+{
+  cfg_t *cfg = cfg_build(fn);
+  if (cfg->count == 0) {
+    cfg_release(cfg);
+    return 0;
+  }
+  cfg_dominators(cfg);
+
+  size_t bucket_count = 64;
+  while (bucket_count < fn->count)
+    bucket_count *= 2;
+  size_t changing_count = fn->local_count + fn->tmp_count;
+  gvn_t gvn = {
+    .fn = fn,
+    .cfg = cfg,
+    .buckets = malloc(bucket_count * sizeof(size_t)),
+    .bucket_count = bucket_count,
+    .leaders = malloc((fn->tmp_count + 1) * sizeof(tac_operand_t)),
+    .leader_log = malloc((fn->tmp_count + 1) * sizeof(long)),
+    .changing = calloc(changing_count + 1, sizeof(bool)),
+    .versions = calloc(changing_count + 1, sizeof(long)),
+    .version_blocks = malloc((changing_count + 1) * sizeof(size_t))
+  };
+  for (size_t h = 0; h < bucket_count; h++)
+    gvn.buckets[h] = GVN_NONE;
+  for (size_t t = 0; t < fn->tmp_count; t++)
+    gvn.leaders[t] = tac_none();
+  for (size_t c = 0; c < changing_count; c++)
+    gvn.version_blocks[c] = GVN_NONE;
+  bool *written = calloc(fn->tmp_count + 1, sizeof(bool));
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_operand_t *dst = &fn->instrs[i].dst;
+    if (dst->kind == TAC_OPND_LOCAL)
+      gvn.changing[dst->value] = true;
+    else if (dst->kind == TAC_OPND_TMP) {
+      gvn.changing[fn->local_count + dst->value] = written[dst->value];
+      written[dst->value] = true;
+    }
+  }
+  free(written);
+
+  /* preorder walk of the dominator tree, a block is pushed again (~b) to
+   * forget what it added once its subtree is done */
+  bool *replaced = calloc(fn->count + 1, sizeof(bool));
+  size_t *value_marks = malloc(cfg->count * sizeof(size_t));
+  size_t *leader_marks = malloc(cfg->count * sizeof(size_t));
+  size_t *stack = malloc(2 * cfg->count * sizeof(size_t));
+  size_t top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    size_t entry = stack[--top];
+    if (entry > cfg->count) {
+      size_t b = ~entry;
+      while (gvn.value_count > value_marks[b]) {
+        gvn_value_t *value = &gvn.values[--gvn.value_count];
+        gvn.buckets[value->bucket] = value->next;
+      }
+      while (gvn.leader_count > leader_marks[b])
+        gvn.leaders[gvn.leader_log[--gvn.leader_count]] = tac_none();
+      continue;
+    }
+    value_marks[entry] = gvn.value_count;
+    leader_marks[entry] = gvn.leader_count;
+    gvn_block(&gvn, entry, replaced);
+    stack[top++] = ~entry;
+    for (size_t c = cfg->dom_child_count[entry]; c-- > 0;)
+      stack[top++] = cfg->dom_children[entry][c];
+  }
+
+  /* the copies are removed when nothing reads their tmp any more */
+  bool *used = calloc(fn->tmp_count + 1, sizeof(bool));
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (instr->src1.kind == TAC_OPND_TMP)
+      used[instr->src1.value] = true;
+    if (instr->src2.kind == TAC_OPND_TMP)
+      used[instr->src2.value] = true;
+  }
+  size_t removed = 0;
+  for (size_t i = 0; i < fn->count; i++) {
+    replaced[i] = replaced[i] && !used[fn->instrs[i].dst.value];
+    removed += replaced[i];
+  }
+  if (removed > 0)
+    tac_remove_instrs(fn, replaced);
+
+  free(used);
+  free(stack);
+  free(leader_marks);
+  free(value_marks);
+  free(replaced);
+  free(gvn.version_blocks);
+  free(gvn.versions);
+  free(gvn.changing);
+  free(gvn.leader_log);
+  free(gvn.leaders);
+  free(gvn.values);
+  free(gvn.buckets);
+  cfg_release(cfg);
+  return removed;
+}
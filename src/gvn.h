@@ -0,0 +1,7 @@
+#ifndef GVN_H
+#define GVN_H
+#include "tac.h"
+
+size_t gvn_function (tac_function_t *fn);
+
+#endif /* ifndef GVN_H */
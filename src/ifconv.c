@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "ifconv.h"
+#include "options.h"
+
+/**
+ * If-conversion: the small branches become conditional moves
+ *
+ * A branch which only chooses the value of a variable costs a misprediction
+ * each time the processor guesses its condition wrong, which happens a lot
+ * when the condition depends on the data. When its arms are a few
+ * operations which can't fail, both of them are computed before the
+ * COMPARE, then a conditional move (cmov<cc>) keeps the value of the arm
+ * the condition chooses:
+ *
+ *   COMPARE a b                  tmp4 = a - b
+ *   JUMP_LTE L1                  tmp5 = b - a
+ *   x = a - b                    COMPARE a b
+ *   JUMP L2              =>      x = tmp4
+ * L1:                            CMOV_LTE tmp5 x
+ *   x = b - a
+ * L2:
+ *
+ * Without sinon (a triangle), the variable keeps its value when the
+ * condition is false:
+ *
+ *   COMPARE x $0                 tmp2 = $0 - x
+ *   JUMP_GTE L1          =>      COMPARE x $0
+ *   x = $0 - x                   CMOV_LT tmp2 x
+ * L1:
+ *
+ * An arm is a sequence of ASSIGN, +, -, * and / by a constant (not 0 nor
+ * -1, see licm.c), the last one writing the variable, or the tmp of a phi
+ * out of SSA form (see ssa.c). The ones before it can only write tmps
+ * which are not used outside of the arm: computing them on both paths
+ * changes nothing else. Both arms write the same variable. Only the branch
+ * jumps to its labels, except to the one after it, which is kept then.
+ *
+ * Both arms now run each time: a branch is converted when the cost of its
+ * arms is at most options.cmov_cost (--cmov-cost=<n>, 0 converts nothing),
+ * an operation costs 1, a multiplication IFCONV_MUL_COST and a division
+ * IFCONV_DIV_COST.
+ * Only copies (movq) are between the COMPARE and the CMOVs, they don't
+ * change the flags. The pass runs after the other optimizations, which
+ * don't know the CMOVs: the copy of the function kept for inlining (see
+ * inline_register) still has its branches, converted again in its callers.
+ */
+
+#define IFCONV_MUL_COST 3
+#define IFCONV_DIV_COST 8
+
+/**
+ * An arm of a branch: the instructions from first to end (excluded), the
+ * last one writes result
+ */
+typedef struct ifconv_arm_t {
+  size_t first;
+  size_t end;
+  tac_operand_t result;
+  size_t cost;
+} ifconv_arm_t;
+
+/**
+ * A branch which can be converted, from its COMPARE to end (excluded).
+ * The second arm runs when the jump is taken, it is empty (end == 0)
+ * without sinon
+ */
+typedef struct ifconv_branch_t {
+  tac_opcode_e jump;
+  ifconv_arm_t arms[2];
+  long join; // label after the branch
+  bool keep_join; // other jumps go to join
+  size_t end;
+} ifconv_branch_t;
+
+typedef struct ifconv_t {
+  tac_function_t *fn;
+  size_t *refs; // jumps to each label, from the first label of the function
+  long first_label;
+  size_t *occurrences; // operands of each tmp in the function
+} ifconv_t;
+
+/**
+ * Gives the cost of an operation which can be computed on both paths of a
+ * branch, 0 for the other instructions
+ */
+static
+size_t ifconv_cost (tac_instr_t *instr)
+{
+  switch (instr->op) {
+  case TAC_ASSIGN:
+  case TAC_ADD:
+  case TAC_SUB:
+    return 1;
+  case TAC_MUL:
+    return IFCONV_MUL_COST;
+  case TAC_DIV:
+    if (instr->src2.kind == TAC_OPND_IMM && instr->src2.value != 0 &&
+        instr->src2.value != -1)
+      return IFCONV_DIV_COST;
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * Reads the arm starting at first, see the top of the file
+ */
+static
+bool ifconv_arm (ifconv_t *ic, size_t first, ifconv_arm_t *arm)
+{
+  tac_function_t *fn = ic->fn;
+  *arm = (ifconv_arm_t){ .first = first, .end = first };
+  while (arm->end < fn->count && ifconv_cost(&fn->instrs[arm->end]) > 0)
+    arm->cost += ifconv_cost(&fn->instrs[arm->end++]);
+  if (arm->end == first)
+    return false;
+  arm->result = fn->instrs[arm->end - 1].dst;
+
+  for (size_t i = first; i + 1 < arm->end; i++) {
+    tac_operand_t *dst = &fn->instrs[i].dst;
+    if (dst->kind != TAC_OPND_TMP)
+      return false;
+    size_t count = 0;
+    for (size_t j = first; j < arm->end; j++) {
+      tac_instr_t *instr = &fn->instrs[j];
+      count += tac_operand_equals(&instr->dst, dst) +
+               tac_operand_equals(&instr->src1, dst) +
+               tac_operand_equals(&instr->src2, dst);
+    }
+    if (count != ic->occurrences[dst->value])
+      return false;
+  }
+  return true;
+}
+
+static
+bool ifconv_is_label (ifconv_t *ic, size_t pos, long label)
+{
+  return pos < ic->fn->count && ic->fn->instrs[pos].op == TAC_LABEL &&
+         ic->fn->instrs[pos].dst.value == label;
+}
+
+/**
+ * Recognizes a branch which can be converted at the position pos: a
+ * COMPARE, the jump, the first arm then the label the jump goes to, or a
+ * jump after the first arm, the label, the second arm and the label after
+ */
+static
+bool ifconv_match (ifconv_t *ic, size_t pos, ifconv_branch_t *branch)
+{
+  tac_function_t *fn = ic->fn;
+  if (pos + 2 >= fn->count || fn->instrs[pos].op != TAC_COMPARE ||
+      !TAC_IS_COND_JUMP(fn->instrs[pos + 1].op))
+    return false;
+  long target = fn->instrs[pos + 1].dst.value;
+  *branch = (ifconv_branch_t){ .jump = fn->instrs[pos + 1].op };
+  if (!ifconv_arm(ic, pos + 2, &branch->arms[0]))
+    return false;
+
+  size_t end = branch->arms[0].end;
+  if (ifconv_is_label(ic, end, target)) {
+    branch->join = target;
+    branch->end = end + 1;
+  }
+  else {
+    tac_instr_t *jump = &fn->instrs[end];
+    if (end == fn->count || jump->op != TAC_JUMP ||
+        !ifconv_is_label(ic, end + 1, target) || ic->refs[target - ic->first_label] != 1 ||
+        !ifconv_arm(ic, end + 2, &branch->arms[1]) ||
+        !ifconv_is_label(ic, branch->arms[1].end, jump->dst.value) ||
+        !tac_operand_equals(&branch->arms[0].result, &branch->arms[1].result))
+      return false;
+    branch->join = jump->dst.value;
+    branch->end = branch->arms[1].end + 1;
+  }
+  branch->keep_join = ic->refs[branch->join - ic->first_label] > 1;
+  return true;
+}
+
+/**
+ * Copies an arm to the end of instrs and gives the value it computes: the
+ * operand of its last instruction when it is a copy, else a new tmp the
+ * last instruction writes instead of the variable
+ */
+static
+tac_operand_t ifconv_speculate (tac_function_t *fn, ifconv_arm_t *arm,
+    tac_instr_t *instrs, size_t *n)
+{
+  for (size_t i = arm->first; i + 1 < arm->end; i++)
+    instrs[(*n)++] = fn->instrs[i];
+  tac_instr_t last = fn->instrs[arm->end - 1];
+  if (last.op == TAC_ASSIGN)
+    return last.src1;
+  last.dst = tac_new_tmp(fn);
+  instrs[(*n)++] = last;
+  return last.dst;
+}
+
+/**
+ * Writes the converted branch whose COMPARE is at pos to the end of
+ * instrs. A value which is already the one of the variable needs no move
+ */
+static
+void ifconv_convert (tac_function_t *fn, size_t pos, ifconv_branch_t *branch,
+    tac_instr_t *instrs, size_t *n)
+{
+  tac_operand_t result = branch->arms[0].result;
+  tac_operand_t first = ifconv_speculate(fn, &branch->arms[0], instrs, n);
+  tac_operand_t second = result;
+  if (branch->arms[1].end > 0)
+    second = ifconv_speculate(fn, &branch->arms[1], instrs, n);
+  instrs[(*n)++] = fn->instrs[pos];
+
+  if (!tac_operand_equals(&second, &result)) {
+    if (!tac_operand_equals(&first, &result))
+      instrs[(*n)++] = (tac_instr_t){ .op = TAC_ASSIGN, .dst = result, .src1 = first };
+    instrs[(*n)++] = (tac_instr_t){ .op = TAC_JUMP_TO_CMOV(branch->jump),
+                                    .dst = result, .src1 = second };
+  }
+  else if (!tac_operand_equals(&first, &result))
+    instrs[(*n)++] = (tac_instr_t){ .op = TAC_JUMP_TO_CMOV(tac_inv_jump(branch->jump)),
+                                    .dst = result, .src1 = first };
+  if (branch->keep_join)
+    instrs[(*n)++] = (tac_instr_t){ .op = TAC_LABEL, .dst = tac_label(branch->join) };
+}
+
+/**
+ * Converts the small branches of a function to conditional moves, see the
+ * top of the file.
+ * Returns the number of converted branches
+ */
+size_t ifconv_function (tac_function_t *fn)
+{
+  ifconv_t ic = { .fn = fn };
+  size_t label_count;
+  tac_label_range(fn, &ic.first_label, &label_count);
+  ic.refs = calloc(label_count + 1, sizeof(size_t));
+  ic.occurrences = calloc(fn->tmp_count + 1, sizeof(size_t));
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (TAC_IS_JUMP(instr->op))
+      ic.refs[instr->dst.value - ic.first_label]++;
+    tac_operand_t *operands[] = { &instr->dst, &instr->src1, &instr->src2 };
+    for (size_t o = 0; o < sizeof(operands) / sizeof(operands[0]); o++)
+      if (operands[o]->kind == TAC_OPND_TMP)
+        ic.occurrences[operands[o]->value]++;
+  }
+
+  /* a converted branch never has more instructions than before */
+  tac_instr_t *instrs = malloc((fn->count + 1) * sizeof(tac_instr_t));
+  size_t n = 0, candidates = 0, converted = 0;
+  for (size_t i = 0; i < fn->count; ) {
+    ifconv_branch_t branch;
+    if (!ifconv_match(&ic, i, &branch)) {
+      instrs[n++] = fn->instrs[i++];
+      continue;
+    }
+    candidates++;
+    if (branch.arms[0].cost + branch.arms[1].cost > options.cmov_cost) {
+      instrs[n++] = fn->instrs[i++];
+      continue;
+    }
+    ifconv_convert(fn, i, &branch, instrs, &n);
+    converted++;
+    i = branch.end;
+  }
+
+  if (converted > 0) {
+    free(fn->instrs);
+    fn->instrs = instrs;
+    fn->capacity = fn->count + 1;
+    fn->count = n;
+  }
+  else
+    free(instrs);
+  free(ic.refs);
+  free(ic.occurrences);
+  if (options.report & REPORT_CMOV)
+    printf("cmov: %s: %zu/%zu branches converted\n", fn->name, converted, candidates);
+  return converted;
+}
@@ -0,0 +1,10 @@
+#ifndef IFCONV_H
+#define IFCONV_H
+#include "tac.h"
+
+/* largest cost of the arms of a converted branch, see --cmov-cost */
+#define IFCONV_DEFAULT_COST 4
+
+size_t ifconv_function (tac_function_t *fn);
+
+#endif /* ifndef IFCONV_H */
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "inline.h"
+#include "cfg.h"
+
+/**
+ * Inlining of the small leaf functions
+ *
+ * A call costs more than the few instructions of a small function: the
+ * PARAMs, the call, the prolog saving the arguments in their slots, the
+ * epilog. The body of the called function replaces the call:
+ *
+ *   PARAM x                      tmp9 = x + $3
+ *   PARAM $3                     ...
+ *   CALL operation2 tmp4   =>    tmp4 = tmp12
+ *                                JUMP L7
+ *                                ...
+ *                              L7:
+ * An argument the called function never writes is replaced by the value
+ * given to the PARAM, which nothing changes during the inlined body. The
+ * other arguments and the local variables get new slots in the caller
+ * (named <function>.<variable>), copied from the PARAMs for the arguments.
+ * The tmps and the labels get new numbers, and the RETURNs write the result
+ * of the call then jump after the inlined body. The optimizations which follow (ssa.c, gvn.c, licm.c)
+ * then see the inlined code with the one of the caller.
+ *
+ * Only the functions which call no other function are inlined (the leaf
+ * functions): a function inlined in itself, or in a function it calls,
+ * would never stop growing. Once the calls of a function are inlined, it
+ * can become a leaf in turn.
+ *
+ * The called function has to be translated before its caller: a copy of
+ * the small leaf functions is kept once they are optimized (see
+ * inline_register). The copies are in a table of fixed size, a function
+ * takes the place of the one which had its entry: with --stream the memory
+ * used still does not depend on the size of the input.
+ *
+ * The cost model, in instructions: a call is inlined when its body adds
+ * fewer instructions than the call costs (INLINE_CALL_COST and 2 moves per
+ * argument), INLINE_LOOP_BONUS times more in a loop, and as long as the
+ * caller has not doubled its size (at least INLINE_MIN_GROWTH
+ * instructions).
+ */
+
+#define INLINE_MAX_SIZE 32 // instructions of a function kept for inlining
+#define INLINE_CALL_COST 6 // call, prolog and epilog
+#define INLINE_LOOP_BONUS 4
+#define INLINE_MIN_GROWTH 64
+#define INLINE_TABLE_SIZE 256 // power of 2
+
+/**
+ * Copy of a function which can be inlined
+ */
+typedef struct inline_body_t {
+  char *name; // interned, NULL for an empty entry
+  size_t param_count;
+  size_t local_count;
+  long *slots; // new slot of each variable, -1 for an argument replaced
+  char **locals; // interned names of the variables given a new slot
+  size_t slot_count;
+  size_t tmp_count;
+  long first_label;
+  size_t label_count;
+  size_t size; // instructions other than the labels
+  tac_instr_t *instrs;
+  size_t count;
+} inline_body_t;
+
+static inline_body_t inline_table[INLINE_TABLE_SIZE];
+
+/**
+ * names are interned, see sym_hash
+ */
+static
+inline_body_t *inline_entry (char *name)
+{
+  uint64_t hash = (uintptr_t)name;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return &inline_table[hash & (INLINE_TABLE_SIZE - 1)];
+}
+
+static
+void inline_release_body (inline_body_t *body)
+{
+  free(body->slots);
+  free(body->locals);
+  free(body->instrs);
+  *body = (inline_body_t){ 0 };
+}
+
+/**
+ * Keeps a copy of a function once it is optimized if it can be inlined:
+ * small, and calling no other function
+ */
+void inline_register (tac_function_t *fn)
+{
+  inline_body_t *body = inline_entry(fn->name);
+  if (body->name == fn->name)
+    inline_release_body(body);
+  if (fn->count > INLINE_MAX_SIZE)
+    return;
+  size_t size = 0;
+  for (size_t i = 0; i < fn->count; i++) {
+    if (fn->instrs[i].op == TAC_CALL)
+      return;
+    size += fn->instrs[i].op != TAC_LABEL;
+  }
+
+  inline_release_body(body);
+  body->name = fn->name;
+  body->param_count = fn->param_count;
+  body->local_count = fn->local_count;
+  body->slots = malloc((fn->local_count + 1) * sizeof(long));
+  body->locals = malloc((fn->local_count + 1) * sizeof(char *));
+  for (size_t slot = 0; slot < fn->local_count; slot++)
+    body->slots[slot] = slot < fn->param_count ? -1 : 0;
+  for (size_t i = 0; i < fn->count; i++)
+    if (fn->instrs[i].dst.kind == TAC_OPND_LOCAL)
+      body->slots[fn->instrs[i].dst.value] = 0;
+  for (size_t slot = 0; slot < fn->local_count; slot++) {
+    if (body->slots[slot] < 0)
+      continue;
+    body->slots[slot] = body->slot_count;
+    body->locals[body->slot_count++] = fn->locals[slot];
+  }
+  body->tmp_count = fn->tmp_count;
+  tac_label_range(fn, &body->first_label, &body->label_count);
+  body->size = size;
+  body->instrs = malloc((fn->count + 1) * sizeof(tac_instr_t));
+  memcpy(body->instrs, fn->instrs, fn->count * sizeof(tac_instr_t));
+  body->count = fn->count;
+}
+
+void inline_release ()
+{
+  for (size_t e = 0; e < INLINE_TABLE_SIZE; e++)
+    inline_release_body(&inline_table[e]);
+}
+
+/**
+ * The copy of the function called by the CALL at the position pos, if the
+ * call can be inlined: its PARAMs are right before it
+ */
+static
+inline_body_t *inline_callee (tac_function_t *fn, size_t pos)
+{
+  tac_instr_t *call = &fn->instrs[pos];
+  if (call->op != TAC_CALL)
+    return NULL;
+  inline_body_t *body = inline_entry(call->src1.name);
+  if (body->name != call->src1.name || body->name == fn->name ||
+      pos < body->param_count)
+    return NULL;
+  for (size_t p = pos - body->param_count; p < pos; p++)
+    if (fn->instrs[p].op != TAC_PARAM)
+      return NULL;
+  return body;
+}
+
+/**
+ * Renames an operand of the inlined body, see inline_function
+ */
+static
+tac_operand_t inline_operand (tac_operand_t operand, tac_instr_t *call, long slot_base,
+    long tmp_base, long label_base, inline_body_t *body)
+{
+  if (operand.kind == TAC_OPND_LOCAL && body->slots[operand.value] < 0)
+    return (call - body->param_count + operand.value)->src1;
+  if (operand.kind == TAC_OPND_LOCAL)
+    operand.value = slot_base + body->slots[operand.value];
+  else if (operand.kind == TAC_OPND_TMP)
+    operand.value += tmp_base;
+  else if (operand.kind == TAC_OPND_LABEL)
+    operand.value += label_base - body->first_label;
+  return operand;
+}
+
+/**
+ * Copies the body of the function called by the instruction call to the
+ * end of instrs
+ */
+static
+void inline_body (tac_function_t *fn, tac_instr_t *call, inline_body_t *body,
+    tac_instr_t *instrs, size_t *n)
+{
+  long slot_base = tac_new_locals(fn, body->name, body->locals, body->slot_count);
+  long tmp_base = fn->tmp_count;
+  fn->tmp_count += body->tmp_count;
+  /* the copied labels keep their distance to the first one, see tac_label_range */
+  long label_base = tac_new_label();
+  for (size_t l = 1; l < body->label_count; l++)
+    tac_new_label();
+  long end = tac_new_label();
+
+  /* the arguments the function writes, from the PARAMs */
+  for (size_t p = 0; p < body->param_count; p++) {
+    tac_instr_t *param = call - body->param_count + p;
+    if (body->slots[p] >= 0)
+      instrs[(*n)++] = (tac_instr_t){ .op = TAC_ASSIGN, .src1 = param->src1,
+                                      .dst = tac_local(slot_base + body->slots[p]) };
+  }
+  for (size_t i = 0; i < body->count; i++) {
+    tac_instr_t instr = body->instrs[i];
+    instr.dst = inline_operand(instr.dst, call, slot_base, tmp_base, label_base, body);
+    instr.src1 = inline_operand(instr.src1, call, slot_base, tmp_base, label_base, body);
+    instr.src2 = inline_operand(instr.src2, call, slot_base, tmp_base, label_base, body);
+    if (instr.op != TAC_RETURN) {
+      instrs[(*n)++] = instr;
+      continue;
+    }
+    if (instr.src1.kind != TAC_OPND_NONE)
+      instrs[(*n)++] = (tac_instr_t){ .op = TAC_ASSIGN, .dst = call->dst, .src1 = instr.src1 };
+    if (i + 1 < body->count)
+      instrs[(*n)++] = (tac_instr_t){ .op = TAC_JUMP, .dst = tac_label(end) };
+  }
+  instrs[(*n)++] = (tac_instr_t){ .op = TAC_LABEL, .dst = tac_label(end) };
+}
+
+/**
+ * Inlines the calls of a function to the small leaf functions, see the cost
+ * model at the top of the file.
+ * Returns the number of inlined calls
+ */
+size_t inline_function (tac_function_t *fn)
+{
+  /* the calls in a loop are worth more */
+  cfg_t *cfg = cfg_build(fn);
+  bool *in_loop = calloc(fn->count + 1, sizeof(bool));
+  size_t loop_count;
+  cfg_loop_t *loops = cfg_loops(cfg, &loop_count);
+  for (size_t l = 0; l < loop_count; l++)
+    for (size_t b = 0; b < cfg->count; b++)
+      if (loops[l].body[b])
+        for (size_t i = cfg->blocks[b].first; i < cfg->blocks[b].end; i++)
+          in_loop[i] = true;
+  cfg_release_loops(loops, loop_count);
+  cfg_release(cfg);
+
+  size_t budget = fn->count > INLINE_MIN_GROWTH ? fn->count : INLINE_MIN_GROWTH;
+  size_t growth = 0, inlined = 0, new_count = fn->count;
+  inline_body_t **callees = calloc(fn->count + 1, sizeof(inline_body_t *));
+  for (size_t i = 0; i < fn->count; i++) {
+    inline_body_t *body = inline_callee(fn, i);
+    if (!body)
+      continue;
+    /* the arguments, the body and the label after it replace the PARAMs
+     * and the call; each RETURN becomes a copy and a jump */
+    size_t added = body->size + 1;
+    size_t benefit = (INLINE_CALL_COST + 2 * body->param_count) *
+                     (in_loop[i] ? INLINE_LOOP_BONUS : 1);
+    if (added > benefit || growth + added > budget)
+      continue;
+    callees[i] = body;
+    growth += added;
+    new_count += body->param_count + 2 * body->count + 1;
+    inlined++;
+  }
+
+  if (inlined > 0) {
+    tac_instr_t *instrs = malloc(new_count * sizeof(tac_instr_t));
+    size_t n = 0;
+    for (size_t i = 0; i < fn->count; i++) {
+      if (!callees[i]) {
+        instrs[n++] = fn->instrs[i];
+        continue;
+      }
+      n -= callees[i]->param_count;
+      inline_body(fn, &fn->instrs[i], callees[i], instrs, &n);
+    }
+    free(fn->instrs);
+    fn->instrs = instrs;
+    fn->count = n;
+    fn->capacity = new_count;
+  }
+  free(callees);
+  free(in_loop);
+  return inlined;
+}
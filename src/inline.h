@@ -0,0 +1,9 @@
+#ifndef INLINE_H
+#define INLINE_H
+#include "tac.h"
+
+size_t inline_function (tac_function_t *fn);
+void inline_register (tac_function_t *fn);
+void inline_release ();
+
+#endif /* ifndef INLINE_H */
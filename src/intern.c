@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "intern.h"
+
+#define INTERN_INITIAL_CAPACITY 1024
+
+/**
+ * Open addressing hash table, slots contain (id + 1), 0 is an empty slot
+ * names are stored by id in a separate array
+ */
+static size_t *slots = NULL;
+static size_t slots_capacity = 0;
+static char **names = NULL;
+static size_t *hashes = NULL;
+static size_t names_count = 0;
+static size_t names_capacity = 0;
+
+/**
+ * FNV-1a hash function
+ */
+static
+size_t intern_hash (const char *str, size_t len)
+{
+  size_t hash = 14695981039346656037UL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)str[i];
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+static
+void intern_grow ()
+{
+  size_t capacity = slots_capacity ? slots_capacity * 2 : INTERN_INITIAL_CAPACITY;
+  size_t *newslots = calloc(capacity, sizeof(size_t));
+  assert(newslots != NULL);
+
+  for (size_t id = 0; id < names_count; id++) {
+    size_t i = hashes[id] & (capacity - 1);
+    while (newslots[i])
+      i = (i + 1) & (capacity - 1);
+    newslots[i] = id + 1;
+  }
+  free(slots);
+  slots = newslots;
+  slots_capacity = capacity;
+}
+
+/**
+ * Returns the id of the len first chars of str, adding them to the table
+ * if they were never seen
+ */
+size_t intern_id (const char *str, size_t len)
+{
+  /* keep the load factor under 1/2 */
+  if ((names_count + 1) * 2 > slots_capacity)
+    intern_grow();
+
+  size_t hash = intern_hash(str, len);
+  size_t i = hash & (slots_capacity - 1);
+  while (slots[i]) {
+    size_t id = slots[i] - 1;
+    if (hashes[id] == hash && strncmp(names[id], str, len) == 0 &&
+        names[id][len] == '\0')
+      return id;
+    i = (i + 1) & (slots_capacity - 1);
+  }
+
+  if (names_count == names_capacity) {
+    names_capacity = names_capacity ? names_capacity * 2 : INTERN_INITIAL_CAPACITY;
+    names = realloc(names, names_capacity * sizeof(char *));
+    hashes = realloc(hashes, names_capacity * sizeof(size_t));
+    assert(names != NULL && hashes != NULL);
+  }
+
+  char *name = malloc(len + 1);
+  memcpy(name, str, len);
+  name[len] = '\0';
+
+  names[names_count] = name;
+  hashes[names_count] = hash;
+  slots[i] = names_count + 1;
+  return names_count++;
+}
+
+char *intern_name (size_t id)
+{
+  assert(id < names_count);
+  return names[id];
+}
+
+char *intern (const char *str)
+{
+  size_t id = intern_id(str, strlen(str));
+  return names[id];
+}
+
+size_t intern_count ()
+{
+  return names_count;
+}
+
+void intern_free ()
+{
+  for (size_t id = 0; id < names_count; id++)
+    free(names[id]);
+  free(names);
+  free(hashes);
+  free(slots);
+  names = NULL;
+  hashes = NULL;
+  slots = NULL;
+  names_count = names_capacity = slots_capacity = 0;
+}
@@ -0,0 +1,16 @@
+#ifndef INTERN_H
+#define INTERN_H
+#include <stddef.h>
+
+/**
+ * Every identifier is stored once in a global table, and gets a stable id
+ * The first ids are reserved for the language keywords, see lexer.c
+ */
+size_t intern_id (const char *str, size_t len);
+char  *intern_name (size_t id);
+/** returns the canonical pointer of str, two equal strings give the same pointer **/
+char  *intern (const char *str);
+size_t intern_count ();
+void   intern_free ();
+
+#endif /* ifndef INTERN_H */
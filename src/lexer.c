@@ -1,137 +1,241 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <stdint.h>
 #include "lexer.h"
 #include "buffer.h"
+#include "intern.h"
+#include "scan.h"
 
-bool isalphanum (char chr)
-{
-  return
-    (chr >= 'a' && chr <= 'z') ||
-    (chr >= 'A' && chr <= 'Z') ||
-    (chr >= '0' && chr <= '9') ||
-    chr == '_';
-}
+#define TOKENS_INITIAL_CAPACITY 1024
+#define TOKENS_BATCH 256
 
-bool isnumber (char chr)
-{
-  return ((chr >= '0' && chr <= '9') || chr == '-');
-}
+/* same order as token_kind_e */
+static char *keywords[] = {
+  "fonction", "si", "sinon", "tantque", "retourner", "entier", "rien",
+  "ET", "OU"
+};
 
-bool isop (char chr)
+static
+void lexer_abort (token_stream_t *stream, size_t offset, char *msg)
 {
-  return 
-    (chr == '=' || chr == '!' ||
-     chr == '<' || chr == '>' ||
-     chr == '+' || chr == '-' || chr == '*' || chr == '/' ||
-     chr == 'E' || chr == 'T' ||
-     chr == 'O' || chr == 'U'
-    );
+  printf("%s.\n", msg);
+  stream->buffer->it = offset;
+  buf_print(stream->buffer);
+  exit(1);
 }
 
-void lexer_assert_simplechar (buffer_t *buffer, char chr, char *msg)
+static
+token_t *lexer_new_token (token_stream_t *stream, token_kind_e kind,
+    size_t offset, size_t length)
 {
-  if (buf_getchar_after_blank(buffer) != chr) {
-    printf("%s.\n", msg);
-    buf_print(buffer);
-    exit(1);
+  if (stream->count == stream->capacity) {
+    stream->capacity *= 2;
+    stream->tokens = realloc(stream->tokens, stream->capacity * sizeof(token_t));
+    assert(stream->tokens != NULL);
   }
+  token_t *token = &stream->tokens[stream->count++];
+  token->kind = kind;
+  token->offset = offset;
+  token->length = length;
+  token->value = 0;
+  return token;
 }
 
-void lexer_assert_blank (buffer_t *buffer, char *msg)
+/**
+ * operators and punctuation, returns the length of the token, or 0 if
+ * the character is unknown
+ */
+static
+size_t lexer_symbol (const char *curr, const char *end, token_kind_e *kind)
 {
-  if (!ISBLANK(buf_getchar(buffer))) {
-    printf("%s.\n", msg);
-    buf_print(buffer);
-    exit(1);
+  bool twochars = curr + 1 < end && curr[1] == '=';
+  switch (*curr) {
+  case '+': *kind = TOK_PLUS; return 1;
+  case '-': *kind = TOK_MINUS; return 1;
+  case '*': *kind = TOK_MULT; return 1;
+  case '/': *kind = TOK_DIV; return 1;
+  case '<': *kind = twochars ? TOK_LTE : TOK_LT; return 1 + twochars;
+  case '>': *kind = twochars ? TOK_GTE : TOK_GT; return 1 + twochars;
+  case '=': *kind = twochars ? TOK_EQ : TOK_EQUALSIGN; return 1 + twochars;
+  case '!': *kind = TOK_DIFF; return twochars ? 2 : 0;
+  case '(': *kind = TOK_OPENBRACE; return 1;
+  case ')': *kind = TOK_CLOSEBRACE; return 1;
+  case '{': *kind = TOK_OPENBRACKET; return 1;
+  case '}': *kind = TOK_CLOSEBRACKET; return 1;
+  case ';': *kind = TOK_SEMICOLON; return 1;
+  case ',': *kind = TOK_COMMA; return 1;
+  case ':': *kind = TOK_TWOPOINTS; return 1;
+  default: return 0;
   }
 }
 
-void lexer_assert_newline (buffer_t *buffer, char *msg)
+void lexer_init (token_stream_t *stream, buffer_t *buffer)
 {
-  if (buf_getchar(buffer) != '\n') {
-    printf("%s.\n", msg);
-    buf_print(buffer);
-    exit(1);
+  stream->buffer = buffer;
+  stream->count = 0;
+  stream->curr = 0;
+  stream->capacity = TOKENS_INITIAL_CAPACITY;
+  stream->tokens = malloc(stream->capacity * sizeof(token_t));
+  stream->scan = buf_ptr(buffer);
+  stream->finished = false;
+  assert(stream->tokens != NULL);
+
+  /* keywords have the first ids, which are also their token kind */
+  for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+    size_t id = intern_id(keywords[i], strlen(keywords[i]));
+    assert(id == i);
+    (void)id;
   }
 }
 
-void lexer_assert_twopoints (buffer_t *buffer, char *msg)
-{ lexer_assert_simplechar(buffer, ':', msg); }
-
-void lexer_assert_semicolon (buffer_t *buffer, char *msg)
-{ lexer_assert_simplechar(buffer, ';', msg); }
-
-void lexer_assert_openbrace (buffer_t *buffer, char *msg)
-{ lexer_assert_simplechar(buffer, '(', msg); }
-
-void lexer_assert_closebrace (buffer_t *buffer, char *msg)
-{ lexer_assert_simplechar(buffer, ')', msg); }
-
-void lexer_assert_openbracket (buffer_t *buffer, char *msg)
-{ lexer_assert_simplechar(buffer, '{', msg); }
+/**
+ * Splits the input into tokens, until n tokens are available after the
+ * current one, or until the end of input
+ * - identifiers are interned, keywords are recognized by their id
+ * - numbers are converted once, a leading '-' is an operator, the parser
+ *   creates negative numbers
+ */
+static
+void lexer_fill (token_stream_t *stream, size_t n)
+{
+  const char *start = stream->buffer->content;
+  const char *end = start + stream->buffer->size;
+  const char *curr = stream->scan;
+  token_kind_e kind;
+  size_t length;
+
+  while (curr < end && stream->count - stream->curr < n) {
+    unsigned char class = scan_classes[(unsigned char)*curr];
+    if (class & SCAN_BLANK) {
+      curr = scan_blanks(curr, end);
+      continue;
+    }
+
+    const char *lexem = curr;
+    size_t offset = lexem - start;
+    if (class & SCAN_DIGIT) {
+      unsigned long value = 0;
+      curr = scan_digits(curr, end);
+      for (const char *digit = lexem; digit < curr; digit++) {
+        value = value * 10 + (*digit - '0');
+        if (value > LONG_MAX)
+          lexer_abort(stream, offset, "Number is too big");
+      }
+      token_t *token = lexer_new_token(stream, TOK_NUMBER, offset, curr - lexem);
+      token->value = value;
+    }
+    else if (class & SCAN_IDENT) {
+      curr = scan_identifier(curr, end);
+      size_t id = intern_id(lexem, curr - lexem);
+      kind = id < TOK_IDENTIFIER ? (token_kind_e)id : TOK_IDENTIFIER;
+      token_t *token = lexer_new_token(stream, kind, offset, curr - lexem);
+      token->id = id;
+    }
+    else if ((length = lexer_symbol(curr, end, &kind)) > 0) {
+      lexer_new_token(stream, kind, offset, length);
+      curr += length;
+    }
+    else
+      lexer_abort(stream, offset, "Unexpected character");
+  }
 
-void lexer_assert_closebracket (buffer_t *buffer, char *msg)
-{ lexer_assert_simplechar(buffer, '}', msg); }
+  stream->scan = curr;
+  if (curr >= end) {
+    lexer_new_token(stream, TOK_EOF, end - start, 0);
+    stream->finished = true;
+  }
+}
 
-void lexer_assert_equalsign (buffer_t *buffer, char *msg)
-{ lexer_assert_simplechar(buffer, '=', msg); }
+/**
+ * Splits the whole input into tokens, in one pass
+ */
+void lexer_tokenize (token_stream_t *stream, buffer_t *buffer)
+{
+  lexer_init(stream, buffer);
+  lexer_fill(stream, SIZE_MAX);
+}
 
-static
-char *lexer_get(buffer_t *buffer, char *lexem, size_t lexer_size,
-    bool (*discriminator)(char))
+/**
+ * The tokens before the current one are not needed anymore (the previous
+ * functions are parsed), so the memory used stays the same whatever the
+ * size of the input
+ */
+void lexer_discard (token_stream_t *stream)
 {
-  buf_skipblank(buffer);
-  size_t count = 0;
-  char *out = NULL;
-  char chr;
-  bool waslocked = true;
-  if (!buffer->islocked) {
-    buf_lock(buffer);
-    waslocked = false;
-  }
+  if (stream->curr == 0)
+    return;
+  stream->count -= stream->curr;
+  memmove(stream->tokens, &stream->tokens[stream->curr], stream->count * sizeof(token_t));
+  stream->curr = 0;
+  if (stream->count > 0)
+    buf_discard(stream->buffer, stream->tokens[0].offset);
+}
 
-  while (count < lexer_size && discriminator(chr = buf_getchar(buffer)))
-    lexem[count++] = chr;
+void lexer_release (token_stream_t *stream)
+{
+  free(stream->tokens);
+  stream->tokens = NULL;
+  stream->count = stream->capacity = stream->curr = 0;
+}
 
-  if (count < lexer_size)
-    buf_rollback(buffer, 1);
+/**
+ * returns the n-th token after the current one, without moving
+ */
+token_t *lexer_peek (token_stream_t *stream, size_t n)
+{
+  if (stream->curr + n >= stream->count && !stream->finished)
+    lexer_fill(stream, n + TOKENS_BATCH);
+  size_t pos = stream->curr + n;
+  if (pos >= stream->count)
+    pos = stream->count - 1;
+  return &stream->tokens[pos];
+}
 
-  if (count > 0) {
-    lexem[count] = '\0';
-    out = malloc(sizeof(char) * (count + 1));
-    strncpy(out, lexem, count + 1);
-  }
-  if (!waslocked)
-    buf_unlock(buffer);
-  return out;
+/**
+ * returns the current token, and moves to the next one.
+ * The next token is read first: the returned pointer stays valid until the
+ * next call to lexer_peek or lexer_next
+ */
+token_t *lexer_next (token_stream_t *stream)
+{
+  lexer_peek(stream, 1);
+  token_t *token = &stream->tokens[stream->curr];
+  if (stream->curr < stream->count - 1)
+    stream->curr++;
+  return token;
 }
 
-char *lexer_getnumber (buffer_t *buffer)
+/**
+ * moves to the next token only if the current one is of the given kind
+ */
+bool lexer_accept (token_stream_t *stream, token_kind_e kind)
 {
-  char lexem[LEXEM_SIZE + 1];
-  return lexer_get(buffer, lexem, LEXEM_SIZE, isnumber);
+  if (lexer_peek(stream, 0)->kind != kind)
+    return false;
+  lexer_next(stream);
+  return true;
 }
 
-char *lexer_getalphanum (buffer_t *buffer)
+token_t *lexer_expect (token_stream_t *stream, token_kind_e kind, char *msg)
 {
-  char lexem[LEXEM_SIZE + 1];
-  return lexer_get(buffer, lexem, LEXEM_SIZE, isalphanum);
+  token_t *token = lexer_peek(stream, 0);
+  if (token->kind != kind)
+    lexer_abort(stream, token->offset, msg);
+  return lexer_next(stream);
 }
 
-char *lexer_getalphanum_rollback (buffer_t *buffer)
+char *lexer_token_name (token_t *token)
 {
-  char lexem[LEXEM_SIZE + 1];
-  buf_lock(buffer);
-  char *out = lexer_get(buffer, lexem, LEXEM_SIZE, isalphanum);
-  if (out) buf_rollback(buffer, strlen(out));
-  buf_unlock(buffer);
-  return out;
+  assert(token->kind == TOK_IDENTIFIER);
+  return intern_name(token->id);
 }
 
-char *lexer_getop (buffer_t *buffer)
+void lexer_print_token (token_stream_t *stream, token_t *token)
 {
-  char lexem[3] = "";
-  return lexer_get(buffer, lexem, 2, isop);
+  stream->buffer->it = token->offset;
+  buf_print(stream->buffer);
 }
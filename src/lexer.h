@@ -3,28 +3,79 @@
 #include <stdbool.h>
 #include "buffer.h"
 
-bool isalphanum (char chr);
-bool isnumber (char chr);
-bool isop (char chr);
+/**
+ * Keywords come first, in the same order as the keywords array of lexer.c:
+ * they are interned before anything else, so a keyword id is its token kind
+ */
+typedef enum {
+  TOK_FONCTION,
+  TOK_SI,
+  TOK_SINON,
+  TOK_TANTQUE,
+  TOK_RETOURNER,
+  TOK_ENTIER,
+  TOK_RIEN,
+  TOK_AND, // ET
+  TOK_OR, // OU
 
-void lexer_assert_simplechar (buffer_t *buffer, char chr, char *msg);
-void lexer_assert_twopoints (buffer_t *buffer, char *msg);
-void lexer_assert_newline (buffer_t *buffer, char *msg);
-void lexer_assert_semicolon (buffer_t *buffer, char *msg);
-void lexer_assert_openbrace (buffer_t *buffer, char *msg);
-void lexer_assert_closebrace (buffer_t *buffer, char *msg);
-void lexer_assert_openbracket (buffer_t *buffer, char *msg);
-void lexer_assert_closebracket (buffer_t *buffer, char *msg);
-void lexer_assert_equalsign (buffer_t *buffer, char *msg);
-void lexer_assert_blank (buffer_t *buffer, char *msg);
+  TOK_IDENTIFIER,
+  TOK_NUMBER,
+  TOK_PLUS,
+  TOK_MINUS,
+  TOK_MULT,
+  TOK_DIV,
+  TOK_LT,
+  TOK_LTE,
+  TOK_GT,
+  TOK_GTE,
+  TOK_EQ,
+  TOK_DIFF,
+  TOK_EQUALSIGN,
+  TOK_OPENBRACE, // (
+  TOK_CLOSEBRACE, // )
+  TOK_OPENBRACKET, // {
+  TOK_CLOSEBRACKET, // }
+  TOK_SEMICOLON,
+  TOK_COMMA,
+  TOK_TWOPOINTS,
+  TOK_EOF
+} token_kind_e;
 
-/** buf_getalphanum_rollback mallocs and rollbacks after read. **/
-char *lexer_getalphanum_rollback (buffer_t *buffer);
-/** buf_getalphanum mallocs and rollbacks only if nothing was parsed. **/
-char *lexer_getalphanum (buffer_t *buffer);
-/** buf_getop mallocs and rollbacks only if nothing was parsed. **/
-char *lexer_getop (buffer_t *buffer);
-/** buf_getnumber mallocs and rollbacks only if nothing was parsed. **/
-char *lexer_getnumber (buffer_t *buffer);
+typedef struct token_t {
+  token_kind_e kind;
+  unsigned int length;
+  size_t offset; // position in the input
+  union {
+    long value; // TOK_NUMBER
+    size_t id; // TOK_IDENTIFIER, interned id
+  };
+} token_t;
+
+/**
+ * The input is tokenized in batches, when the parser moves through the
+ * tokens array with lexer_peek/lexer_next, or at once with lexer_tokenize
+ * the last token is always TOK_EOF
+ */
+typedef struct token_stream_t {
+  buffer_t *buffer;
+  token_t *tokens;
+  size_t count;
+  size_t capacity;
+  size_t curr;
+  const char *scan; // next character to tokenize
+  bool finished; // TOK_EOF was added
+} token_stream_t;
+
+void     lexer_init (token_stream_t *stream, buffer_t *buffer);
+void     lexer_tokenize (token_stream_t *stream, buffer_t *buffer);
+/** drops the tokens before the current one, and the input they come from **/
+void     lexer_discard (token_stream_t *stream);
+void     lexer_release (token_stream_t *stream);
+token_t *lexer_peek (token_stream_t *stream, size_t n);
+token_t *lexer_next (token_stream_t *stream);
+bool     lexer_accept (token_stream_t *stream, token_kind_e kind);
+token_t *lexer_expect (token_stream_t *stream, token_kind_e kind, char *msg);
+char    *lexer_token_name (token_t *token);
+void     lexer_print_token (token_stream_t *stream, token_t *token);
 
 #endif /* ifndef LEXER_H */
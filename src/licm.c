@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "licm.h"
+#include "cfg.h"
+
+/**
+ * Loop invariant code motion
+ *
+ * An operation of a loop whose operands don't change while the loop runs
+ * computes the same value at each iteration, like (a + b) * (a - b) when
+ * the loop writes neither a nor b. It is moved before the loop, in the
+ * preheader, and computed once:
+ *
+ *   L0:                          tmp0 = a + b
+ *     COMPARE i $100             tmp1 = a - b
+ *     JUMP_GTE L1                tmp2 = tmp0 * tmp1
+ *     tmp0 = a + b         =>  L0:
+ *     tmp1 = a - b                 COMPARE i $100
+ *     tmp2 = tmp0 * tmp1           JUMP_GTE L1
+ *     s = s + tmp2                 s = s + tmp2
+ *     ...                          ...
+ *
+ * An operand is invariant when it is an immediate value, a variable no
+ * instruction of the loop writes, or a tmp computed outside of the loop or
+ * by a moved operation. Only the operations writing a tmp are moved: a tmp
+ * is written by exactly one instruction, which stays the only one
+ * computing it. Out of SSA form (see ssa.c) the tmps of the phis are
+ * written by several copies, they are not moved.
+ *
+ * The preheader runs even when the loop does not run once, only the
+ * operations which can't fail are moved: no division by a variable, by 0
+ * or by -1 (LONG_MIN / -1 overflows).
+ * The CALLs are never moved, nor their PARAMs, as they may have side
+ * effects, and their results are not invariant. A called function can't
+ * write the variables of the caller: the variables a loop does not assign
+ * stay invariant across its calls. A moved value alive across a call of
+ * the loop gets a callee-saved register, see regalloc.c.
+ *
+ * The loops are found on the control flow graph (cfg_loops), the inner
+ * ones are treated first: what they move to their preheader is in the
+ * outer loop, which can move it again.
+ */
+
+/**
+ * Tells whether an operand has the same value at each iteration of the
+ * loop, see licm_loop
+ */
+static
+bool licm_invariant (tac_operand_t *operand, bool *written, bool *computed)
+{
+  switch (operand->kind) {
+  case TAC_OPND_IMM:
+    return true;
+  case TAC_OPND_LOCAL:
+    return !written[operand->value];
+  case TAC_OPND_TMP:
+    return !computed[operand->value];
+  default:
+    return false;
+  }
+}
+
+static
+bool licm_can_move (tac_instr_t *instr, bool *redefined)
+{
+  if (instr->dst.kind != TAC_OPND_TMP || redefined[instr->dst.value])
+    return false;
+  if (instr->op == TAC_ASSIGN || instr->op == TAC_ADD ||
+      instr->op == TAC_SUB || instr->op == TAC_MUL)
+    return true;
+  return instr->op == TAC_DIV && instr->src2.kind == TAC_OPND_IMM &&
+         instr->src2.value != 0 && instr->src2.value != -1;
+}
+
+/**
+ * Moves the invariant operations of a loop to its preheader, the code
+ * right before the header label. The jumps from outside of the loop to the
+ * header go to a new label before the moved code.
+ * Returns the number of moved instructions
+ */
+static
+size_t licm_loop (tac_function_t *fn, cfg_t *cfg, cfg_loop_t *loop)
+{
+  cfg_block_t *header = &cfg->blocks[loop->header];
+  if (fn->instrs[header->first].op != TAC_LABEL)
+    return 0;
+  /* a block of the loop going on in the header would run the preheader */
+  if (loop->header > 0 && loop->body[loop->header - 1]) {
+    tac_instr_t *last = &fn->instrs[cfg->blocks[loop->header - 1].end - 1];
+    if (last->op != TAC_JUMP && last->op != TAC_RETURN)
+      return 0;
+  }
+
+  /* written: the variables the loop assigns, computed: the tmps it
+   * computes, which are not invariant until they are moved */
+  bool *written = calloc(fn->local_count + 1, sizeof(bool));
+  bool *computed = calloc(fn->tmp_count + 1, sizeof(bool));
+  bool *moved = calloc(fn->count, sizeof(bool));
+  bool *defined = calloc(fn->tmp_count + 1, sizeof(bool));
+  bool *redefined = calloc(fn->tmp_count + 1, sizeof(bool));
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_operand_t *dst = &fn->instrs[i].dst;
+    if (dst->kind == TAC_OPND_TMP) {
+      redefined[dst->value] |= defined[dst->value];
+      defined[dst->value] = true;
+    }
+  }
+  for (size_t b = 0; b < cfg->count; b++) {
+    if (!loop->body[b])
+      continue;
+    for (size_t i = cfg->blocks[b].first; i < cfg->blocks[b].end; i++) {
+      tac_operand_t *dst = &fn->instrs[i].dst;
+      if (dst->kind == TAC_OPND_LOCAL)
+        written[dst->value] = true;
+      else if (dst->kind == TAC_OPND_TMP)
+        computed[dst->value] = true;
+    }
+  }
+
+  /* an operation can use the result of one found later in the array, in
+   * an inner loop: until nothing more is found */
+  size_t count = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = 0; b < cfg->count; b++) {
+      if (!loop->body[b])
+        continue;
+      for (size_t i = cfg->blocks[b].first; i < cfg->blocks[b].end; i++) {
+        tac_instr_t *instr = &fn->instrs[i];
+        if (moved[i] || !licm_can_move(instr, redefined) ||
+            !licm_invariant(&instr->src1, written, computed) ||
+            (instr->op != TAC_ASSIGN && !licm_invariant(&instr->src2, written, computed)))
+          continue;
+        moved[i] = true;
+        computed[instr->dst.value] = false;
+        count++;
+        changed = true;
+      }
+    }
+  }
+
+  if (count > 0) {
+    /* the jumps entering the loop go to the preheader */
+    bool outside_jump = false;
+    long preheader = 0;
+    for (size_t p = 0; p < header->pred_count; p++) {
+      cfg_block_t *pred = &cfg->blocks[header->preds[p]];
+      tac_instr_t *last = &fn->instrs[pred->end - 1];
+      if (loop->body[header->preds[p]] || !TAC_IS_JUMP(last->op) ||
+          cfg_label_block(cfg, last->dst.value) != loop->header)
+        continue;
+      if (!outside_jump)
+        preheader = tac_new_label();
+      outside_jump = true;
+      last->dst.value = preheader;
+    }
+
+    /* the instructions in their new order: the ones before the header,
+     * the preheader, then the others without the moved ones */
+    size_t new_count = fn->count + outside_jump;
+    tac_instr_t *instrs = malloc(new_count * sizeof(tac_instr_t));
+    size_t n = 0;
+    for (size_t i = 0; i < header->first; i++)
+      if (!moved[i])
+        instrs[n++] = fn->instrs[i];
+    if (outside_jump)
+      instrs[n++] = (tac_instr_t){ .op = TAC_LABEL, .dst = tac_label(preheader) };
+    for (size_t i = 0; i < fn->count; i++)
+      if (moved[i])
+        instrs[n++] = fn->instrs[i];
+    for (size_t i = header->first; i < fn->count; i++)
+      if (!moved[i])
+        instrs[n++] = fn->instrs[i];
+
+    free(fn->instrs);
+    fn->instrs = instrs;
+    fn->count = new_count;
+    fn->capacity = new_count;
+  }
+  free(redefined);
+  free(defined);
+  free(moved);
+  free(computed);
+  free(written);
+  return count;
+}
+
+/**
+ * Moves the loop invariant operations of a function out of their loops.
+ * The graph is built again after each loop which moved code, the inner
+ * loops (the smallest ones) are treated first.
+ * Returns the number of moved instructions
+ */
+size_t licm_function (tac_function_t *fn)
+{
+  size_t total = 0, moved;
+  do {
+    moved = 0;
+    cfg_t *cfg = cfg_build(fn);
+    size_t loop_count;
+    cfg_loop_t *loops = cfg_loops(cfg, &loop_count);
+    bool *done = calloc(loop_count + 1, sizeof(bool));
+    for (size_t l = 0; l < loop_count && !moved; l++) {
+      size_t smallest = loop_count;
+      for (size_t k = 0; k < loop_count; k++)
+        if (!done[k] && (smallest == loop_count || loops[k].size < loops[smallest].size))
+          smallest = k;
+      done[smallest] = true;
+      moved = licm_loop(fn, cfg, &loops[smallest]);
+    }
+    total += moved;
+    free(done);
+    cfg_release_loops(loops, loop_count);
+    cfg_release(cfg);
+  } while (moved > 0);
+  return total;
+}
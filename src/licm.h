@@ -0,0 +1,7 @@
+#ifndef LICM_H
+#define LICM_H
+#include "tac.h"
+
+size_t licm_function (tac_function_t *fn);
+
+#endif /* ifndef LICM_H */
@@ -10,13 +10,63 @@
 #include "utils.h"
 #include "tac.h"
 #include "asm.h"
+#include "peephole.h"
+#include "inline.h"
+#include "ifconv.h"
+#include "bench.h"
+#include "arena.h"
+#include "options.h"
 
-symbol_t *global_table = NULL;
-symbol_t **pglobal_table = &global_table;
+sym_table_t *global_table = NULL;
+sym_table_t **pglobal_table = &global_table;
+options_t options = { .cmov_cost = IFCONV_DEFAULT_COST };
 
 void help (char *prg_name)
 {
-  printf("Usage: %s <file.intech>\n", prg_name);
+  printf("Usage: %s [options] <file.intech>\n", prg_name);
+  printf("       %s --bench=symbols|lexer|expressions|division\n", prg_name);
+  printf("Options:\n");
+  printf("  --stream    compile each function as soon as it is parsed, then\n"
+         "              release it (the memory used does not depend on the\n"
+         "              size of the input)\n");
+  printf("  --emit=tac  also write the three address code to <file>.interm\n");
+  printf("  --promote-locals\n"
+         "              keep the arguments and local variables in registers\n"
+         "              instead of the stack when there are enough of them\n");
+  printf("  --ssa       optimize the functions in static single assignment\n"
+         "              form: the variables become tmps\n");
+  printf("  --omit-frame-pointer\n"
+         "              address the variables from %%rsp, without saving\n"
+         "              %%rbp, which becomes one more register\n");
+  printf("  --cmov-cost=<n>\n"
+         "              convert the branches choosing a value to conditional\n"
+         "              moves when their arms cost at most n operations\n"
+         "              (default %d, 0 disables)\n", IFCONV_DEFAULT_COST);
+  printf("  --report=regalloc\n"
+         "              print the spills and the saved registers of each\n"
+         "              function\n");
+  printf("  --report=peephole\n"
+         "              print how many times each peephole rule fired\n");
+  printf("  --report=cmov\n"
+         "              print the branches converted to conditional moves in\n"
+         "              each function\n");
+  printf("  --disable-peephole=<rule>[,<rule>...]\n"
+         "              disable peephole rules: redundant-load, store-forward,\n"
+         "              cmp-zero, zero-idiom, or all\n");
+}
+
+/**
+ * Gives the report_e flag of a --report=<name> option, 0 if it is unknown
+ */
+unsigned report_flag (const char *name)
+{
+  if (strcmp(name, "regalloc") == STREQUAL)
+    return REPORT_REGALLOC;
+  if (strcmp(name, "peephole") == STREQUAL)
+    return REPORT_PEEPHOLE;
+  if (strcmp(name, "cmov") == STREQUAL)
+    return REPORT_CMOV;
+  return 0;
 }
 
 int suffix (const char *buffer, const char *endswith) {
@@ -26,6 +76,12 @@ int suffix (const char *buffer, const char *endswith) {
   return strcmp(&buffer[b_len - e_len], endswith);
 }
 
+void print_function (ast_t *function)
+{
+  ast_print(function);
+  printf("\n");
+}
+
 void print_functions (ast_list_t *functions)
 {
   printf("\n\n\n");
@@ -53,14 +109,18 @@ char *create_interm_filename (const char *filename)
   return tac_filename;
 }
 
-char *launch_tac_generator (ast_list_t *functions, const char *filename)
+tac_function_t *launch_tac_generator (ast_list_t *functions, const char *filename)
 {
-  char *tac_filename = create_interm_filename(filename);
+  tac_function_t *tac = tac_generator(functions);
+  if (!options.emit_tac)
+    return tac;
 
+  char *tac_filename = create_interm_filename(filename);
   FILE *tac_file = fopen(tac_filename, "w");
-  tac_generator(functions, tac_file);
+  tac_print(tac, tac_file);
   fclose(tac_file);
-  return tac_filename;
+  free(tac_filename);
+  return tac;
 }
 
 ast_list_t *launch_parser (const char *filename)
@@ -70,35 +130,121 @@ ast_list_t *launch_parser (const char *filename)
   buf_init(&buffer, input);
 
   ast_list_t *functions = parse(&buffer);
-  
+
+  buf_release(&buffer);
   fclose(input);
 
   print_functions(functions);
   return functions;
 }
 
-char *launch_asm_generator (const char *tac_filename, const char *filename)
+void launch_asm_generator (tac_function_t *tac, const char *filename)
 {
-  buffer_t buffer;
   char *asm_filename = create_asm_filename(filename);
-  FILE *input = fopen(tac_filename, "r");
   FILE *output = fopen(asm_filename, "w");
+
+  asm_generator(tac, output);
+
+  fclose(output);
+  free(asm_filename);
+}
+
+/**
+ * TAC and assembly outputs of the streaming mode
+ */
+typedef struct stream_output_t {
+  FILE *tac_file; // NULL without --emit=tac
+  FILE *asm_file;
+} stream_output_t;
+
+/**
+ * Called by the parser as soon as a function is parsed: its TAC is
+ * converted to assembly, then the function is released
+ */
+void stream_function (ast_t *function, void *data)
+{
+  stream_output_t *output = data;
+
+  print_function(function);
+
+  tac_function_t *tac = tac_generate_function(function);
+  if (output->tac_file)
+    tac_print_function(tac, output->tac_file);
+  asm_function(tac, output->asm_file);
+
+  tac_release_function(tac);
+  parse_release_function(function);
+}
+
+/**
+ * Streaming mode: each function goes through the whole pipeline before the
+ * next one is parsed
+ */
+void launch_stream (const char *filename)
+{
+  buffer_t buffer;
+  stream_output_t output = { NULL, NULL };
+  char *tac_filename = create_interm_filename(filename);
+  char *asm_filename = create_asm_filename(filename);
+  FILE *input = fopen(filename, "r");
+  if (options.emit_tac)
+    output.tac_file = fopen(tac_filename, "w");
+  output.asm_file = fopen(asm_filename, "w");
   buf_init(&buffer, input);
 
-  asm_generator(&buffer, output);
-  return asm_filename;
+  tac_init();
+  asm_begin(output.asm_file);
+  parse_each(&buffer, stream_function, &output);
+  asm_end(output.asm_file);
+
+  buf_release(&buffer);
+  fclose(input);
+  if (output.tac_file)
+    fclose(output.tac_file);
+  fclose(output.asm_file);
+  free(tac_filename);
+  free(asm_filename);
 }
 
 int main (int argc, char **argv)
 {
-  if (argc != 2) {
+  const char *filename = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--bench=", sizeof("--bench=") - 1) == 0)
+      return bench_run(&argv[i][sizeof("--bench=") - 1]);
+    else if (strcmp(argv[i], "--stream") == STREQUAL)
+      options.stream = true;
+    else if (strcmp(argv[i], "--emit=tac") == STREQUAL)
+      options.emit_tac = true;
+    else if (strcmp(argv[i], "--promote-locals") == STREQUAL)
+      options.promote_locals = true;
+    else if (strcmp(argv[i], "--ssa") == STREQUAL)
+      options.ssa = true;
+    else if (strcmp(argv[i], "--omit-frame-pointer") == STREQUAL)
+      options.omit_frame_pointer = true;
+    else if (strncmp(argv[i], "--cmov-cost=", sizeof("--cmov-cost=") - 1) == 0)
+      options.cmov_cost = strtoul(&argv[i][sizeof("--cmov-cost=") - 1], NULL, 10);
+    else if (strncmp(argv[i], "--report=", sizeof("--report=") - 1) == 0 &&
+             report_flag(&argv[i][sizeof("--report=") - 1]))
+      options.report |= report_flag(&argv[i][sizeof("--report=") - 1]);
+    else if (strncmp(argv[i], "--disable-peephole=", sizeof("--disable-peephole=") - 1) == 0)
+      peephole_disable(&argv[i][sizeof("--disable-peephole=") - 1]);
+    else if (argv[i][0] == '-') {
+      help(argv[0]);
+      printf("Unknown option '%s'.\n", argv[i]);
+      exit(1);
+    }
+    else
+      filename = argv[i];
+  }
+
+  if (!filename) {
     help(argv[0]);
     printf("Not enough arguments.\n");
     exit(1);
   }
 
-  const char *filename = argv[1];
-
   if (suffix(filename, ".intech") != 0) {
     printf("File does not terminate with .intech\n");
     exit(1);
@@ -106,11 +252,17 @@ int main (int argc, char **argv)
 
   printf("Lecture du fichier " COLOR_GREEN "%s" COLOR_DEFAULT "\n", filename);
 
-  ast_list_t *functions = launch_parser(filename);
-  char *tac_filename = launch_tac_generator(functions, filename);
-  char *asm_filename = launch_asm_generator(tac_filename, filename);
+  if (options.stream)
+    launch_stream(filename);
+  else {
+    ast_list_t *functions = launch_parser(filename);
+    tac_function_t *tac = launch_tac_generator(functions, filename);
+    launch_asm_generator(tac, filename);
+    tac_release(tac);
+  }
+  inline_release();
 
-  free(tac_filename);
-  free(asm_filename);
+  arena_print_stats(arena_current);
+  arena_release(arena_current);
   return 0;
 }
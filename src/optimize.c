@@ -0,0 +1,54 @@
+#include "optimize.h"
+#include "cfg.h"
+#include "licm.h"
+#include "gvn.h"
+#include "inline.h"
+#include "ifconv.h"
+#include "ssa.h"
+#include "options.h"
+
+/**
+ * Runs the cleanup passes until none of them finds anything
+ */
+static
+void optimize_cleanup (tac_function_t *fn)
+{
+  size_t removed;
+  do {
+    removed = cfg_remove_unreachable(fn);
+    removed += cfg_thread_jumps(fn);
+  } while (removed > 0);
+}
+
+/**
+ * The optimizations of the three address code, run on each function once
+ * it is generated, before it is printed or translated to assembly
+ *  - cfg_remove_unreachable: code after a return, jumps to the next label
+ *  - cfg_thread_jumps: jumps to jumps, useless labels
+ * each pass can give work to the other one, they run until nothing changes
+ *  - inline_function: the calls to small leaf functions are replaced by
+ *    their body, the function is kept for its callers if it is one of them
+ *  - with --ssa, the function goes through SSA form (see ssa.c): the
+ *    variables become tmps, the copies between them disappear. Going back
+ *    adds jumps and labels, which the passes above clean up again
+ *  - gvn_function: the operations computing a value already available reuse
+ *    the tmp holding it
+ *  - licm_function: the operations a loop computes again at each iteration
+ *    with the same operands are moved before it
+ *  - ifconv_function: the small branches choosing the value of a variable
+ *    become conditional moves, once the function is kept for inlining
+ */
+void optimize_function (tac_function_t *fn)
+{
+  optimize_cleanup(fn);
+  if (inline_function(fn) > 0)
+    optimize_cleanup(fn);
+  if (options.ssa) {
+    ssa_destroy(ssa_build(fn));
+    optimize_cleanup(fn);
+  }
+  gvn_function(fn);
+  licm_function(fn);
+  inline_register(fn);
+  ifconv_function(fn);
+}
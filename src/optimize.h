@@ -0,0 +1,7 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+#include "tac.h"
+
+void optimize_function (tac_function_t *fn);
+
+#endif /* ifndef OPTIMIZE_H */
@@ -0,0 +1,31 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Reports printed on the standard output while compiling, see --report
+ */
+typedef enum {
+  REPORT_REGALLOC = 1 << 0, // tmps, spills and saved registers of each function
+  REPORT_PEEPHOLE = 1 << 1, // how many times each peephole rule fired
+  REPORT_CMOV = 1 << 2      // branches converted to conditional moves
+} report_e;
+
+/**
+ * Command line options, see help() in main.c
+ */
+typedef struct options_t {
+  bool stream; // compile each function as soon as it is parsed
+  bool emit_tac; // write the three address code to <file>.interm
+  bool promote_locals; // keep the variables in registers, see regalloc.c
+  bool ssa; // optimize the functions in SSA form, see ssa.c
+  bool omit_frame_pointer; // address the frame from %rsp, see asm.c
+  size_t cmov_cost; // largest cost of the arms of a branch, see ifconv.c
+  unsigned report; // report_e flags
+  bool quiet; // don't print the symbols of each function, for the benchmarks
+} options_t;
+
+extern options_t options;
+
+#endif /* ifndef OPTIONS_H */
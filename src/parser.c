@@ -10,120 +10,114 @@
 #include "parser.h"
 #include "ast.h"
 #include "utils.h"
-#include "stack.h"
+#include "arena.h"
 #include "lexer.h"
+#include "intern.h"
+#include "options.h"
 
-extern symbol_t **pglobal_table;
+extern sym_table_t **pglobal_table;
 
-void *parse_abort (buffer_t *buffer, const char *msg)
+void *parse_abort (token_stream_t *stream, const char *msg)
 {
   printf("%s", msg);
-  buf_print(buffer);
+  lexer_print_token(stream, lexer_peek(stream, 0));
   exit(1);
   return NULL;
 }
 
-int parse_return_type (buffer_t *buffer)
+int parse_return_type (token_stream_t *stream)
 {
   if (DEBUG) printf("parse_return_type\n");
-  lexer_assert_twopoints(buffer, "parameters should be followed by ':'");
+  lexer_expect(stream, TOK_TWOPOINTS, "parameters should be followed by ':'");
 
-  char *lexem = lexer_getalphanum(buffer);
-  if (lexem && !strcmp(lexem, "entier"))
+  if (lexer_accept(stream, TOK_ENTIER))
     return AST_INTEGER;
-  if (lexem && !strcmp(lexem, "rien"))
+  if (lexer_accept(stream, TOK_RIEN))
     return AST_VOID;
   else
-    parse_abort(buffer,
+    parse_abort(stream,
         "Expected a valid type (either 'entier' or 'rien'). stopping. \n");
   return -1;
 }
 
-int parse_type (buffer_t *buffer)
+int parse_type (token_stream_t *stream)
 {
-  char *lexem = lexer_getalphanum(buffer);
-  if (!lexem)
-    parse_abort(buffer, "Expected a type. exiting.\n");
+  if (!parse_is_type(stream))
+    parse_abort(stream, "Expected a valid type (either 'entier'). stopping. \n");
 
-  int ret = -1;
-  if (strcmp(lexem, "entier") == 0)
-    ret = AST_INTEGER;
-  else
-    parse_abort(buffer, "Expected a valid type (either 'entier'). stopping. \n");
-
-  free(lexem);
-  return ret;
+  lexer_next(stream);
+  return AST_INTEGER;
 }
 
 
-bool parse_is_type (buffer_t *buffer, char *str)
+bool parse_is_type (token_stream_t *stream)
 {
-  return strcmp(str, "entier") == STREQUAL;
+  return lexer_peek(stream, 0)->kind == TOK_ENTIER;
 }
 
-ast_list_t *parse_parameters (buffer_t *buffer, symbol_t **table)
+ast_list_t *parse_parameters (token_stream_t *stream, sym_table_t **table)
 {
   if (DEBUG) printf("parse_parameters\n");
   ast_list_t *params = NULL;
   ast_t *ast = NULL;
-  
-  lexer_assert_openbrace(buffer, "Expecting a '(' after function name");
 
-  buf_lock(buffer);
-  char next = buf_getchar_after_blank(buffer);
-  if (next == ')') {
-    buf_unlock(buffer);
+  lexer_expect(stream, TOK_OPENBRACE, "Expecting a '(' after function name");
+
+  if (lexer_accept(stream, TOK_CLOSEBRACE))
     return params;
-  }
-  buf_rollback_and_unlock(buffer, 1);
 
   for (;;) {
-    int type = parse_type(buffer);
+    int type = parse_type(stream);
 
-    char *name = lexer_getalphanum(buffer);
-    if (!name || isdigit(name[0]))
-      parse_abort(buffer, "Expected an identifier. exiting.\n");
+    if (lexer_peek(stream, 0)->kind != TOK_IDENTIFIER)
+      parse_abort(stream, "Expected an identifier. exiting.\n");
+    char *name = lexer_token_name(lexer_next(stream));
 
     if (sym_search(*table, name)) {
       printf("Identifier '%s' has already been declared. exiting.\n", name);
-      buf_print(buffer);
+      lexer_print_token(stream, lexer_peek(stream, 0));
       exit(1);
     }
 
     ast = ast_new_variable(name, type);
     ast_list_add(&params, ast);
     sym_add(table, sym_new(name, SYM_PARAM, ast));
-    free(name);
 
-    next = buf_getchar_after_blank(buffer);
-    if (next == ')')
+    if (lexer_accept(stream, TOK_CLOSEBRACE))
       break;
 
-    if (next != ',')
-      parse_abort(buffer, "Unexpected end of input. stopping. \n");
+    if (!lexer_accept(stream, TOK_COMMA))
+      parse_abort(stream, "Unexpected end of input. stopping. \n");
   }
   return params;
 }
 
-ast_t *parse_number (buffer_t *buffer)
+/**
+ * numbers are always positive in the tokens, a '-' before a number
+ * makes it negative
+ */
+ast_t *parse_number (token_stream_t *stream)
 {
   if (DEBUG) printf("parse_number\n");
-  char *lexem = lexer_getnumber(buffer);
-  char *invalid = NULL;
-  long value = strtol(lexem, &invalid, 10);
-
-  if (invalid && *invalid != '\0')
-    parse_abort(buffer, "Number should only contain digits. exiting. \n");
-  
-  free(lexem);
-  return ast_new_integer(value);
+  bool negative = lexer_accept(stream, TOK_MINUS);
+  token_t *token = lexer_peek(stream, 0);
+
+  if (token->kind != TOK_NUMBER)
+    parse_abort(stream, "Number should only contain digits. exiting. \n");
+
+  long value = lexer_next(stream)->value;
+  return ast_new_integer(negative ? -value : value);
 }
 
+/**
+ * An integer is also a condition, like tantque (1): it is true when it is
+ * not 0, see tac_condition
+ */
 bool ast_check_types (ast_t *ast, ast_node_type_e type)
 {
   symbol_t *sym;
 
-  if (ast->type == AST_INTEGER && type == AST_INTEGER)
+  if (ast->type == AST_INTEGER && (type == AST_INTEGER || type == AST_BOOLEAN))
     return true;
 
   if (ast->type == AST_VARIABLE && ast->var.type == type)
@@ -137,174 +131,162 @@ bool ast_check_types (ast_t *ast, ast_node_type_e type)
       return true;
   }
 
+  if (ast->type != AST_FNCALL)
+    return false;
+
   if (!(sym = sym_search(*pglobal_table, ast->call.name))) {
     printf("Unknown function name in function call. exiting.\n");
     exit(1);
   }
 
-  if (ast->type == AST_FNCALL && sym->attributes->function.return_type == type)
-    return true;
-
-  return false;
+  return sym->attributes->function.return_type == type;
 }
 
-ast_list_t *parse_arguments (buffer_t *buffer, symbol_t **table, symbol_t *function)
+ast_list_t *parse_arguments (token_stream_t *stream, sym_table_t **table, symbol_t *function)
 {
   if (DEBUG) printf("parse_arguments\n");
   ast_list_t *args = NULL;
   ast_t *ast = NULL;
   ast_list_t *param = function->attributes->function.params;
+
+  if (!param) {
+    lexer_expect(stream, TOK_CLOSEBRACE, "Expected a ')' after a call without arguments");
+    return args;
+  }
+
   for (;;) {
-    ast = parse_expression(buffer, table);
+    ast = parse_expression(stream, table);
 
     if (!ast_check_types(ast, param->elem->var.type))
-      parse_abort(buffer, "Argument type does not match function definition. exiting.\n");
+      parse_abort(stream, "Argument type does not match function definition. exiting.\n");
 
     ast_list_add(&args, ast);
 
     param = param->next;
-    char next = buf_getchar(buffer);
-    if (next == ')') {
-      if (param) parse_abort(buffer, "Expected others arguments to function");
+    if (lexer_accept(stream, TOK_CLOSEBRACE)) {
+      if (param) parse_abort(stream, "Expected others arguments to function");
       return args;
     }
 
-    if (next != ',')
-      parse_abort(buffer, "Expected a ')' or a ',' after argument list");
+    if (!lexer_accept(stream, TOK_COMMA))
+      parse_abort(stream, "Expected a ')' or a ',' after argument list");
 
     if (!param) {
       printf("Too many arguments to function '%s'. exiting.\n", function->name);
-      buf_print(buffer);
+      lexer_print_token(stream, lexer_peek(stream, 0));
       exit(1);
     }
   }
 }
 
-ast_t *parse_known_symbol (buffer_t *buffer, symbol_t **table)
+ast_t *parse_known_symbol (token_stream_t *stream, sym_table_t **table)
 {
   if (DEBUG) printf("parse_known_symbol\n");
-  char *lexem = lexer_getalphanum(buffer);
   symbol_t *symbol = NULL;
   ast_t *ast = NULL;
-  if (!lexem)
-    parse_abort(buffer, "Expected an identifier. exiting.\n");
+  if (lexer_peek(stream, 0)->kind != TOK_IDENTIFIER)
+    parse_abort(stream, "Expected an identifier. exiting.\n");
+
+  char *name = lexer_token_name(lexer_next(stream));
 
-  if (!(symbol = sym_search(*table, lexem)) && \
-      !(symbol = sym_search(*pglobal_table, lexem))) {
-    printf("Identifier '%s' is used before declaration. exiting.\n", lexem);
-    buf_print(buffer);
+  /* the function table has the global table as parent scope */
+  if (!(symbol = sym_lookup(*table, name))) {
+    printf("Identifier '%s' is used before declaration. exiting.\n", name);
+    lexer_print_token(stream, lexer_peek(stream, 0));
     exit(1);
   }
 
   if (SYM_ISVAR(symbol))
-    ast = ast_new_variable(lexem, AST_GET_VARTYPE(symbol->attributes));
+    ast = ast_new_variable(name, AST_GET_VARTYPE(symbol->attributes));
   else if (SYM_ISFUN(symbol)) {
-    lexer_assert_openbrace(buffer,
+    lexer_expect(stream, TOK_OPENBRACE,
         "function call should always be followed by (). exiting.\n");
 
-    ast = ast_new_fncall(lexem, parse_arguments(buffer, table, symbol));
+    ast = ast_new_fncall(name, parse_arguments(stream, table, symbol));
   }
-  free(lexem);
   if (!ast)
-    parse_abort(buffer, "Unknown symbol. exiting.\n");
+    parse_abort(stream, "Unknown symbol. exiting.\n");
   return ast;
 }
 
-ast_t * parse_stack_to_ast (mystack_t *ordered)
-{
-  if (stack_isempty(*ordered)) return NULL;
-  ast_t *item = stack_pop(ordered);
-  if (item->type == AST_UNARY && item->unary.op == AST_UN_PAREN) {
-    ast_t *tmp = item->unary.operand;
-    free(item);
-    item = tmp;
-  }
-
-  if (DEBUG) ast_print_binary_or_integer(item);
-
-  if (item->type == AST_BINARY) {
-    if (!item->binary.right)
-      item->binary.right = parse_stack_to_ast(ordered);
-    if (!item->binary.left)
-      item->binary.left = parse_stack_to_ast(ordered);
-  }
-  return item;
-}
-
-ast_t *parse_binary_expression (buffer_t *buffer, symbol_t **table)
+/**
+ * reads a binary operator, the tree node is created by parse_expression
+ */
+ast_binary_e parse_binary_operator (token_stream_t *stream)
 {
-  if (DEBUG) printf("parse_binary_expression\n");
-
-  char *op = lexer_getop(buffer);
+  if (DEBUG) printf("parse_binary_operator\n");
 
-  assert(op != NULL);
-  ast_binary_e type;
+  ast_binary_e type = AST_BIN_INVALID_OP;
   // after a number, we should have an operator
-  if (!strcmp(op, "+"))
-    type = AST_BIN_PLUS;
-  else if (!strcmp(op, "-"))
-    type = AST_BIN_MINUS;
-  else if (!strcmp(op, "*"))
-    type = AST_BIN_MULT;
-  else if (!strcmp(op, "/"))
-    type = AST_BIN_DIV;
-  else if (!strcmp(op, ">="))
-    type = AST_BIN_GTE;
-  else if (!strcmp(op, ">"))
-    type = AST_BIN_GT;
-  else if (!strcmp(op, "<="))
-    type = AST_BIN_LTE;
-  else if (!strcmp(op, "<"))
-    type = AST_BIN_LT;
-  else if (!strcmp(op, "!="))
-    type = AST_BIN_DIFF;
-  else if (!strcmp(op, "=="))
-    type = AST_BIN_EQ;
-  else if (!strcmp(op, "OU"))
-    type = AST_BIN_OR;
-  else if (!strcmp(op, "ET"))
-    type = AST_BIN_AND;
-  else
-    parse_abort(buffer, "Expected a binary operator. exiting.\n");
-  free(op);
-  return ast_new_binary(type, NULL, NULL);
+  switch (lexer_peek(stream, 0)->kind) {
+  case TOK_PLUS: type = AST_BIN_PLUS; break;
+  case TOK_MINUS: type = AST_BIN_MINUS; break;
+  case TOK_MULT: type = AST_BIN_MULT; break;
+  case TOK_DIV: type = AST_BIN_DIV; break;
+  case TOK_GTE: type = AST_BIN_GTE; break;
+  case TOK_GT: type = AST_BIN_GT; break;
+  case TOK_LTE: type = AST_BIN_LTE; break;
+  case TOK_LT: type = AST_BIN_LT; break;
+  case TOK_DIFF: type = AST_BIN_DIFF; break;
+  case TOK_EQ: type = AST_BIN_EQ; break;
+  case TOK_OR: type = AST_BIN_OR; break;
+  case TOK_AND: type = AST_BIN_AND; break;
+  default:
+    parse_abort(stream, "Expected a binary operator. exiting.\n");
+  }
+  lexer_next(stream);
+  return type;
 }
 
-bool parse_expression_end (buffer_t *buffer)
+bool parse_expression_end (token_stream_t *stream)
 {
   if (DEBUG) printf("parse_expression_end\n");
-  char next = buf_getchar_rollback(buffer);
-  return next == ';' || next == ')' || next == ',';
+  token_kind_e next = lexer_peek(stream, 0)->kind;
+  return next == TOK_SEMICOLON || next == TOK_CLOSEBRACE || next == TOK_COMMA;
 }
 
+/**
+ * an operand: number, variable, function call, or an expression between
+ * parentheses. A parenthesized expression is returned as is, it is already
+ * a complete tree so nothing can be attached to it
+ */
 static
-ast_t *parse_expression_ (buffer_t *buffer, symbol_t **table)
+ast_t *parse_expression_ (token_stream_t *stream, sym_table_t **table)
 {
   if (DEBUG) printf("parse_expression_\n");
   ast_t *ast = NULL;
 
-  buf_lock(buffer);
-  char next = buf_getchar_after_blank(buffer);
-  if (next == '(') {
-    buf_unlock(buffer);
+  token_kind_e next = lexer_peek(stream, 0)->kind;
+  if (next == TOK_OPENBRACE) {
+    lexer_next(stream);
 
-    ast = ast_new_unary(AST_UN_PAREN, parse_expression(buffer, table));
-    lexer_assert_closebrace(buffer, "missing ')' at the end of the expression");
+    ast = parse_expression(stream, table);
+    lexer_expect(stream, TOK_CLOSEBRACE, "missing ')' at the end of the expression");
   }
-  else if (isnumber(next)) {
-    buf_rollback_and_unlock(buffer, 1);
-    ast = parse_number(buffer);
+  else if (next == TOK_NUMBER || next == TOK_MINUS) {
+    ast = parse_number(stream);
   }
   else {
-    buf_rollback_and_unlock(buffer, 1);
-    ast = parse_known_symbol(buffer, table);
+    ast = parse_known_symbol(stream, table);
   }
 
   if (!ast)
-    parse_abort(buffer, "Could not parse expression. exiting.\n");
+    parse_abort(stream, "Could not parse expression. exiting.\n");
   return ast;
 }
 
+/**
+ * operators of the same priority that follow each other, they are right
+ * associative: a - b - c is a - (b - c)
+ */
+typedef struct parse_chain_t {
+  int priority;
+  ast_t *root;
+  ast_t **hole; // right operand of the last operator of the chain
+} parse_chain_t;
+
+#define PARSE_MAX_CHAINS 4 // number of distinct priorities, see ast_op_priority
+
 /**
  * expressions can be composed of
  * - arithmetic operations
@@ -340,80 +322,75 @@ ast_t *parse_expression_ (buffer_t *buffer, symbol_t **table)
  *             ➘ + ─ * ─ 3
  *                     ➘ 4
  *                 ➘ -3
+ *
+ * The tree is built while reading (precedence climbing), without recursion
+ * on the operators: one chain is open per priority, and their priorities
+ * increase from the bottom to the top of the chains array.
+ * When an operator comes:
+ *  - the chains of higher priority are complete, they become the operand
+ *  - it is appended to the chain of its priority, or opens it
  */
-ast_t *parse_expression (buffer_t *buffer, symbol_t **table)
+ast_t *parse_expression (token_stream_t *stream, sym_table_t **table)
 {
   if (DEBUG) printf("parse_expression\n");
-  ast_t *curr = NULL,
-        *last = NULL;
-  mystack_t stack = NULL,
-          ordered = NULL;
-  bool isfinished = false;
-  int next_expected = 0;
-
-  do {
-    if (stack_isempty(stack) ||
-        ast_binary_priority(stack_top(stack)) <= ast_binary_priority(curr)) {
-      if (curr != NULL && (stack_isempty(stack) || curr != stack_top(stack))) {
-        stack_push(&stack, curr);
-      }
-
-      switch (next_expected)
-      {
-      case 0: curr = parse_expression_(buffer, table); break;
-      case 1:
-        if ((isfinished = parse_expression_end(buffer)))
-          curr = NULL;
-        break;
-      case 2: curr = parse_binary_expression(buffer, table); break;
-      }
-
-      next_expected = (next_expected + 1) % 3;
+  parse_chain_t chains[PARSE_MAX_CHAINS];
+  int top = -1;
+  ast_t *operand = parse_expression_(stream, table);
+
+  while (!parse_expression_end(stream)) {
+    ast_binary_e op = parse_binary_operator(stream);
+    int priority = ast_op_priority(op);
+
+    for (; top >= 0 && chains[top].priority > priority; top--) {
+      *chains[top].hole = operand;
+      operand = chains[top].root;
     }
+
+    ast_t *node = ast_new_binary(op, operand, NULL);
+    if (top >= 0 && chains[top].priority == priority)
+      *chains[top].hole = node;
     else {
-      do {
-        last = stack_pop(&stack);
-        stack_push(&ordered, last);
-      }
-      while (!stack_isempty(stack) &&
-          ast_binary_priority(stack_top(stack)) >= ast_binary_priority(last));
+      assert(top + 1 < PARSE_MAX_CHAINS);
+      chains[++top] = (parse_chain_t){ priority, node, NULL };
     }
+    chains[top].hole = &node->binary.right;
+
+    operand = parse_expression_(stream, table);
   }
-  while (!isfinished || !stack_isempty(stack));
 
-  ast_t *ast = parse_stack_to_ast(&ordered);
-  if (DEBUG) printf("\n");
-  return ast;
+  for (; top >= 0; top--) {
+    *chains[top].hole = operand;
+    operand = chains[top].root;
+  }
+  return operand;
 }
 
-ast_t *parse_assignment (buffer_t *buffer, symbol_t **table, symbol_t *variable, char *lexem)
+ast_t *parse_assignment (token_stream_t *stream, sym_table_t **table, symbol_t *variable, char *name)
 {
   if (DEBUG) printf("parse_assignment\n");
   ast_t *lvalue = NULL;
 
   if (!SYM_ISVAR(variable))
-    parse_abort(buffer, "Assignment to something that is not a variable. exiting.\n");
+    parse_abort(stream, "Assignment to something that is not a variable. exiting.\n");
 
-  lvalue = ast_new_variable(lexem, AST_GET_VARTYPE(variable->attributes));
+  lvalue = ast_new_variable(name, AST_GET_VARTYPE(variable->attributes));
 
-  lexer_assert_equalsign(buffer, "should have an equal sign");
-  return ast_new_assignment(lvalue, parse_expression(buffer, table));
+  lexer_expect(stream, TOK_EQUALSIGN, "should have an equal sign");
+  return ast_new_assignment(lvalue, parse_expression(stream, table));
 }
 
-ast_t *parse_declaration (buffer_t *buffer, symbol_t **table)
+ast_t *parse_declaration (token_stream_t *stream, sym_table_t **table)
 {
   if (DEBUG) printf("parse_declaration\n");
 
-  int type = parse_type(buffer);
+  int type = parse_type(stream);
   // add a SYM_VAR entry to the symbol table
   // evaluate the expression if it's an initialization;
-  char *name = lexer_getalphanum(buffer);
   ast_t *lvalue = NULL;
-  assert(name != NULL);
 
-  if (isdigit(name[0]))
-    parse_abort(buffer, "variable name cannot start with a number. exiting.");
- 
+  if (lexer_peek(stream, 0)->kind != TOK_IDENTIFIER)
+    parse_abort(stream, "variable name cannot start with a number. exiting.");
+  char *name = lexer_token_name(lexer_next(stream));
 
   if (sym_search(*table, name)) {
     printf("Identifier '%s' has already been declared. exiting.\n", name);
@@ -422,91 +399,77 @@ ast_t *parse_declaration (buffer_t *buffer, symbol_t **table)
 
   lvalue = ast_new_variable(name, type);
   sym_add(table, sym_new(name, SYM_VAR, lvalue));
-  free(name);
 
-  char next = buf_getchar_rollback(buffer);
-  if (next == ';') {
+  if (lexer_peek(stream, 0)->kind == TOK_SEMICOLON) {
     return ast_new_declaration(lvalue, NULL);
   }
-  if (next == '=') {
-    buf_forward(buffer, 1);
-    return ast_new_declaration(lvalue, parse_expression(buffer, table));
+  if (lexer_accept(stream, TOK_EQUALSIGN)) {
+    return ast_new_declaration(lvalue, parse_expression(stream, table));
   }
-  parse_abort(buffer, "Expected either a '=' or a ';'\n");
+  parse_abort(stream, "Expected either a '=' or a ';'\n");
   return NULL;
 }
 
 void parse_condition_start (
-    buffer_t *buffer,
+    token_stream_t *stream,
     symbol_t *fct,
-    const char *expected,
+    token_kind_e expected,
     ast_t **condition,
     ast_t **valid)
 {
   if (DEBUG) printf("parse_condition_start\n");
 
-  char *lexem = lexer_getalphanum(buffer);
+  if (!lexer_accept(stream, expected))
+    parse_abort(stream, "Condition should start with a si/tantque. exiting.\n");
 
-  if (strcmp(lexem, expected))
-    parse_abort(buffer, "Condition should start with a si/tantque. exiting.\n");
+  lexer_expect(stream, TOK_OPENBRACE, "condition should be followed by '('");
+  *condition = parse_expression(stream, &fct->function_table);
 
-  lexer_assert_openbrace(buffer, "condition should be followed by '('");
-  *condition = parse_expression(buffer, &fct->function_table);
-  
   if (!ast_check_types(*condition, AST_BOOLEAN))
-    parse_abort(buffer, "Condition should contain a boolean expression. exiting.\n");
+    parse_abort(stream, "Condition should contain a boolean expression. exiting.\n");
 
-  lexer_assert_closebrace(buffer, "condition should be ended by a ')'");
+  lexer_expect(stream, TOK_CLOSEBRACE, "condition should be ended by a ')'");
 
-  *valid = parse_statement(buffer, fct);
+  *valid = parse_statement(stream, fct);
 }
 
-ast_t *parse_loop (buffer_t *buffer, symbol_t *fct)
+ast_t *parse_loop (token_stream_t *stream, symbol_t *fct)
 {
   if (DEBUG) printf("parse_loop\n");
   ast_t *condition = NULL,
         *stmt = NULL;
 
-  parse_condition_start(buffer, fct, "tantque", &condition, &stmt);
+  parse_condition_start(stream, fct, TOK_TANTQUE, &condition, &stmt);
 
   return ast_new_loop(condition, stmt);
 }
 
-ast_t *parse_branch (buffer_t *buffer, symbol_t *fct)
+ast_t *parse_branch (token_stream_t *stream, symbol_t *fct)
 {
   if (DEBUG) printf("parse_branch\n");
   ast_t *condition = NULL,
         *valid = NULL,
         *invalid = NULL;
 
-  parse_condition_start(buffer, fct, "si", &condition, &valid);
+  parse_condition_start(stream, fct, TOK_SI, &condition, &valid);
 
-  buf_lock(buffer);
-  char *lexem = lexer_getalphanum(buffer);
-  if (!lexem)
-    buf_unlock(buffer);
-
-  else {
-    if (strcmp(lexem, "sinon") == STREQUAL) {
-      buf_unlock(buffer);
-      invalid = parse_statement(buffer, fct);
-    } else {
-      buf_rollback_and_unlock(buffer, strlen(lexem));
-    }
-  }
+  if (lexer_accept(stream, TOK_SINON))
+    invalid = parse_statement(stream, fct);
 
   return ast_new_branch(condition, valid, invalid);
 }
 
-ast_t *parse_compount_stmt (buffer_t *buffer, symbol_t *fct)
+ast_t *parse_compount_stmt (token_stream_t *stream, symbol_t *fct)
 {
   if (DEBUG) printf("parse_compount_stmt\n");
   ast_list_t *stmts = NULL;
 
-  while (buf_getchar_rollback(buffer) != '}')
-    ast_list_add(&stmts, parse_statement(buffer, fct));
+  while (!lexer_accept(stream, TOK_CLOSEBRACKET)) {
+    if (lexer_peek(stream, 0)->kind == TOK_EOF)
+      parse_abort(stream, "Unexpected end of input, missing a '}'. exiting.\n");
+    ast_list_add(&stmts, parse_statement(stream, fct));
+  }
 
-  buf_forward(buffer, 1); // skip '}'
   return ast_new_comp_stmt(stmts);
 }
 
@@ -516,81 +479,74 @@ ast_t *parse_compount_stmt (buffer_t *buffer, symbol_t *fct)
  *  - branching OK
  *  - any expression OK
 */
-ast_t *parse_statement (buffer_t *buffer, symbol_t *fct)
+ast_t *parse_statement (token_stream_t *stream, symbol_t *fct)
 {
   if (DEBUG) printf("parse_statement\n");
   symbol_t *symbol = NULL;
   ast_t *ast = NULL;
-  // compound statement
-  if (buf_getchar_rollback(buffer) == '{') {
-    buf_forward(buffer, 1);
-    return parse_compount_stmt(buffer, fct);
-  }
-
-  buf_lock(buffer);
-  char *lexem = lexer_getalphanum(buffer);
-  if (!lexem)
-    parse_abort(buffer, "Did not find any suitable character. exiting.\n");
+  token_t *token = lexer_peek(stream, 0);
 
-  if (DEBUG) printf("lexem: '%s'\n", lexem);
+  switch (token->kind) {
+  /* compound statement */
+  case TOK_OPENBRACKET:
+    lexer_next(stream);
+    return parse_compount_stmt(stream, fct);
   /* branching */
-  if (strcmp(lexem, "si") == STREQUAL) {
-    buf_rollback_and_unlock(buffer, sizeof("si") - 1);
-    free(lexem);
-    return parse_branch(buffer, fct);
-  }
+  case TOK_SI:
+    return parse_branch(stream, fct);
   /* loop */
-  if (strcmp(lexem, "tantque") == STREQUAL) {
-    buf_rollback_and_unlock(buffer, sizeof("tantque") - 1);
-    free(lexem);
-    return parse_loop(buffer, fct);
-  }
+  case TOK_TANTQUE:
+    return parse_loop(stream, fct);
   /* return statement */
-  if (strcmp(lexem, "retourner") == STREQUAL) {
-    buf_unlock(buffer);
-    ast_t *ret = parse_expression(buffer, &fct->function_table);
+  case TOK_RETOURNER:
+    lexer_next(stream);
+    ast_t *ret = parse_expression(stream, &fct->function_table);
 
     if (!ast_check_types(ret, fct->attributes->function.return_type))
-      parse_abort(buffer, "Wrong return expression.\n");
+      parse_abort(stream, "Wrong return expression.\n");
 
     ast = ast_new_return(ret);
-  }
+    break;
   /* declaration */
-  else if (parse_is_type(buffer, lexem)) {
-    buf_rollback_and_unlock(buffer, strlen(lexem));
-    if (DEBUG) printf("found type '%s'\n", lexem);
-    ast = parse_declaration(buffer, &fct->function_table);
-  }
-  /* assignment */
-  else if ((symbol = sym_search(fct->function_table, lexem)) != NULL &&
-      buf_getchar_rollback(buffer) == '=') {
-    buf_unlock(buffer);
-    if (DEBUG) printf("found symbol %s\n", symbol->name);
-    ast = parse_assignment(buffer, &fct->function_table, symbol, lexem);
-  }
-  /* any expression */
-  else {
-    buf_rollback_and_unlock(buffer, strlen(lexem));
-    if (DEBUG) printf("any expression\n");
-    ast = parse_expression(buffer, &fct->function_table);
+  case TOK_ENTIER:
+    ast = parse_declaration(stream, &fct->function_table);
+    break;
+  case TOK_EOF:
+    parse_abort(stream, "Did not find any suitable character. exiting.\n");
+    break;
+  default:
+    /* assignment */
+    /* peeking further can move the tokens, token is not used after it */
+    if (token->kind == TOK_IDENTIFIER &&
+        lexer_peek(stream, 1)->kind == TOK_EQUALSIGN &&
+        (symbol = sym_search(fct->function_table, lexer_token_name(lexer_peek(stream, 0)))) != NULL) {
+      lexer_next(stream);
+      if (DEBUG) printf("found symbol %s\n", symbol->name);
+      ast = parse_assignment(stream, &fct->function_table, symbol, symbol->name);
+    }
+    /* any expression */
+    else {
+      if (DEBUG) printf("any expression\n");
+      ast = parse_expression(stream, &fct->function_table);
+    }
   }
-  lexer_assert_semicolon(buffer, "Statement should end with a ';'");
-  free(lexem);
+  lexer_expect(stream, TOK_SEMICOLON, "Statement should end with a ';'");
   return ast;
 }
 
-ast_list_t *parse_function_body (buffer_t *buffer, symbol_t *fct)
+ast_list_t *parse_function_body (token_stream_t *stream, symbol_t *fct)
 {
   if (DEBUG) printf("parse_function_body\n");
   ast_list_t *stmts = NULL;
 
-  lexer_assert_openbracket(buffer, "Function body should start with a '{'");
+  lexer_expect(stream, TOK_OPENBRACKET, "Function body should start with a '{'");
 
-  while (buf_getchar_rollback(buffer) != '}') {
-    ast_list_add(&stmts, parse_statement(buffer, fct));
+  while (!lexer_accept(stream, TOK_CLOSEBRACKET)) {
+    if (lexer_peek(stream, 0)->kind == TOK_EOF)
+      parse_abort(stream, "Function body should stop with a '}'");
+    ast_list_add(&stmts, parse_statement(stream, fct));
   }
 
-  lexer_assert_closebracket(buffer, "Function body should stop with a '}'");
   return stmts;
 }
 
@@ -599,58 +555,113 @@ ast_list_t *parse_function_body (buffer_t *buffer, symbol_t *fct)
  *   instructions;
  * }
  */
-ast_t *parse_function (buffer_t *buffer)
+ast_t *parse_function (token_stream_t *stream)
 {
   if (DEBUG) printf("parse_function\n");
   int return_type;
-  symbol_t *table = NULL;
+  sym_table_t *table = sym_table_new(*pglobal_table);
   symbol_t *sym;
   ast_t *ast;
   ast_list_t *params;
 
-  char *name = lexer_getalphanum(buffer);
+  if (lexer_peek(stream, 0)->kind != TOK_IDENTIFIER)
+    parse_abort(stream, "Identifier cannot start with a digit. stopping.\n");
+  char *name = lexer_token_name(lexer_next(stream));
 
-  if (!name || isdigit(name[0]))
-    parse_abort(buffer, "Identifier cannot start with a digit. stopping.\n");
-
-  params = parse_parameters(buffer, &table);
-  return_type = parse_return_type(buffer);
+  params = parse_parameters(stream, &table);
+  return_type = parse_return_type(stream);
 
   ast = ast_new_function(name, return_type, params, NULL);
   sym = sym_new_function(name, SYM_FUNCTION, ast, table);
   sym_add(pglobal_table, sym);
 
-  ast->function.stmts = parse_function_body(buffer, sym);
+  /* the body of each function is allocated in its own sub-arena */
+  ast->function.arena = arena_push();
+  ast->function.stmts = parse_function_body(stream, sym);
+  arena_pop();
 
-  printf("function %s: \n", name);
-  sym_print_list(sym->function_table);
+  if (!options.quiet) {
+    printf("function %s: \n", name);
+    sym_print_list(sym->function_table);
+  }
 
-  free(name);
   return ast;
 }
 
 /**
- * This function generates ASTs for each global-scope function
+ * Releases the body of a function once it has been compiled: its
+ * statements, its local variables and its symbol table. Only its signature
+ * (name, return type and parameters) is kept, to check the later calls
  */
-ast_list_t *parse (buffer_t *buffer)
+void parse_release_function (ast_t *function)
 {
-  ast_list_t *functions = NULL;
-  char *lexem = NULL;
+  symbol_t *sym = sym_search(*pglobal_table, function->function.name);
+  assert(sym != NULL && sym->attributes == function);
+
+  /* the parameters are declared first, outside of the body arena */
+  symbol_t *curr = sym_first(sym->function_table);
+  while (curr && curr->type == SYM_PARAM) {
+    symbol_t *next = curr->next;
+    sym_delete(curr);
+    curr = next;
+  }
+  sym_table_delete(sym->function_table);
+  sym->function_table = NULL;
+
+  arena_release(function->function.arena);
+  function->function.arena = NULL;
+  function->function.stmts = NULL;
+}
+
+/**
+ * Parses the functions one by one, callback is called as soon as a function
+ * is parsed. The tokens of the previous functions are dropped, so the memory
+ * used by the parser does not depend on the size of the input
+ */
+void parse_each (buffer_t *buffer, parse_callback_t callback, void *data)
+{
+  token_stream_t stream;
+  lexer_init(&stream, buffer);
+
+  if (!*pglobal_table)
+    *pglobal_table = sym_table_new(NULL);
+
   do  {
-    lexem = lexer_getalphanum(buffer);
-    if (lexem && strcmp(lexem, "fonction") == STREQUAL) {
-      free(lexem);
-      ast_list_add(&functions, parse_function(buffer));
-    }
+    if (lexer_accept(&stream, TOK_FONCTION))
+      callback(parse_function(&stream), data);
     else
-      parse_abort(buffer, "Only functions are allowed on global scope.\n");
-  } while (!buf_eof(buffer));
+      parse_abort(&stream, "Only functions are allowed on global scope.\n");
+    lexer_discard(&stream);
+  } while (lexer_peek(&stream, 0)->kind != TOK_EOF);
+
+  lexer_release(&stream);
 
-  if (!sym_search(*pglobal_table, "main")) {
+  if (!sym_search(*pglobal_table, intern("main"))) {
     printf("The entrypoint 'main' function was not found. exiting.\n");
     exit(1);
   }
 
   if (DEBUG) printf("** end of file. **\n");
+}
+
+/**
+ * appends a function at the end of the list, data points to the last next
+ */
+static
+void parse_append (ast_t *function, void *data)
+{
+  ast_list_t ***last = data;
+  **last = ast_list_new_node(function);
+  *last = &(**last)->next;
+}
+
+/**
+ * This function generates ASTs for each global-scope function
+ */
+ast_list_t *parse (buffer_t *buffer)
+{
+  ast_list_t *functions = NULL;
+  ast_list_t **last = &functions;
+  parse_each(buffer, parse_append, &last);
   return functions;
 }
@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "peephole.h"
+#include "regalloc.h"
+#include "options.h"
+
+/**
+ * Peephole optimizer of the assembly of a function
+ *
+ * asm.c translates each TAC instruction on its own, which leaves patterns a
+ * look at the neighbouring instructions removes:
+ *  - redundant-load: a value copied to where it already is
+ *      movq %rax, -8(%rbp); ...; movq -8(%rbp), %rax  =>  movq %rax, -8(%rbp)
+ *  - store-forward: a slot read just after a register was stored in it
+ *      movq %rax, -8(%rbp); cmpq $1000, -8(%rbp)
+ *        =>  movq %rax, -8(%rbp); cmpq $1000, %rax
+ *  - zero-idiom: movq $0, %rax  =>  xorl %eax, %eax (shorter, no dependency)
+ *    only when nothing reads the flags xorl sets
+ *  - cmp-zero: a cmpq $0 of the result of addq/subq, which already set the
+ *    zero flag, when only je/jne read it
+ *
+ * The rules are a table, each one is tried at every line and looks at a
+ * window of PEEPHOLE_WINDOW lines around it. The window stops at the labels
+ * and the calls: the values known before them may not be true after.
+ * The code of asm.c never keeps the flags alive across a label or a jump
+ * (each conditional jump follows its cmpq), the flags are dead there.
+ *
+ * A rule can be disabled with --disable-peephole=<rule>, --report=peephole
+ * prints how many times each one fired.
+ */
+
+#define PEEPHOLE_WINDOW 8
+#define PEEPHOLE_MAX_PASSES 4
+
+/* what an instruction does, see peephole_ops */
+#define OP_READS_DST   (1 << 0) // the dst operand is read
+#define OP_WRITES_DST  (1 << 1) // the dst operand is written
+#define OP_SETS_FLAGS  (1 << 2)
+#define OP_READS_FLAGS (1 << 3)
+#define OP_LEAVES      (1 << 4) // jumps or calls: the flags are dead after it
+#define OP_BARRIER     (1 << 5) // the values in registers are not known after it
+
+typedef struct peephole_op_t {
+  const char *name;
+  unsigned flags;
+} peephole_op_t;
+
+/**
+ * The instructions emitted by asm.c, an unknown one stops every rule.
+ * An instruction writing its dst has another entry for its one operand
+ * form (imulq)
+ */
+static const peephole_op_t peephole_ops[] = {
+  { "movq", OP_WRITES_DST },
+  { "addq", OP_READS_DST | OP_WRITES_DST | OP_SETS_FLAGS },
+  { "subq", OP_READS_DST | OP_WRITES_DST | OP_SETS_FLAGS },
+  { "xorl", OP_WRITES_DST | OP_SETS_FLAGS },
+  { "cmpq", OP_READS_DST | OP_SETS_FLAGS },
+  { "imulq", OP_READS_DST | OP_WRITES_DST | OP_SETS_FLAGS },
+  { "salq", OP_READS_DST | OP_WRITES_DST | OP_SETS_FLAGS },
+  { "sarq", OP_READS_DST | OP_WRITES_DST | OP_SETS_FLAGS },
+  { "shrq", OP_READS_DST | OP_WRITES_DST | OP_SETS_FLAGS },
+  { "leaq", OP_WRITES_DST },
+  { "cmovl", OP_READS_DST | OP_WRITES_DST | OP_READS_FLAGS },
+  { "cmovle", OP_READS_DST | OP_WRITES_DST | OP_READS_FLAGS },
+  { "cmovg", OP_READS_DST | OP_WRITES_DST | OP_READS_FLAGS },
+  { "cmovge", OP_READS_DST | OP_WRITES_DST | OP_READS_FLAGS },
+  { "cmovne", OP_READS_DST | OP_WRITES_DST | OP_READS_FLAGS },
+  { "cmove", OP_READS_DST | OP_WRITES_DST | OP_READS_FLAGS },
+  /* one operand, or registers written without being named */
+  { "imulq", OP_SETS_FLAGS | OP_BARRIER },
+  { "negq", OP_SETS_FLAGS | OP_BARRIER },
+  { "cqto", OP_BARRIER },
+  { "idivq", OP_SETS_FLAGS | OP_BARRIER },
+  { "pushq", 0 },
+  { "popq", OP_BARRIER },
+  { "leave", OP_BARRIER },
+  { "ret", OP_LEAVES | OP_BARRIER },
+  { "call", OP_LEAVES | OP_BARRIER },
+  { "jmp", OP_LEAVES | OP_BARRIER },
+  { "jl", OP_READS_FLAGS | OP_BARRIER },
+  { "jle", OP_READS_FLAGS | OP_BARRIER },
+  { "jg", OP_READS_FLAGS | OP_BARRIER },
+  { "jge", OP_READS_FLAGS | OP_BARRIER },
+  { "jne", OP_READS_FLAGS | OP_BARRIER },
+  { "je", OP_READS_FLAGS | OP_BARRIER },
+  /* directives */
+  { ".p2align", 0 },
+  { NULL, 0 }
+};
+
+/* 32 bits names of the registers, in the order of reg_e */
+static const char *reg_names32[REG_COUNT] = {
+  "%eax", "%ebx", "%ecx", "%edx", "%esi", "%edi", "%r8d", "%r9d",
+  "%r10d", "%r11d", "%r12d", "%r13d", "%r14d", "%r15d", "%ebp"
+};
+
+/**
+ * The function being optimized: its lines, the description of the
+ * instruction of each line (NULL for a label or an unknown one), the
+ * register of the dst operand of each line (see peephole_reg) and the
+ * lines removed by the rules
+ */
+typedef struct peephole_t {
+  asm_code_t *code;
+  const peephole_op_t **ops;
+  int *dst_regs;
+  bool *removed;
+} peephole_t;
+
+typedef struct peephole_rule_t {
+  const char *name;
+  bool (*apply) (peephole_t *p, size_t i);
+  bool enabled;
+  size_t fired;
+} peephole_rule_t;
+
+static
+const peephole_op_t *peephole_op (asm_line_t *line)
+{
+  if (!line->op[0])
+    return NULL;
+  for (const peephole_op_t *op = peephole_ops; op->name; op++)
+    if (!strcmp(op->name, line->op) && (line->dst[0] || !(op->flags & OP_WRITES_DST)))
+      return op;
+  return NULL;
+}
+
+static
+bool peephole_is (peephole_t *p, size_t i, unsigned flags)
+{
+  return p->ops[i] && (p->ops[i]->flags & flags);
+}
+
+static
+bool peephole_known (peephole_t *p, size_t i)
+{
+  return p->ops[i] && !(p->ops[i]->flags & OP_BARRIER);
+}
+
+/**
+ * Gives the reg_e of a register operand (64 or 32 bits), -1 for anything
+ * else
+ */
+static
+int peephole_reg (const char *operand)
+{
+  if (operand[0] != '%')
+    return -1;
+  for (int reg = 0; reg < REG_COUNT; reg++)
+    if (!strcmp(operand, reg_names[reg]) || !strcmp(operand, reg_names32[reg]))
+      return reg;
+  return -1;
+}
+
+static
+bool peephole_is_memory (const char *operand)
+{
+  return strchr(operand, '(') != NULL;
+}
+
+/**
+ * Tells whether line i modifies the operand (of register reg): it writes
+ * it, or writes a register the operand is the address of
+ */
+static
+bool peephole_writes (peephole_t *p, size_t i, const char *operand, int reg)
+{
+  if (!peephole_is(p, i, OP_WRITES_DST))
+    return false;
+  const char *dst = p->code->lines[i].dst;
+  return !strcmp(dst, operand) ||
+         (reg >= 0 && reg == p->dst_regs[i]) ||
+         (dst[0] == '%' && peephole_is_memory(operand) && strstr(operand, dst));
+}
+
+static
+size_t peephole_next (peephole_t *p, size_t i)
+{
+  for (i++; i < p->code->count && p->removed[i]; i++)
+    ;
+  return i;
+}
+
+/**
+ * Gives the line before i, p->code->count if there is none
+ */
+static
+size_t peephole_prev (peephole_t *p, size_t i)
+{
+  while (i-- > 0)
+    if (!p->removed[i])
+      return i;
+  return p->code->count;
+}
+
+/**
+ * Tells whether the flags are dead after line i: nothing reads them before
+ * they are set again. When only is given, the jumps with this name (and
+ * only them) can read them
+ */
+static
+bool peephole_flags_dead (peephole_t *p, size_t i, const char *only, const char *only2)
+{
+  for (size_t j = peephole_next(p, i); j < p->code->count; j = peephole_next(p, j)) {
+    asm_line_t *line = &p->code->lines[j];
+    if (!line->op[0])
+      return true;
+    if (!p->ops[j])
+      return false;
+    if (p->ops[j]->flags & OP_READS_FLAGS) {
+      if (!only || (strcmp(line->op, only) && strcmp(line->op, only2)))
+        return false;
+    }
+    else if (p->ops[j]->flags & (OP_SETS_FLAGS | OP_LEAVES))
+      return true;
+  }
+  return true;
+}
+
+/**
+ * movq A, B; ...; movq A, B (or movq B, A): the second copy is removed when
+ * nothing modified A or B in between
+ */
+static
+bool peephole_redundant_load (peephole_t *p, size_t i)
+{
+  asm_line_t *copy = &p->code->lines[i];
+  if (strcmp(copy->op, "movq"))
+    return false;
+  int src_reg = peephole_reg(copy->src), dst_reg = p->dst_regs[i];
+
+  size_t j = i;
+  for (int steps = 0; steps < PEEPHOLE_WINDOW; steps++) {
+    j = peephole_next(p, j);
+    if (j == p->code->count || !peephole_known(p, j))
+      return false;
+    asm_line_t *line = &p->code->lines[j];
+    if (!strcmp(line->op, "movq") &&
+        ((!strcmp(line->src, copy->src) && !strcmp(line->dst, copy->dst)) ||
+         (!strcmp(line->src, copy->dst) && !strcmp(line->dst, copy->src)))) {
+      p->removed[j] = true;
+      return true;
+    }
+    if (peephole_writes(p, j, copy->src, src_reg) ||
+        peephole_writes(p, j, copy->dst, dst_reg))
+      return false;
+  }
+  return false;
+}
+
+/**
+ * movq R, M; ...; op M, X  =>  movq R, M; ...; op R, X
+ * the slot M is read from the register R it was just stored from, as long
+ * as neither is modified. A copy of R to itself is removed
+ */
+static
+bool peephole_store_forward (peephole_t *p, size_t i)
+{
+  asm_line_t *store = &p->code->lines[i];
+  int reg = peephole_reg(store->src);
+  if (strcmp(store->op, "movq") || reg < 0 || !peephole_is_memory(store->dst))
+    return false;
+
+  bool fired = false;
+  size_t j = i;
+  for (int steps = 0; steps < PEEPHOLE_WINDOW; steps++) {
+    j = peephole_next(p, j);
+    if (j == p->code->count || !peephole_known(p, j))
+      break;
+    asm_line_t *line = &p->code->lines[j];
+    if (!strcmp(line->src, store->dst)) {
+      strcpy(line->src, store->src);
+      fired = true;
+      if (!strcmp(line->op, "movq") && !strcmp(line->src, line->dst))
+        p->removed[j] = true;
+    }
+    /* cmpq only reads its second operand */
+    if (!strcmp(line->dst, store->dst) && !peephole_is(p, j, OP_WRITES_DST)) {
+      strcpy(line->dst, store->src);
+      p->dst_regs[j] = reg;
+      fired = true;
+    }
+    if (peephole_writes(p, j, store->src, reg) || peephole_writes(p, j, store->dst, -1))
+      break;
+  }
+  return fired;
+}
+
+/**
+ * movq $0, %rax  =>  xorl %eax, %eax
+ * writing the 32 bits register clears the upper half too, but xorl sets
+ * the flags: nothing after it may read them
+ */
+static
+bool peephole_zero_idiom (peephole_t *p, size_t i)
+{
+  asm_line_t *line = &p->code->lines[i];
+  int reg = p->dst_regs[i];
+  if (strcmp(line->op, "movq") || strcmp(line->src, "$0") || reg < 0 ||
+      !peephole_flags_dead(p, i, NULL, NULL))
+    return false;
+
+  strcpy(line->op, "xorl");
+  strcpy(line->src, reg_names32[reg]);
+  strcpy(line->dst, reg_names32[reg]);
+  p->ops[i] = peephole_op(line);
+  return true;
+}
+
+/**
+ * addq Y, X; ...; cmpq $0, X; je L  =>  addq Y, X; ...; je L
+ * addq and subq set the zero flag like cmpq $0 of their result. They set
+ * the other flags differently, so only je and jne may read them.
+ * The lines in between can only be copies which do not modify X
+ */
+static
+bool peephole_cmp_zero (peephole_t *p, size_t i)
+{
+  asm_line_t *compare = &p->code->lines[i];
+  if (strcmp(compare->op, "cmpq") || strcmp(compare->src, "$0") ||
+      !peephole_flags_dead(p, i, "je", "jne"))
+    return false;
+
+  size_t j = i;
+  for (int steps = 0; steps < PEEPHOLE_WINDOW; steps++) {
+    j = peephole_prev(p, j);
+    if (j == p->code->count || !peephole_known(p, j))
+      return false;
+    asm_line_t *line = &p->code->lines[j];
+    if (peephole_is(p, j, OP_SETS_FLAGS)) {
+      if ((strcmp(line->op, "addq") && strcmp(line->op, "subq")) ||
+          strcmp(line->dst, compare->dst))
+        return false;
+      p->removed[i] = true;
+      return true;
+    }
+    if (peephole_writes(p, j, compare->dst, p->dst_regs[i]))
+      return false;
+  }
+  return false;
+}
+
+/**
+ * The rules, in the order they are tried at each line
+ */
+static peephole_rule_t peephole_rules[] = {
+  { "redundant-load", peephole_redundant_load, true, 0 },
+  { "store-forward", peephole_store_forward, true, 0 },
+  { "cmp-zero", peephole_cmp_zero, true, 0 },
+  { "zero-idiom", peephole_zero_idiom, true, 0 },
+};
+#define PEEPHOLE_RULE_COUNT (sizeof(peephole_rules) / sizeof(peephole_rules[0]))
+
+/**
+ * Applies the enabled rules to the code of a function, until they don't
+ * change anything, then removes the lines they marked
+ */
+void peephole_function (asm_code_t *code)
+{
+  peephole_t p = {
+    .code = code,
+    .ops = malloc((code->count + 1) * sizeof(peephole_op_t *)),
+    .dst_regs = malloc((code->count + 1) * sizeof(int)),
+    .removed = calloc(code->count + 1, sizeof(bool))
+  };
+  for (size_t i = 0; i < code->count; i++) {
+    p.ops[i] = peephole_op(&code->lines[i]);
+    p.dst_regs[i] = peephole_reg(code->lines[i].dst);
+  }
+
+  bool changed = true;
+  for (int pass = 0; changed && pass < PEEPHOLE_MAX_PASSES; pass++) {
+    changed = false;
+    for (size_t i = 0; i < code->count; i++) {
+      for (size_t r = 0; r < PEEPHOLE_RULE_COUNT && !p.removed[i]; r++) {
+        peephole_rule_t *rule = &peephole_rules[r];
+        if (rule->enabled && rule->apply(&p, i)) {
+          rule->fired++;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < code->count; i++)
+    if (!p.removed[i])
+      code->lines[count++] = code->lines[i];
+  code->count = count;
+  free(p.ops);
+  free(p.dst_regs);
+  free(p.removed);
+}
+
+/**
+ * Disables the rules of a comma separated list, "all" disables every rule,
+ * for --disable-peephole=<rules>
+ */
+void peephole_disable (const char *names)
+{
+  while (*names) {
+    size_t length = strcspn(names, ",");
+    bool found = false;
+    for (size_t r = 0; r < PEEPHOLE_RULE_COUNT; r++) {
+      peephole_rule_t *rule = &peephole_rules[r];
+      if ((strlen(rule->name) == length && !strncmp(rule->name, names, length)) ||
+          (length == 3 && !strncmp(names, "all", 3))) {
+        rule->enabled = false;
+        found = true;
+      }
+    }
+    if (!found) {
+      printf("Unknown peephole rule '%.*s'.\n", (int)length, names);
+      exit(1);
+    }
+    names += length;
+    if (*names == ',')
+      names++;
+  }
+}
+
+/**
+ * prints how many times each rule fired in the program, for
+ * --report=peephole
+ */
+void peephole_report ()
+{
+  for (size_t r = 0; r < PEEPHOLE_RULE_COUNT; r++) {
+    peephole_rule_t *rule = &peephole_rules[r];
+    printf("peephole: %s: %zu%s\n", rule->name, rule->fired,
+           rule->enabled ? "" : " (disabled)");
+  }
+}
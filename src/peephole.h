@@ -0,0 +1,9 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+#include "asm.h"
+
+void peephole_function (asm_code_t *code);
+void peephole_disable (const char *names);
+void peephole_report ();
+
+#endif /* ifndef PEEPHOLE_H */
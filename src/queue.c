@@ -4,10 +4,11 @@
 #include <assert.h>
 #include <stdbool.h>
 #include "queue.h"
+#include "arena.h"
 
 queue_item_t *queue_new_item (void *data)
 {
-  queue_item_t *item = malloc(sizeof(queue_item_t)); 
+  queue_item_t *item = arena_malloc(sizeof(queue_item_t));
   item->data = data;
   item->next = NULL;
   return item;
@@ -35,7 +36,7 @@ void *queue_dequeue (myqueue_t *queue)
   queue_item_t *item = *queue;
   *queue = (*queue)->next;
   void *data = item->data;
-  free(item);
+  arena_dispose(item, sizeof(queue_item_t));
   return data;
 }
 
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "regalloc.h"
+#include "options.h"
+
+/**
+ * Linear scan register allocation of the tmps of a function
+ *
+ * Each tmp lives from its first to its last occurrence in the instruction
+ * array, its live interval. When the interval meets a loop (a jump back
+ * to a label), the tmp is alive during the whole loop: it is used again at
+ * the next iteration, so the interval is extended up to the back edge.
+ *
+ * The intervals are then visited by increasing start. The ones which ended
+ * give their register back, the current one takes a free register:
+ *  - the register of the tmp it is copied from, %rax for the value of a
+ *    call or of a return, or the register an argument is passed in, so
+ *    that the move disappears (the hint)
+ *  - not the register of the right operand of a subtraction defining it,
+ *    when another one is free: asm.c would first copy the operand to
+ *    %rcx, to write the left one over it
+ *  - else a register the called functions may destroy (%rax, %r10 and the
+ *    argument registers): it does not have to be saved by the prolog
+ *  - else a callee-saved register (%rbx, %r12 - %r15, and %rbp when the
+ *    frame is addressed from %rsp, see --omit-frame-pointer)
+ * A tmp alive across a CALL can only be in a callee-saved register. The
+ * PARAMs of a call write the argument registers and a division %rdx: a tmp
+ * alive in a PARAM ... CALL sequence or at a DIV does not get them (its
+ * clobbered registers). An argument only takes its own argument register,
+ * the prolog would otherwise write over another argument before moving it.
+ *
+ * When no register is free, the interval ending last (the current one or an
+ * active one) is spilled: its tmp gets a stack slot after the local
+ * variables, and asm.c reads it from memory.
+ *
+ * Finally the tmps of the instructions are replaced by their register
+ * (TAC_OPND_REG) or their slot (TAC_OPND_LOCAL).
+ *
+ * With --promote-locals, the variables (arguments and locals) are given
+ * registers the same way, and only stay in memory when they are spilled.
+ * The slots are then renumbered: the variables in memory first, then the
+ * spilled tmps, the promoted and unused variables take no slot of the frame.
+ * Unlike a tmp, a variable can be written several times, in any branch: a
+ * variable met in a loop is kept alive during the whole loop. The arguments
+ * are written at the start of the function, by the prolog.
+ * Out of SSA form (--ssa), a tmp can also be written several times, by the
+ * copies of a phi: it is kept alive during a loop it meets, like a variable.
+ */
+
+const char *reg_names[REG_COUNT] = {
+  "%rax", "%rbx", "%rcx", "%rdx", "%rsi", "%rdi", "%r8", "%r9",
+  "%r10", "%r11", "%r12", "%r13", "%r14", "%r15", "%rbp"
+};
+
+#define NO_REG -1
+
+/* the registers of the arguments, in the order of call_registers (asm.c) */
+#ifdef WIN32
+static const int arg_regs[] = { REG_RCX, REG_RDX, REG_R8, REG_R9 };
+#else
+static const int arg_regs[] = { REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9 };
+#endif
+#define ARG_REG_COUNT (sizeof(arg_regs) / sizeof(arg_regs[0]))
+
+typedef struct interval_t {
+  size_t start; // position of the first occurrence, SIZE_MAX if unused
+  size_t end; // position of the last occurrence
+  bool starts_with_use; // read before being written, in a loop
+  bool returned; // value of a RETURN
+  bool crosses_call;
+  bool variable; // promoted variable, its slot is its spill slot
+  bool redefined; // tmp written by several instructions, see ssa.c
+  bool param;
+  unsigned clobbered; // registers written while it is alive
+  int reg; // NO_REG when spilled
+  long slot;
+} interval_t;
+
+typedef struct back_edge_t {
+  size_t label; // position of the label
+  size_t jump; // position of the jump to the label, after it
+} back_edge_t;
+
+/**
+ * Gives the interval of an operand: the tmps come first, then the promoted
+ * variables. -1 for the other operands
+ */
+long regalloc_index (tac_function_t *fn, tac_operand_t *operand)
+{
+  if (operand->kind == TAC_OPND_TMP)
+    return operand->value;
+  if (options.promote_locals && operand->kind == TAC_OPND_LOCAL &&
+      (size_t)operand->value < fn->local_count)
+    return fn->tmp_count + operand->value;
+  return -1;
+}
+
+/**
+ * Records an occurrence of a tmp or a variable at the position pos
+ */
+void regalloc_occurrence (tac_function_t *fn, interval_t *intervals,
+    tac_operand_t *operand, size_t pos, bool use)
+{
+  long index = regalloc_index(fn, operand);
+  if (index < 0)
+    return;
+  interval_t *interval = &intervals[index];
+  if (interval->start == SIZE_MAX) {
+    interval->start = pos;
+    interval->starts_with_use = use;
+  }
+  interval->end = pos;
+}
+
+/**
+ * Lists the jumps going back to a label, see tac_label_range
+ */
+back_edge_t *regalloc_back_edges (tac_function_t *fn, size_t *count)
+{
+  long first;
+  size_t label_count;
+  tac_label_range(fn, &first, &label_count);
+  *count = 0;
+  if (label_count == 0)
+    return NULL;
+
+  /* SIZE_MAX until the label is seen: a jump to a label already seen goes
+   * backwards */
+  size_t *positions = malloc(label_count * sizeof(size_t));
+  for (size_t label = 0; label < label_count; label++)
+    positions[label] = SIZE_MAX;
+  back_edge_t *edges = NULL;
+  size_t capacity = 0;
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (instr->op == TAC_LABEL)
+      positions[instr->dst.value - first] = i;
+    else if (TAC_IS_JUMP(instr->op) && instr->dst.value >= first &&
+             instr->dst.value < first + (long)label_count && positions[instr->dst.value - first] != SIZE_MAX) {
+      size_t label = positions[instr->dst.value - first];
+      if (*count == capacity) {
+        capacity = capacity ? capacity * 2 : 8;
+        edges = realloc(edges, capacity * sizeof(back_edge_t));
+      }
+      edges[(*count)++] = (back_edge_t){ label, i };
+    }
+  }
+  free(positions);
+  return edges;
+}
+
+/**
+ * Computes the live interval of each tmp and promoted variable
+ */
+interval_t *regalloc_intervals (tac_function_t *fn, size_t count)
+{
+  interval_t *intervals = malloc(count * sizeof(interval_t));
+  for (size_t t = 0; t < count; t++) {
+    intervals[t] = (interval_t){ .start = SIZE_MAX, .reg = NO_REG };
+    if (t >= fn->tmp_count) {
+      intervals[t].variable = true;
+      intervals[t].param = t - fn->tmp_count < fn->param_count;
+      intervals[t].slot = t - fn->tmp_count;
+    }
+  }
+
+  bool *written = calloc(fn->tmp_count + 1, sizeof(bool));
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    regalloc_occurrence(fn, intervals, &instr->src1, i, true);
+    regalloc_occurrence(fn, intervals, &instr->src2, i, true);
+    regalloc_occurrence(fn, intervals, &instr->dst, i, false);
+    long index = regalloc_index(fn, &instr->src1);
+    if (instr->op == TAC_RETURN && index >= 0)
+      intervals[index].returned = true;
+    if (instr->dst.kind == TAC_OPND_TMP) {
+      intervals[instr->dst.value].redefined |= written[instr->dst.value];
+      written[instr->dst.value] = true;
+    }
+  }
+  free(written);
+  /* the used arguments are written before the first instruction */
+  for (size_t t = fn->tmp_count; t < count; t++) {
+    if (intervals[t].param && intervals[t].start != SIZE_MAX) {
+      intervals[t].start = 0;
+      intervals[t].starts_with_use = false;
+    }
+  }
+
+  /* a loop can contain other loops, extending an interval to one loop can
+   * make it meet another one */
+  size_t edge_count;
+  back_edge_t *edges = regalloc_back_edges(fn, &edge_count);
+  bool changed = edge_count > 0;
+  while (changed) {
+    changed = false;
+    for (size_t t = 0; t < count; t++) {
+      interval_t *interval = &intervals[t];
+      if (interval->start == SIZE_MAX)
+        continue;
+      for (size_t e = 0; e < edge_count; e++) {
+        back_edge_t *edge = &edges[e];
+        /* a variable or a redefined tmp is alive in the whole loop, so is a
+         * tmp read before being written in the loop, or written in the loop
+         * and read after */
+        bool meets = interval->start <= edge->jump && interval->end >= edge->label;
+        bool enters = interval->start < edge->label &&
+                      interval->end >= edge->label && interval->end < edge->jump;
+        bool leaves = interval->start > edge->label &&
+                      interval->start <= edge->jump && interval->end > edge->jump;
+        bool inside = interval->starts_with_use &&
+                      interval->start > edge->label && interval->start < edge->jump;
+        if (((interval->variable || interval->redefined) && meets) || leaves || inside) {
+          if (interval->start > edge->label) {
+            interval->start = edge->label;
+            changed = true;
+          }
+          enters = true;
+        }
+        if (enters && interval->end < edge->jump) {
+          interval->end = edge->jump;
+          changed = true;
+        }
+      }
+    }
+  }
+  free(edges);
+
+  /* calls_before[i] is the number of calls before the position i, so are
+   * params_before and divs_before for the positions in a PARAM ... CALL
+   * sequence (the CALL excluded) and the DIVs */
+  size_t *calls_before = malloc(3 * (fn->count + 1) * sizeof(size_t));
+  size_t *params_before = calls_before + fn->count + 1,
+         *divs_before = params_before + fn->count + 1;
+  bool in_params = false;
+  calls_before[0] = params_before[0] = divs_before[0] = 0;
+  for (size_t i = 0; i < fn->count; i++) {
+    tac_opcode_e op = fn->instrs[i].op;
+    in_params = (in_params || op == TAC_PARAM) && op != TAC_CALL;
+    calls_before[i + 1] = calls_before[i] + (op == TAC_CALL);
+    params_before[i + 1] = params_before[i] + in_params;
+    divs_before[i + 1] = divs_before[i] + (op == TAC_DIV);
+  }
+  for (size_t t = 0; t < count; t++) {
+    interval_t *interval = &intervals[t];
+    if (interval->start == SIZE_MAX)
+      continue;
+    /* the arguments are written before the first instruction, a call in
+     * it is crossed */
+    size_t first = interval->param ? 0 : interval->start + 1;
+    interval->crosses_call = calls_before[interval->end] > calls_before[first];
+    /* an argument can keep its own register at the entry, the prolog writes
+     * the other ones */
+    if (interval->param) {
+      interval->clobbered |= REG_ARGUMENTS;
+      if ((size_t)interval->slot < ARG_REG_COUNT)
+        interval->clobbered &= ~REG_BIT(arg_regs[interval->slot]);
+    }
+    if (params_before[interval->end + 1] > params_before[interval->start])
+      interval->clobbered |= REG_ARGUMENTS;
+    if (divs_before[interval->end + 1] > divs_before[interval->start])
+      interval->clobbered |= REG_BIT(REG_RDX);
+  }
+  free(calls_before);
+  return intervals;
+}
+
+/**
+ * The register the interval would like to have, see the top of the file
+ */
+int regalloc_hint (tac_function_t *fn, interval_t *intervals, interval_t *interval)
+{
+  if (!interval->starts_with_use && !interval->param) {
+    tac_instr_t *def = &fn->instrs[interval->start];
+    if (def->op == TAC_CALL)
+      return REG_RAX;
+    long src_index = regalloc_index(fn, &def->src1);
+    if ((def->op == TAC_ASSIGN || TAC_IS_ARITHMETIC(def->op)) && src_index >= 0) {
+      interval_t *src = &intervals[src_index];
+      if (src->reg != NO_REG && src->end == interval->start)
+        return src->reg;
+    }
+  }
+  if (interval->param && (size_t)interval->slot < ARG_REG_COUNT)
+    return arg_regs[interval->slot];
+  return interval->returned ? REG_RAX : NO_REG;
+}
+
+/**
+ * The register the interval should not take: the one of the right operand
+ * of the subtraction defining it, which ends there
+ */
+static
+unsigned regalloc_avoid (tac_function_t *fn, interval_t *intervals, interval_t *interval)
+{
+  if (interval->starts_with_use || interval->param)
+    return 0;
+  tac_instr_t *def = &fn->instrs[interval->start];
+  long src_index = regalloc_index(fn, &def->src2);
+  if (def->op != TAC_SUB || src_index < 0 || tac_operand_equals(&def->src1, &def->src2))
+    return 0;
+  interval_t *src = &intervals[src_index];
+  return src->reg != NO_REG ? REG_BIT(src->reg) : 0;
+}
+
+/**
+ * Picks a register among the free ones, see the top of the file
+ */
+int regalloc_choose (tac_function_t *fn, unsigned allowed, int hint)
+{
+  if (hint != NO_REG && (allowed & REG_BIT(hint)))
+    return hint;
+  if (allowed & ~REG_CALLEE_SAVED)
+    allowed &= ~REG_CALLEE_SAVED;
+  else if (allowed & fn->saved_regs)
+    allowed &= fn->saved_regs;
+  return __builtin_ctz(allowed);
+}
+
+void regalloc_spill (tac_function_t *fn, interval_t *interval)
+{
+  interval->reg = NO_REG;
+  if (!interval->variable)
+    interval->slot = fn->local_count + fn->spill_count++;
+}
+
+/**
+ * active is sorted by increasing end
+ */
+void regalloc_activate (interval_t **active, size_t *count, interval_t *interval)
+{
+  size_t i = *count;
+  while (i > 0 && active[i - 1]->end > interval->end) {
+    active[i] = active[i - 1];
+    i--;
+  }
+  active[i] = interval;
+  (*count)++;
+}
+
+int regalloc_compare_start (const void *a, const void *b)
+{
+  const interval_t *ia = *(interval_t * const *)a, *ib = *(interval_t * const *)b;
+  if (ia->start != ib->start)
+    return ia->start < ib->start ? -1 : 1;
+  if (ia->param != ib->param)
+    return ia->param ? -1 : 1;
+  return ia < ib ? -1 : ia > ib;
+}
+
+void regalloc_scan (tac_function_t *fn, interval_t *intervals, size_t count)
+{
+  interval_t **order = malloc(count * sizeof(interval_t *));
+  size_t order_count = 0;
+  for (size_t t = 0; t < count; t++)
+    if (intervals[t].start != SIZE_MAX)
+      order[order_count++] = &intervals[t];
+  qsort(order, order_count, sizeof(interval_t *), regalloc_compare_start);
+
+  interval_t *active[REG_COUNT];
+  size_t active_count = 0;
+  unsigned allocatable = REG_ALLOCATABLE;
+  if (options.omit_frame_pointer)
+    allocatable |= REG_BIT(REG_RBP);
+  unsigned free_regs = allocatable;
+  for (size_t o = 0; o < order_count; o++) {
+    interval_t *current = order[o];
+
+    /* a register read by the instruction defining current can be reused,
+     * the arguments are all alive before the first instruction */
+    size_t expired = 0;
+    while (!current->param && expired < active_count &&
+           active[expired]->end <= current->start)
+      free_regs |= REG_BIT(active[expired++]->reg);
+    for (size_t i = expired; i < active_count; i++)
+      active[i - expired] = active[i];
+    active_count -= expired;
+
+    unsigned candidates = current->crosses_call ? allocatable & REG_CALLEE_SAVED : allocatable;
+    candidates &= ~current->clobbered;
+    if (free_regs & candidates) {
+      unsigned allowed = free_regs & candidates;
+      unsigned avoid = regalloc_avoid(fn, intervals, current);
+      if (allowed & ~avoid)
+        allowed &= ~avoid;
+      current->reg = regalloc_choose(fn, allowed, regalloc_hint(fn, intervals, current));
+    }
+    else {
+      /* takes the register of the active interval ending last, if it ends
+       * after current */
+      size_t victim = active_count;
+      while (victim > 0 && !(candidates & REG_BIT(active[victim - 1]->reg)))
+        victim--;
+      if (victim == 0 || active[victim - 1]->end <= current->end) {
+        regalloc_spill(fn, current);
+        continue;
+      }
+      interval_t *spilled = active[--victim];
+      current->reg = spilled->reg;
+      free_regs |= REG_BIT(spilled->reg);
+      regalloc_spill(fn, spilled);
+      for (size_t i = victim + 1; i < active_count; i++)
+        active[i - 1] = active[i];
+      active_count--;
+    }
+
+    free_regs &= ~REG_BIT(current->reg);
+    if (REG_CALLEE_SAVED & REG_BIT(current->reg))
+      fn->saved_regs |= REG_BIT(current->reg);
+    regalloc_activate(active, &active_count, current);
+  }
+  free(order);
+}
+
+void regalloc_rewrite (tac_function_t *fn, tac_operand_t *operand, interval_t *intervals)
+{
+  long index = regalloc_index(fn, operand);
+  if (index < 0)
+    return;
+  interval_t *interval = &intervals[index];
+  if (interval->reg == NO_REG)
+    *operand = tac_local(interval->slot);
+  else
+    *operand = (tac_operand_t){ .kind = TAC_OPND_REG, .value = interval->reg };
+}
+
+/**
+ * prints the result of the allocation of a function, for --report=regalloc
+ */
+void regalloc_report (tac_function_t *fn)
+{
+  printf("regalloc: %s: %zu tmps, %zu spilled, ", fn->name, fn->tmp_count, fn->spill_count);
+  if (options.promote_locals) {
+    size_t promoted = 0;
+    for (size_t slot = 0; slot < fn->local_count; slot++)
+      promoted += fn->places[slot].kind == TAC_OPND_REG;
+    printf("%zu/%zu variables in registers, ", promoted, fn->local_count);
+  }
+  printf("callee-saved:");
+  for (int reg = 0; reg < REG_COUNT; reg++)
+    if (fn->saved_regs & REG_BIT(reg))
+      printf(" %s", reg_names[reg]);
+  printf("\n");
+}
+
+/**
+ * Gives the final slots: the variables left in memory, in their order, then
+ * the spilled tmps. Returns the number of slots of the frame
+ */
+size_t regalloc_slots (tac_function_t *fn, interval_t *intervals, size_t count)
+{
+  size_t slots = options.promote_locals ? 0 : fn->local_count;
+  for (size_t t = fn->tmp_count; t < count; t++)
+    if (intervals[t].reg == NO_REG && intervals[t].start != SIZE_MAX)
+      intervals[t].slot = slots++;
+  for (size_t t = 0; t < fn->tmp_count; t++)
+    if (intervals[t].reg == NO_REG)
+      intervals[t].slot += (long)slots - (long)fn->local_count;
+  return slots + fn->spill_count;
+}
+
+/**
+ * Replaces the tmps of a function by registers or stack slots
+ * fn->slot_count and fn->saved_regs tell asm.c the size of the frame and
+ * the registers to save in the prolog, fn->places where the prolog moves
+ * the arguments (TAC_OPND_NONE for an unused promoted one)
+ */
+void regalloc_function (tac_function_t *fn)
+{
+  size_t count = fn->tmp_count + (options.promote_locals ? fn->local_count : 0);
+  fn->spill_count = 0;
+  fn->slot_count = fn->local_count;
+  fn->saved_regs = 0;
+  fn->places = realloc(fn->places, (fn->local_count + 1) * sizeof(tac_operand_t));
+  for (size_t slot = 0; slot < fn->local_count; slot++)
+    fn->places[slot] = tac_local(slot);
+  if (count > 0) {
+    interval_t *intervals = regalloc_intervals(fn, count);
+    regalloc_scan(fn, intervals, count);
+    fn->slot_count = regalloc_slots(fn, intervals, count);
+    for (size_t i = 0; i < fn->count; i++) {
+      regalloc_rewrite(fn, &fn->instrs[i].dst, intervals);
+      regalloc_rewrite(fn, &fn->instrs[i].src1, intervals);
+      regalloc_rewrite(fn, &fn->instrs[i].src2, intervals);
+    }
+    for (size_t slot = 0; slot < fn->local_count && options.promote_locals; slot++) {
+      if (intervals[fn->tmp_count + slot].start == SIZE_MAX)
+        fn->places[slot] = (tac_operand_t){ .kind = TAC_OPND_NONE };
+      else
+        regalloc_rewrite(fn, &fn->places[slot], intervals);
+    }
+    free(intervals);
+  }
+  if (options.report & REPORT_REGALLOC)
+    regalloc_report(fn);
+}
@@ -0,0 +1,50 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+#include "tac.h"
+
+/**
+ * x86_64 general purpose registers, except %rsp. %rbp is the frame pointer,
+ * it is only given to the tmps with --omit-frame-pointer
+ */
+typedef enum {
+  REG_RAX,
+  REG_RBX,
+  REG_RCX,
+  REG_RDX,
+  REG_RSI,
+  REG_RDI,
+  REG_R8,
+  REG_R9,
+  REG_R10,
+  REG_R11,
+  REG_R12,
+  REG_R13,
+  REG_R14,
+  REG_R15,
+  REG_RBP,
+  REG_COUNT
+} reg_e;
+
+#define REG_BIT(reg) (1u << (reg))
+/* kept intact by the called functions, a function using them saves them */
+#define REG_CALLEE_SAVED (REG_BIT(REG_RBX) | REG_BIT(REG_R12) | \
+    REG_BIT(REG_R13) | REG_BIT(REG_R14) | REG_BIT(REG_R15) | REG_BIT(REG_RBP))
+/* the argument registers, except %rcx. They are written by the PARAMs
+ * (%rdx by the divisions too): only the tmps alive at none of these get
+ * them, see regalloc.c */
+#ifdef WIN32
+#define REG_ARGUMENTS (REG_BIT(REG_RDX) | REG_BIT(REG_R8) | REG_BIT(REG_R9))
+#else
+#define REG_ARGUMENTS (REG_BIT(REG_RDI) | REG_BIT(REG_RSI) | REG_BIT(REG_RDX) | \
+    REG_BIT(REG_R8) | REG_BIT(REG_R9))
+#endif
+/* given to the tmps. %r11 and %rcx are the scratch registers of asm.c,
+ * %rbp is the frame pointer unless --omit-frame-pointer */
+#define REG_ALLOCATABLE (REG_BIT(REG_RAX) | REG_BIT(REG_R10) | REG_ARGUMENTS | \
+    (REG_CALLEE_SAVED & ~REG_BIT(REG_RBP)))
+
+extern const char *reg_names[REG_COUNT];
+
+void regalloc_function (tac_function_t *fn);
+
+#endif /* ifndef REGALLOC_H */
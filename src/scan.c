@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#define DIGIT (SCAN_DIGIT | SCAN_IDENT)
+#define ALPHA SCAN_IDENT
+
+const unsigned char scan_classes[256] = {
+  [' '] = SCAN_BLANK, ['\n'] = SCAN_BLANK, ['\t'] = SCAN_BLANK,
+  ['0' ... '9'] = DIGIT,
+  ['a' ... 'z'] = ALPHA,
+  ['A' ... 'Z'] = ALPHA,
+  ['_'] = ALPHA
+};
+
+const char *scan_class (const char *curr, const char *end, unsigned char class)
+{
+  while (curr < end && SCAN_IS(*curr, class))
+    curr++;
+  return curr;
+}
+
+static const char *scan_blanks_scalar (const char *curr, const char *end)
+{ return scan_class(curr, end, SCAN_BLANK); }
+
+static const char *scan_identifier_scalar (const char *curr, const char *end)
+{ return scan_class(curr, end, SCAN_IDENT); }
+
+static const char *scan_digits_scalar (const char *curr, const char *end)
+{ return scan_class(curr, end, SCAN_DIGIT); }
+
+#ifdef SCAN_X86
+/**
+ * The vector versions compute, for 16 (or 32) characters at once, a mask of
+ * the characters that belong to the class. The run ends at the first zero
+ * bit of the mask, the last bytes of the input are left to the scalar loop
+ * so nothing is read past end.
+ * Bytes >= 0x80 are negative in the signed comparisons, so they never belong
+ * to a class.
+ * Most runs of blanks are a single space, so the second character is checked
+ * before loading a whole vector
+ */
+#define SCAN_IN(vec, low, high, set1, cmpgt, cmplt, and) \
+  and(cmpgt(vec, set1((low) - 1)), cmplt(vec, set1((high) + 1)))
+
+#define SCAN_LOOP(width, type, load, movemask, classify, class, fallback) \
+  if (end - curr < width || !SCAN_IS(curr[1], class))                 \
+    return fallback(curr, end);                                       \
+  while (end - curr >= width) {                                       \
+    type vec = load((const type *)curr);                              \
+    unsigned mask = ~(unsigned)movemask(classify(vec));               \
+    if (width < 32) mask &= (1u << (width & 31)) - 1;                 \
+    if (mask)                                                         \
+      return curr + __builtin_ctz(mask);                              \
+    curr += width;                                                    \
+  }                                                                   \
+  return fallback(curr, end);
+
+static inline __m128i scan_sse2_blank (__m128i vec)
+{
+  __m128i space = _mm_cmpeq_epi8(vec, _mm_set1_epi8(' '));
+  __m128i newline = _mm_cmpeq_epi8(vec, _mm_set1_epi8('\n'));
+  __m128i tab = _mm_cmpeq_epi8(vec, _mm_set1_epi8('\t'));
+  return _mm_or_si128(space, _mm_or_si128(newline, tab));
+}
+
+static inline __m128i scan_sse2_digit (__m128i vec)
+{
+  return SCAN_IN(vec, '0', '9', _mm_set1_epi8,
+      _mm_cmpgt_epi8, _mm_cmplt_epi8, _mm_and_si128);
+}
+
+static inline __m128i scan_sse2_ident (__m128i vec)
+{
+  /* setting the 0x20 bit puts upper case letters on the lower case ones */
+  __m128i lower = _mm_or_si128(vec, _mm_set1_epi8(0x20));
+  __m128i alpha = SCAN_IN(lower, 'a', 'z', _mm_set1_epi8,
+      _mm_cmpgt_epi8, _mm_cmplt_epi8, _mm_and_si128);
+  __m128i underscore = _mm_cmpeq_epi8(vec, _mm_set1_epi8('_'));
+  return _mm_or_si128(alpha, _mm_or_si128(underscore, scan_sse2_digit(vec)));
+}
+
+static const char *scan_blanks_sse2 (const char *curr, const char *end)
+{ SCAN_LOOP(16, __m128i, _mm_loadu_si128, _mm_movemask_epi8, scan_sse2_blank, SCAN_BLANK, scan_blanks_scalar) }
+
+static const char *scan_identifier_sse2 (const char *curr, const char *end)
+{ SCAN_LOOP(16, __m128i, _mm_loadu_si128, _mm_movemask_epi8, scan_sse2_ident, SCAN_IDENT, scan_identifier_scalar) }
+
+static const char *scan_digits_sse2 (const char *curr, const char *end)
+{ SCAN_LOOP(16, __m128i, _mm_loadu_si128, _mm_movemask_epi8, scan_sse2_digit, SCAN_DIGIT, scan_digits_scalar) }
+
+/* AVX2 is compiled for this file only. It is not the default even when the
+ * cpu supports it: the runs of a source file are short (an identifier, a
+ * few blanks), most of them end in the first 16 bytes and the 32 bytes
+ * loads only add work, --bench=lexer measures it slower than SSE2 */
+#define SCAN_AVX2_FN __attribute__((target("avx2")))
+
+/* there is no _mm256_cmplt_epi8, the operands are swapped */
+#define scan_avx2_cmplt(a, b) _mm256_cmpgt_epi8(b, a)
+
+static inline SCAN_AVX2_FN __m256i scan_avx2_blank (__m256i vec)
+{
+  __m256i space = _mm256_cmpeq_epi8(vec, _mm256_set1_epi8(' '));
+  __m256i newline = _mm256_cmpeq_epi8(vec, _mm256_set1_epi8('\n'));
+  __m256i tab = _mm256_cmpeq_epi8(vec, _mm256_set1_epi8('\t'));
+  return _mm256_or_si256(space, _mm256_or_si256(newline, tab));
+}
+
+static inline SCAN_AVX2_FN __m256i scan_avx2_digit (__m256i vec)
+{
+  return SCAN_IN(vec, '0', '9', _mm256_set1_epi8,
+      _mm256_cmpgt_epi8, scan_avx2_cmplt, _mm256_and_si256);
+}
+
+static inline SCAN_AVX2_FN __m256i scan_avx2_ident (__m256i vec)
+{
+  __m256i lower = _mm256_or_si256(vec, _mm256_set1_epi8(0x20));
+  __m256i alpha = SCAN_IN(lower, 'a', 'z', _mm256_set1_epi8,
+      _mm256_cmpgt_epi8, scan_avx2_cmplt, _mm256_and_si256);
+  __m256i underscore = _mm256_cmpeq_epi8(vec, _mm256_set1_epi8('_'));
+  return _mm256_or_si256(alpha, _mm256_or_si256(underscore, scan_avx2_digit(vec)));
+}
+
+static SCAN_AVX2_FN const char *scan_blanks_avx2 (const char *curr, const char *end)
+{ SCAN_LOOP(32, __m256i, _mm256_loadu_si256, _mm256_movemask_epi8, scan_avx2_blank, SCAN_BLANK, scan_blanks_sse2) }
+
+static SCAN_AVX2_FN const char *scan_identifier_avx2 (const char *curr, const char *end)
+{ SCAN_LOOP(32, __m256i, _mm256_loadu_si256, _mm256_movemask_epi8, scan_avx2_ident, SCAN_IDENT, scan_identifier_sse2) }
+
+static SCAN_AVX2_FN const char *scan_digits_avx2 (const char *curr, const char *end)
+{ SCAN_LOOP(32, __m256i, _mm256_loadu_si256, _mm256_movemask_epi8, scan_avx2_digit, SCAN_DIGIT, scan_digits_sse2) }
+#endif /* SCAN_X86 */
+
+typedef const char *(*scan_fn_t)(const char *curr, const char *end);
+
+static const char *scan_blanks_init (const char *curr, const char *end);
+static const char *scan_identifier_init (const char *curr, const char *end);
+static const char *scan_digits_init (const char *curr, const char *end);
+
+static scan_impl_e scan_impl = SCAN_SCALAR;
+static scan_fn_t scan_blanks_fn = scan_blanks_init;
+static scan_fn_t scan_identifier_fn = scan_identifier_init;
+static scan_fn_t scan_digits_fn = scan_digits_init;
+
+scan_impl_e scan_supported_impl ()
+{
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SCAN_AVX2;
+  return SCAN_SSE2;
+#else
+  return SCAN_SCALAR;
+#endif
+}
+
+/**
+ * The default implementation: SSE2 when the cpu supports it, even with
+ * AVX2, see SCAN_AVX2_FN
+ */
+scan_impl_e scan_best_impl ()
+{
+  scan_impl_e supported = scan_supported_impl();
+  return supported > SCAN_SSE2 ? SCAN_SSE2 : supported;
+}
+
+bool scan_set_impl (scan_impl_e impl)
+{
+  if (impl > scan_supported_impl())
+    return false;
+
+  scan_impl = impl;
+  switch (impl) {
+#ifdef SCAN_X86
+    case SCAN_AVX2:
+      scan_blanks_fn = scan_blanks_avx2;
+      scan_identifier_fn = scan_identifier_avx2;
+      scan_digits_fn = scan_digits_avx2;
+      break;
+    case SCAN_SSE2:
+      scan_blanks_fn = scan_blanks_sse2;
+      scan_identifier_fn = scan_identifier_sse2;
+      scan_digits_fn = scan_digits_sse2;
+      break;
+#endif
+    default:
+      scan_blanks_fn = scan_blanks_scalar;
+      scan_identifier_fn = scan_identifier_scalar;
+      scan_digits_fn = scan_digits_scalar;
+      break;
+  }
+  return true;
+}
+
+scan_impl_e scan_get_impl ()
+{
+  if (scan_blanks_fn == scan_blanks_init)
+    scan_set_impl(scan_best_impl());
+  return scan_impl;
+}
+
+const char *scan_impl_name (scan_impl_e impl)
+{
+  switch (impl) {
+    case SCAN_SCALAR: return "scalar";
+    case SCAN_SSE2: return "sse2";
+    case SCAN_AVX2: return "avx2";
+    default: return "";
+  }
+}
+
+static const char *scan_blanks_init (const char *curr, const char *end)
+{
+  scan_set_impl(scan_best_impl());
+  return scan_blanks_fn(curr, end);
+}
+
+static const char *scan_identifier_init (const char *curr, const char *end)
+{
+  scan_set_impl(scan_best_impl());
+  return scan_identifier_fn(curr, end);
+}
+
+static const char *scan_digits_init (const char *curr, const char *end)
+{
+  scan_set_impl(scan_best_impl());
+  return scan_digits_fn(curr, end);
+}
+
+const char *scan_blanks (const char *curr, const char *end)
+{
+  return scan_blanks_fn(curr, end);
+}
+
+const char *scan_identifier (const char *curr, const char *end)
+{
+  return scan_identifier_fn(curr, end);
+}
+
+const char *scan_digits (const char *curr, const char *end)
+{
+  return scan_digits_fn(curr, end);
+}
@@ -0,0 +1,41 @@
+#ifndef SCAN_H
+#define SCAN_H
+#include <stdbool.h>
+
+/**
+ * Character classes of the lexer, one table lookup per character
+ */
+#define SCAN_BLANK  0x01 // ' ', '\n', '\t'
+#define SCAN_DIGIT  0x02 // 0-9
+#define SCAN_IDENT  0x04 // a-z, A-Z, 0-9, '_'
+
+extern const unsigned char scan_classes[256];
+
+#define SCAN_IS(chr, class) (scan_classes[(unsigned char)(chr)] & (class))
+
+/**
+ * Implementations of the scan_* functions, the best one supported by the
+ * cpu is selected at the first call: SSE2, AVX2 only when asked for
+ */
+typedef enum {
+  SCAN_SCALAR,
+  SCAN_SSE2,
+  SCAN_AVX2
+} scan_impl_e;
+
+/** each function returns the end of the run starting at curr **/
+const char *scan_blanks (const char *curr, const char *end);
+const char *scan_identifier (const char *curr, const char *end);
+const char *scan_digits (const char *curr, const char *end);
+/** scalar version, for any combination of classes **/
+const char *scan_class (const char *curr, const char *end, unsigned char class);
+
+scan_impl_e scan_best_impl ();
+/** the last implementation the cpu supports **/
+scan_impl_e scan_supported_impl ();
+scan_impl_e scan_get_impl ();
+/** returns false if the cpu does not support impl **/
+bool        scan_set_impl (scan_impl_e impl);
+const char *scan_impl_name (scan_impl_e impl);
+
+#endif /* ifndef SCAN_H */
@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "ssa.h"
+
+/**
+ * Static single assignment form of the three address code
+ *
+ * The tmps are written once, but a variable can be written anywhere, so
+ * what an instruction reads depends on the path which led to it. In SSA
+ * form each write of a variable gets a new tmp, and where several writes
+ * reach a block, a phi chooses between them depending on the predecessor
+ * the block was entered from:
+ *
+ *   ASSIGN $0 x                      (x0 is $0)
+ *   L0:                            L0: tmp1 = phi($0, tmp2)
+ *     COMPARE x $10                  COMPARE tmp1 $10
+ *     JUMP_GTE L1            =>      JUMP_GTE L1
+ *     x = x + $1                     tmp2 = tmp1 + $1
+ *     JUMP L0                        JUMP L0
+ *   L1:                            L1:
+ *     RETURN x                       RETURN tmp1
+ *
+ * The construction is the one of Cytron et al.:
+ *  - the dominator tree (cfg_dominators) and the dominance frontiers: the
+ *    frontier of a block is where its dominance stops, the first blocks
+ *    also reached by other paths
+ *  - a variable written in a block needs a phi in its frontier, the phi
+ *    being a write too (the iterated frontier). The phis are only placed
+ *    where the variable is alive, the other ones would be unused
+ *  - the renaming walks the dominator tree: the current tmp of each
+ *    variable replaces it in the instructions, each write pushes a new one
+ *    and the phis of the successors get the current tmp as argument
+ * A copy ASSIGN src x does not need a new tmp: src is the value of x, the
+ * copy is removed.
+ * The value of a variable before its first write is its slot: the
+ * arguments are read from their slot, as before. Nothing writes the slots
+ * any more, a slot can replace a variable anywhere.
+ *
+ * ssa_destroy goes back to instructions: a phi is a copy to its tmp at the
+ * end of each predecessor. Its tmp is then written more than once, like a
+ * variable, see regalloc.c.
+ */
+
+static
+void ssa_add_frontier (ssa_t *ssa, size_t block, size_t member)
+{
+  size_t count = ssa->frontier_count[block];
+  if (count > 0 && ssa->frontier[block][count - 1] == member)
+    return;
+  /* the capacity is the next power of 2 */
+  if ((count & (count - 1)) == 0)
+    ssa->frontier[block] = realloc(ssa->frontier[block], (count ? count * 2 : 1) * sizeof(size_t));
+  ssa->frontier[block][ssa->frontier_count[block]++] = member;
+}
+
+/**
+ * Dominance frontiers, as computed by Cooper, Harvey and Kennedy: a join
+ * block is in the frontier of its predecessors and of their dominators,
+ * up to its own immediate dominator
+ */
+static
+void ssa_frontiers (ssa_t *ssa)
+{
+  cfg_t *cfg = ssa->cfg;
+  ssa->frontier = calloc(cfg->count + 1, sizeof(size_t *));
+  ssa->frontier_count = calloc(cfg->count + 1, sizeof(size_t));
+  for (size_t b = 0; b < cfg->count; b++) {
+    cfg_block_t *block = &cfg->blocks[b];
+    if (block->pred_count < 2 || cfg->idom[b] == CFG_NO_BLOCK)
+      continue;
+    for (size_t p = 0; p < block->pred_count; p++) {
+      size_t runner = block->preds[p];
+      if (cfg->idom[runner] == CFG_NO_BLOCK)
+        continue;
+      while (runner != cfg->idom[b]) {
+        ssa_add_frontier(ssa, runner, b);
+        runner = cfg->idom[runner];
+      }
+    }
+  }
+}
+
+static
+bool ssa_is_variable (tac_function_t *fn, tac_operand_t *operand)
+{
+  return operand->kind == TAC_OPND_LOCAL && (size_t)operand->value < fn->local_count;
+}
+
+/**
+ * The variables alive at the start of each block, live_in[b * local_count
+ * + slot]: read in the block before being written, or alive at the start of
+ * a successor and not written in the block
+ */
+static
+bool *ssa_live_in (ssa_t *ssa)
+{
+  tac_function_t *fn = ssa->fn;
+  cfg_t *cfg = ssa->cfg;
+  size_t vars = fn->local_count;
+  bool *live_in = calloc(cfg->count * vars + 1, sizeof(bool));
+  bool *written = calloc(cfg->count * vars + 1, sizeof(bool));
+  for (size_t b = 0; b < cfg->count; b++) {
+    bool *in = &live_in[b * vars], *def = &written[b * vars];
+    for (size_t i = cfg->blocks[b].first; i < cfg->blocks[b].end; i++) {
+      tac_instr_t *instr = &fn->instrs[i];
+      if (ssa_is_variable(fn, &instr->src1) && !def[instr->src1.value])
+        in[instr->src1.value] = true;
+      if (ssa_is_variable(fn, &instr->src2) && !def[instr->src2.value])
+        in[instr->src2.value] = true;
+      if (ssa_is_variable(fn, &instr->dst))
+        def[instr->dst.value] = true;
+    }
+  }
+
+  /* backwards, in reverse of the reverse postorder, until nothing changes */
+  size_t *order = malloc((cfg->count + 1) * sizeof(size_t));
+  size_t order_count = 0;
+  for (size_t b = 0; b < cfg->count; b++)
+    if (cfg->rpo_number[b] != CFG_NO_BLOCK)
+      order[cfg->rpo_number[b]] = b, order_count++;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = order_count; i-- > 0;) {
+      size_t b = order[i];
+      cfg_block_t *block = &cfg->blocks[b];
+      for (size_t s = 0; s < block->succ_count; s++) {
+        bool *succ_in = &live_in[block->succs[s] * vars];
+        for (size_t v = 0; v < vars; v++) {
+          if (succ_in[v] && !written[b * vars + v] && !live_in[b * vars + v]) {
+            live_in[b * vars + v] = true;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+  free(order);
+  free(written);
+  return live_in;
+}
+
+/**
+ * Places the phis: each block writing a variable, and the entry which
+ * gives it its initial value, needs a phi in its frontier when the
+ * variable is alive there
+ */
+static
+void ssa_place_phis (ssa_t *ssa)
+{
+  tac_function_t *fn = ssa->fn;
+  cfg_t *cfg = ssa->cfg;
+  size_t vars = fn->local_count;
+  bool *live_in = ssa_live_in(ssa);
+  /* has_phi and in_work hold the last variable (+1) which set them */
+  size_t *has_phi = calloc(cfg->count + 1, sizeof(size_t));
+  size_t *in_work = calloc(cfg->count + 1, sizeof(size_t));
+  size_t *work = malloc((cfg->count + 1) * sizeof(size_t));
+  size_t **def_blocks = calloc(vars + 1, sizeof(size_t *));
+  size_t *def_count = calloc(vars + 1, sizeof(size_t));
+  for (size_t b = 0; b < cfg->count; b++) {
+    for (size_t i = cfg->blocks[b].first; i < cfg->blocks[b].end; i++) {
+      tac_operand_t *dst = &fn->instrs[i].dst;
+      if (!ssa_is_variable(fn, dst))
+        continue;
+      size_t *count = &def_count[dst->value];
+      if (*count > 0 && def_blocks[dst->value][*count - 1] == b)
+        continue;
+      if ((*count & (*count - 1)) == 0)
+        def_blocks[dst->value] = realloc(def_blocks[dst->value], (*count ? *count * 2 : 1) * sizeof(size_t));
+      def_blocks[dst->value][(*count)++] = b;
+    }
+  }
+
+  for (size_t v = 0; v < vars; v++) {
+    if (def_count[v] == 0)
+      continue;
+    size_t top = 0;
+    work[top++] = 0;
+    in_work[0] = v + 1;
+    for (size_t d = 0; d < def_count[v]; d++) {
+      if (in_work[def_blocks[v][d]] != v + 1) {
+        in_work[def_blocks[v][d]] = v + 1;
+        work[top++] = def_blocks[v][d];
+      }
+    }
+    while (top > 0) {
+      size_t b = work[--top];
+      for (size_t f = 0; f < ssa->frontier_count[b]; f++) {
+        size_t join = ssa->frontier[b][f];
+        if (has_phi[join] == v + 1 || !live_in[join * vars + v])
+          continue;
+        has_phi[join] = v + 1;
+        ssa_phi_t *phi = malloc(sizeof(ssa_phi_t));
+        phi->slot = v;
+        phi->dst = tac_none();
+        phi->args = malloc((cfg->blocks[join].pred_count + 1) * sizeof(tac_operand_t));
+        for (size_t p = 0; p < cfg->blocks[join].pred_count; p++)
+          phi->args[p] = tac_local(v);
+        phi->next = ssa->phis[join];
+        ssa->phis[join] = phi;
+        if (in_work[join] != v + 1) {
+          in_work[join] = v + 1;
+          work[top++] = join;
+        }
+      }
+    }
+  }
+
+  for (size_t v = 0; v < vars; v++)
+    free(def_blocks[v]);
+  free(def_blocks);
+  free(def_count);
+  free(work);
+  free(in_work);
+  free(has_phi);
+  free(live_in);
+}
+
+/**
+ * The current value of each variable is names[slot], the previous ones
+ * are saved in a log to restore them when the renaming leaves a block
+ */
+typedef struct ssa_names_t {
+  tac_operand_t *names;
+  struct { long slot; tac_operand_t previous; } *log;
+  size_t log_count;
+  size_t log_capacity;
+} ssa_names_t;
+
+static
+void ssa_push_name (ssa_names_t *names, long slot, tac_operand_t name)
+{
+  if (names->log_count == names->log_capacity) {
+    names->log_capacity = names->log_capacity ? names->log_capacity * 2 : 64;
+    names->log = realloc(names->log, names->log_capacity * sizeof(*names->log));
+  }
+  names->log[names->log_count].slot = slot;
+  names->log[names->log_count++].previous = names->names[slot];
+  names->names[slot] = name;
+}
+
+static
+void ssa_rename_block (ssa_t *ssa, size_t b, ssa_names_t *names)
+{
+  tac_function_t *fn = ssa->fn;
+  cfg_t *cfg = ssa->cfg;
+  for (ssa_phi_t *phi = ssa->phis[b]; phi; phi = phi->next) {
+    phi->dst = tac_new_tmp(fn);
+    ssa_push_name(names, phi->slot, phi->dst);
+  }
+
+  for (size_t i = cfg->blocks[b].first; i < cfg->blocks[b].end; i++) {
+    tac_instr_t *instr = &fn->instrs[i];
+    if (ssa_is_variable(fn, &instr->src1))
+      instr->src1 = names->names[instr->src1.value];
+    if (ssa_is_variable(fn, &instr->src2))
+      instr->src2 = names->names[instr->src2.value];
+    if (!ssa_is_variable(fn, &instr->dst))
+      continue;
+    long slot = instr->dst.value;
+    if (instr->op == TAC_ASSIGN) {
+      ssa_push_name(names, slot, instr->src1);
+      ssa->removed[i] = true;
+      continue;
+    }
+    instr->dst = tac_new_tmp(fn);
+    ssa_push_name(names, slot, instr->dst);
+  }
+
+  cfg_block_t *block = &cfg->blocks[b];
+  for (size_t s = 0; s < block->succ_count; s++) {
+    cfg_block_t *succ = &cfg->blocks[block->succs[s]];
+    size_t k = 0;
+    while (succ->preds[k] != b)
+      k++;
+    for (ssa_phi_t *phi = ssa->phis[block->succs[s]]; phi; phi = phi->next)
+      phi->args[k] = names->names[phi->slot];
+  }
+}
+
+/**
+ * Renames the variables in a preorder walk of the dominator tree, with an
+ * explicit stack: a block is pushed twice, the second time (~b) to restore
+ * the names once its subtree is done
+ */
+static
+void ssa_rename (ssa_t *ssa)
+{
+  tac_function_t *fn = ssa->fn;
+  cfg_t *cfg = ssa->cfg;
+  ssa_names_t names = { .names = malloc((fn->local_count + 1) * sizeof(tac_operand_t)) };
+  for (size_t v = 0; v < fn->local_count; v++)
+    names.names[v] = tac_local(v);
+
+  size_t *marks = malloc((cfg->count + 1) * sizeof(size_t));
+  size_t *stack = malloc((2 * cfg->count + 1) * sizeof(size_t));
+  size_t top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    size_t entry = stack[--top];
+    if (entry > cfg->count) {
+      size_t b = ~entry;
+      while (names.log_count > marks[b]) {
+        names.log_count--;
+        names.names[names.log[names.log_count].slot] = names.log[names.log_count].previous;
+      }
+      continue;
+    }
+    marks[entry] = names.log_count;
+    ssa_rename_block(ssa, entry, &names);
+    stack[top++] = ~entry;
+    for (size_t c = cfg->dom_child_count[entry]; c-- > 0;)
+      stack[top++] = cfg->dom_children[entry][c];
+  }
+  free(stack);
+  free(marks);
+  free(names.log);
+  free(names.names);
+}
+
+/**
+ * Converts a function to SSA form, the function must not have unreachable
+ * blocks (see cfg_remove_unreachable).
+ * The entry block gives the variables their initial value, it can't be
+ * jumped to: a function starting with a label (a loop) gets a new label
+ * before it, a block of its own which cfg_thread_jumps removes afterwards
+ */
+ssa_t *ssa_build (tac_function_t *fn)
+{
+  if (fn->count > 0 && fn->instrs[0].op == TAC_LABEL) {
+    fn->instrs = realloc(fn->instrs, (fn->count + 1) * sizeof(tac_instr_t));
+    memmove(&fn->instrs[1], fn->instrs, fn->count * sizeof(tac_instr_t));
+    fn->instrs[0] = (tac_instr_t){ .op = TAC_LABEL, .dst = tac_label(tac_new_label()) };
+    fn->count++;
+    fn->capacity = fn->count;
+  }
+  ssa_t *ssa = calloc(1, sizeof(ssa_t));
+  ssa->fn = fn;
+  ssa->cfg = cfg_build(fn);
+  ssa->phis = calloc(ssa->cfg->count + 1, sizeof(ssa_phi_t *));
+  ssa->removed = calloc(fn->count + 1, sizeof(bool));
+  if (ssa->cfg->count == 0)
+    return ssa;
+
+  cfg_dominators(ssa->cfg);
+  ssa_frontiers(ssa);
+  ssa_place_phis(ssa);
+  ssa_rename(ssa);
+  return ssa;
+}
+
+/**
+ * Instructions to insert before each instruction of the function, see
+ * ssa_destroy
+ */
+typedef struct ssa_inserts_t {
+  tac_instr_t **instrs;
+  size_t *count;
+  size_t *capacity;
+} ssa_inserts_t;
+
+static
+void ssa_insert (ssa_inserts_t *inserts, size_t pos, tac_instr_t instr)
+{
+  if (inserts->count[pos] == inserts->capacity[pos]) {
+    inserts->capacity[pos] = inserts->capacity[pos] ? inserts->capacity[pos] * 2 : 4;
+    inserts->instrs[pos] = realloc(inserts->instrs[pos], inserts->capacity[pos] * sizeof(tac_instr_t));
+  }
+  inserts->instrs[pos][inserts->count[pos]++] = instr;
+}
+
+/**
+ * The phis of a block entered from its predecessor k are copies which all
+ * happen at once: dst1 = arg1, dst2 = arg2 where arg2 can be dst1 (the
+ * phis of a loop swapping two variables). A copy whose dst is not read by
+ * the other ones goes first; when they all are (a cycle), one of the dst is
+ * saved in a new tmp first
+ */
+static
+void ssa_copies (tac_function_t *fn, ssa_phi_t *phis, size_t k,
+    ssa_inserts_t *inserts, size_t pos)
+{
+  size_t count = 0;
+  for (ssa_phi_t *phi = phis; phi; phi = phi->next)
+    count++;
+  tac_operand_t *dsts = malloc((count + 1) * sizeof(tac_operand_t));
+  tac_operand_t *srcs = malloc((count + 1) * sizeof(tac_operand_t));
+  size_t pending = 0;
+  for (ssa_phi_t *phi = phis; phi; phi = phi->next) {
+    if (tac_operand_equals(&phi->dst, &phi->args[k]))
+      continue;
+    dsts[pending] = phi->dst;
+    srcs[pending++] = phi->args[k];
+  }
+
+  while (pending > 0) {
+    size_t ready = pending;
+    for (size_t c = 0; c < pending && ready == pending; c++) {
+      bool read = false;
+      for (size_t o = 0; o < pending && !read; o++)
+        read = o != c && tac_operand_equals(&srcs[o], &dsts[c]);
+      if (!read)
+        ready = c;
+    }
+    if (ready == pending) {
+      tac_operand_t saved = tac_new_tmp(fn);
+      ssa_insert(inserts, pos, (tac_instr_t){ .op = TAC_ASSIGN, .dst = saved, .src1 = dsts[0] });
+      for (size_t o = 0; o < pending; o++)
+        if (tac_operand_equals(&srcs[o], &dsts[0]))
+          srcs[o] = saved;
+      continue;
+    }
+    ssa_insert(inserts, pos, (tac_instr_t){ .op = TAC_ASSIGN, .dst = dsts[ready], .src1 = srcs[ready] });
+    pending--;
+    dsts[ready] = dsts[pending];
+    srcs[ready] = srcs[pending];
+  }
+  free(srcs);
+  free(dsts);
+}
+
+/**
+ * Leaves the SSA form: the phis become copies at the end of the
+ * predecessors, before their jump. A predecessor ending with a conditional
+ * jump to the block would run the copies on both of its edges, the edge is
+ * split:
+ *     JUMP_LT L1     =>    JUMP_GTE L9; copies; JUMP L1; L9:
+ * The copies folded by the renaming are removed, and the SSA form is
+ * released
+ */
+void ssa_destroy (ssa_t *ssa)
+{
+  tac_function_t *fn = ssa->fn;
+  cfg_t *cfg = ssa->cfg;
+  ssa_inserts_t inserts = {
+    .instrs = calloc(fn->count + 1, sizeof(tac_instr_t *)),
+    .count = calloc(fn->count + 1, sizeof(size_t)),
+    .capacity = calloc(fn->count + 1, sizeof(size_t))
+  };
+
+  for (size_t p = 0; p < cfg->count; p++) {
+    cfg_block_t *pred = &cfg->blocks[p];
+    tac_instr_t *last = &fn->instrs[pred->end - 1];
+    /* the jump target comes after the next block, it is handled first so
+     * that its copies come before the ones of the next block */
+    for (size_t s = pred->succ_count; s-- > 0;) {
+      size_t b = pred->succs[s];
+      if (!ssa->phis[b])
+        continue;
+      size_t k = 0;
+      while (cfg->blocks[b].preds[k] != p)
+        k++;
+
+      if (last->op == TAC_JUMP)
+        ssa_copies(fn, ssa->phis[b], k, &inserts, pred->end - 1);
+      else if (!TAC_IS_COND_JUMP(last->op))
+        ssa_copies(fn, ssa->phis[b], k, &inserts, pred->end);
+      else if (cfg_label_block(cfg, last->dst.value) != b)
+        ssa_copies(fn, ssa->phis[b], k, &inserts, pred->end);
+      else if (pred->succ_count == 1) {
+        /* both edges go to the next block, the jump goes to the copies */
+        long label = tac_new_label();
+        last->dst = tac_label(label);
+        ssa_insert(&inserts, pred->end, (tac_instr_t){ .op = TAC_LABEL, .dst = tac_label(label) });
+        ssa_copies(fn, ssa->phis[b], k, &inserts, pred->end);
+      }
+      else {
+        long label = tac_new_label();
+        tac_operand_t target = last->dst;
+        last->op = tac_inv_jump(last->op);
+        last->dst = tac_label(label);
+        ssa_copies(fn, ssa->phis[b], k, &inserts, pred->end);
+        ssa_insert(&inserts, pred->end, (tac_instr_t){ .op = TAC_JUMP, .dst = target });
+        ssa_insert(&inserts, pred->end, (tac_instr_t){ .op = TAC_LABEL, .dst = tac_label(label) });
+      }
+    }
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i <= fn->count; i++)
+    count += inserts.count[i] + (i < fn->count && !ssa->removed[i]);
+  tac_instr_t *instrs = malloc((count + 1) * sizeof(tac_instr_t));
+  size_t n = 0;
+  for (size_t i = 0; i <= fn->count; i++) {
+    for (size_t j = 0; j < inserts.count[i]; j++)
+      instrs[n++] = inserts.instrs[i][j];
+    if (i < fn->count && !ssa->removed[i])
+      instrs[n++] = fn->instrs[i];
+    free(inserts.instrs[i]);
+  }
+  free(fn->instrs);
+  fn->instrs = instrs;
+  fn->count = count;
+  fn->capacity = count + 1;
+  free(inserts.instrs);
+  free(inserts.count);
+  free(inserts.capacity);
+
+  for (size_t b = 0; b < cfg->count; b++) {
+    while (ssa->phis[b]) {
+      ssa_phi_t *next = ssa->phis[b]->next;
+      free(ssa->phis[b]->args);
+      free(ssa->phis[b]);
+      ssa->phis[b] = next;
+    }
+    if (ssa->frontier)
+      free(ssa->frontier[b]);
+  }
+  free(ssa->frontier);
+  free(ssa->frontier_count);
+  free(ssa->phis);
+  free(ssa->removed);
+  cfg_release(cfg);
+  free(ssa);
+}
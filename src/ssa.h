@@ -0,0 +1,37 @@
+#ifndef SSA_H
+#define SSA_H
+#include <stdbool.h>
+#include "tac.h"
+#include "cfg.h"
+
+/**
+ * A phi of a block: dst is the value of the variable slot when the block
+ * is entered from its predecessor k, args[k], as ordered in block->preds
+ */
+typedef struct ssa_phi_t {
+  long slot;
+  tac_operand_t dst; // tmp
+  tac_operand_t *args;
+  struct ssa_phi_t *next;
+} ssa_phi_t;
+
+/**
+ * A function in SSA form: its variables are replaced by tmps, each one
+ * written by one instruction or one phi. The phis are kept apart from the
+ * instructions, in the blocks of cfg.
+ * The copies folded by the renaming stay in fn->instrs until ssa_destroy,
+ * marked in removed
+ */
+typedef struct ssa_t {
+  tac_function_t *fn;
+  cfg_t *cfg;
+  ssa_phi_t **phis; // list of each block
+  size_t **frontier; // dominance frontier of each block
+  size_t *frontier_count;
+  bool *removed;
+} ssa_t;
+
+ssa_t *ssa_build (tac_function_t *fn);
+void ssa_destroy (ssa_t *ssa);
+
+#endif /* ifndef SSA_H */
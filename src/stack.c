@@ -4,10 +4,11 @@
 #include <assert.h>
 #include <stdbool.h>
 #include "stack.h"
+#include "arena.h"
 
 stack_item_t *stack_new_item (void *data)
 {
-  stack_item_t *item = malloc(sizeof(stack_item_t)); 
+  stack_item_t *item = arena_malloc(sizeof(stack_item_t));
   item->data = data;
   item->next = NULL;
   return item;
@@ -37,7 +38,7 @@ void *stack_pop (mystack_t *stack)
   stack_item_t *item = *stack;
   *stack = (*stack)->next;
   void *data = item->data;
-  free(item);
+  arena_dispose(item, sizeof(stack_item_t));
   return data;
 }
 
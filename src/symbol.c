@@ -1,14 +1,94 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 #include "symbol.h"
 #include "ast.h"
 #include "utils.h"
+#include "arena.h"
+
+#define SYM_TABLE_INITIAL_CAPACITY 16
 
 int next_id = 0;
 
-symbol_t *sym_new_function (char *name, int type, ast_t *attributes, symbol_t *table)
+/* marks a slot whose symbol was removed, so that probing continues */
+static symbol_t sym_removed;
+
+/**
+ * names are interned, so the hash only depends on the pointer value
+ */
+static
+size_t sym_hash (char *name)
+{
+  uint64_t hash = (uintptr_t)name;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+sym_table_t *sym_table_new (sym_table_t *parent)
+{
+  sym_table_t *table = malloc(sizeof(sym_table_t));
+  table->capacity = SYM_TABLE_INITIAL_CAPACITY;
+  table->slots = calloc(table->capacity, sizeof(symbol_t *));
+  table->count = 0;
+  table->used = 0;
+  table->first = NULL;
+  table->last = NULL;
+  table->parent = parent;
+  return table;
+}
+
+void sym_table_delete (sym_table_t *table)
+{
+  if (!table) return;
+  free(table->slots);
+  free(table);
+}
+
+/**
+ * returns the slot of name, or the empty slot where it should be inserted
+ */
+static
+symbol_t **sym_slot (sym_table_t *table, char *name)
+{
+  size_t mask = table->capacity - 1;
+  size_t i = sym_hash(name) & mask;
+  symbol_t **removed = NULL;
+
+  while (table->slots[i]) {
+    if (table->slots[i] == &sym_removed) {
+      if (!removed) removed = &table->slots[i];
+    }
+    else if (table->slots[i]->name == name)
+      return &table->slots[i];
+    i = (i + 1) & mask;
+  }
+  return removed ? removed : &table->slots[i];
+}
+
+/**
+ * doubles the capacity, the removed slots are dropped
+ */
+static
+void sym_grow (sym_table_t *table)
+{
+  size_t capacity = table->capacity;
+  while (table->count * 2 >= capacity)
+    capacity *= 2;
+
+  free(table->slots);
+  table->capacity = capacity;
+  table->slots = calloc(capacity, sizeof(symbol_t *));
+  table->used = table->count;
+
+  for (symbol_t *curr = table->first; curr; curr = curr->next)
+    *sym_slot(table, curr->name) = curr;
+}
+
+symbol_t *sym_new_function (char *name, int type, ast_t *attributes, sym_table_t *table)
 {
   symbol_t *sym = sym_new(name, type, attributes);
   sym->function_table = table;
@@ -17,9 +97,9 @@ symbol_t *sym_new_function (char *name, int type, ast_t *attributes, symbol_t *t
 
 symbol_t *sym_new (char *name, int type, ast_t *attributes)
 {
-  symbol_t *sym = malloc(sizeof(symbol_t));
+  symbol_t *sym = arena_malloc(sizeof(symbol_t));
 
-  sym->name = copy_name(name);
+  sym->name = name;
   sym->type = type;
   sym->rel_pos = 0;
   sym->function_table = NULL;
@@ -28,25 +108,32 @@ symbol_t *sym_new (char *name, int type, ast_t *attributes)
   return sym;
 }
 
+/**
+ * the attributes belong to the ast, they are released with the arena
+ */
 void sym_delete (symbol_t * sym)
 {
-  if (!sym) return;
-  free(sym->name);
-  if (sym->attributes) // FIXME probably not the way to go
-    free(sym->attributes);
-  free(sym);
+  arena_dispose(sym, sizeof(symbol_t));
 }
 
-void sym_remove (symbol_t **table, symbol_t *sym)
+void sym_remove (sym_table_t **table, symbol_t *sym)
 {
   assert(sym);
   assert(table);
-  symbol_t *curr = *table;
+  if (!*table) return;
+
+  symbol_t **slot = sym_slot(*table, sym->name);
+  if (*slot != sym) return;
+  *slot = &sym_removed;
+  (*table)->count--;
+
+  symbol_t *curr = (*table)->first;
   symbol_t *prec = NULL;
   while (curr) {
     if (sym == curr) {
-      if (!prec) *table = curr->next;
+      if (!prec) (*table)->first = curr->next;
       else prec->next = curr->next;
+      if ((*table)->last == curr) (*table)->last = prec;
       sym_delete(curr);
       break;
     }
@@ -55,29 +142,61 @@ void sym_remove (symbol_t **table, symbol_t *sym)
   }
 }
 
-void sym_add (symbol_t **table, symbol_t *sym)
+/**
+ * adds a symbol at the end of the table, the table is created if needed
+ */
+void sym_add (sym_table_t **table, symbol_t *sym)
 {
   assert(sym);
   assert(table);
-  if (!*table) {
-    *table = sym;
-    return;
-  }
-  symbol_t *curr = *table;
+  if (!*table)
+    *table = sym_table_new(NULL);
+
+  sym_table_t *tbl = *table;
+  /* keep the load factor (including removed slots) under 1/2 */
+  if ((tbl->used + 1) * 2 > tbl->capacity)
+    sym_grow(tbl);
+
+  symbol_t **slot = sym_slot(tbl, sym->name);
+  assert(*slot == NULL || *slot == &sym_removed);
+  if (*slot == NULL)
+    tbl->used++;
+  *slot = sym;
+  tbl->count++;
+
+  sym->next = NULL;
+  if (!tbl->first)
+    tbl->first = sym;
+  else
+    tbl->last->next = sym;
+  tbl->last = sym;
+}
 
-  while (curr->next) curr = curr->next;
-  curr->next = sym;
+symbol_t * sym_first (sym_table_t *table)
+{
+  return table ? table->first : NULL;
 }
 
-symbol_t * sym_search (symbol_t *table, char *name)
+/**
+ * name has to be interned, symbols are compared by identity
+ * only the given table is searched
+ */
+symbol_t * sym_search (sym_table_t *table, char *name)
 {
-  while (table) {
-    if (strcmp(table->name, name) == STREQUAL) {
-      return table;
-    }
-    table = table->next;
-  }
-  return NULL;
+  if (!table) return NULL;
+  symbol_t *sym = *sym_slot(table, name);
+  return sym == &sym_removed ? NULL : sym;
+}
+
+/**
+ * searches the table, then its parent scopes
+ */
+symbol_t * sym_lookup (sym_table_t *table, char *name)
+{
+  symbol_t *sym = NULL;
+  while (table && !(sym = sym_search(table, name)))
+    table = table->parent;
+  return sym;
 }
 
 char * sym_get_symbol_type (sym_type_t type)
@@ -90,14 +209,13 @@ char * sym_get_symbol_type (sym_type_t type)
   }
 }
 
-void sym_print_list (symbol_t *table)
+void sym_print_list (sym_table_t *table)
 {
-  while (table) {
+  for (symbol_t *curr = sym_first(table); curr; curr = curr->next) {
     printf("  %s '" COLOR_GREEN "%s" COLOR_DEFAULT "' : "
         COLOR_BLUE "%s" COLOR_DEFAULT "\n",
-        sym_get_symbol_type(table->type),
-        table->name,
-        ast_get_var_type(table->attributes));
-    table = table->next;
+        sym_get_symbol_type(curr->type),
+        curr->name,
+        ast_get_var_type(curr->attributes));
   }
 }
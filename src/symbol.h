@@ -14,20 +14,41 @@ typedef enum {
 #define SYM_ISFUN(symbol) ((symbol)->type == SYM_FUNCTION)
 
 typedef struct symbol_t {
-  char *name;
+  char *name; // interned
   sym_type_t type; // symbol type
   ast_t *attributes;
   size_t rel_pos;
-  struct symbol_t *function_table;
-  struct symbol_t *next;
+  struct sym_table_t *function_table;
+  struct symbol_t *next; // next symbol in declaration order
 } symbol_t;
 
-symbol_t *sym_new_function (char *name, int type, ast_t *attributes, symbol_t *table);
+/**
+ * A symbol table is an open addressing hash table, indexed by the
+ * interned name pointer.
+ * Symbols are also linked in declaration order (first -> next -> ... -> last),
+ * which is the order used to lay out the stack of a function.
+ * A table can have a parent scope (the global table for a function table)
+ */
+typedef struct sym_table_t {
+  symbol_t **slots;
+  size_t capacity;
+  size_t count;
+  size_t used; // count + removed slots
+  symbol_t *first;
+  symbol_t *last;
+  struct sym_table_t *parent;
+} sym_table_t;
+
+sym_table_t *sym_table_new (sym_table_t *parent);
+void sym_table_delete (sym_table_t *table);
+symbol_t *sym_new_function (char *name, int type, ast_t *attributes, sym_table_t *table);
 symbol_t * sym_new (char *name, int type, ast_t *attributes);
 void sym_delete (symbol_t * sym);
-void sym_remove (symbol_t **table, symbol_t *sym);
-void sym_add (symbol_t **table, symbol_t *sym);
-void sym_print_list (symbol_t *table);
-symbol_t * sym_search (symbol_t *table, char *name);
+void sym_remove (sym_table_t **table, symbol_t *sym);
+void sym_add (sym_table_t **table, symbol_t *sym);
+void sym_print_list (sym_table_t *table);
+symbol_t * sym_first (sym_table_t *table);
+symbol_t * sym_search (sym_table_t *table, char *name);
+symbol_t * sym_lookup (sym_table_t *table, char *name);
 
 #endif /* ifndef SYMBOL_H */
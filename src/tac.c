@@ -3,24 +3,28 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
-#include <math.h> /* used for log10() */
+#include <limits.h>
 #include "symbol.h"
-#include "buffer.h"
-#include "lexer.h"
-#include "parser.h"
 #include "ast.h"
 #include "utils.h"
-#include "queue.h"
 #include "tac.h"
+#include "intern.h"
+#include "arena.h"
+#include "regalloc.h"
+#include "optimize.h"
 
 /**
  * The Tree Address Code is an assembly-like language, with simpler primitives
- * Types of parameters:
- *  - local variable, with a user-defined name
- *  - argument, with a user-defined name
+ * Types of parameters (tac_operand_t):
+ *  - local variable, with a user-defined name, numbered by its slot
+ *  - argument, with a user-defined name, numbered by its slot too
  *  - immediate value, known at compile-time (like 1, 2, etc.)
  *  - temporary variable, like tmp0, tmp1, etc. Likely to be stored in a CPU register
+ *  - label, like L0, L1, etc.
  *
+ * Each function is an array of instructions (tac_function_t) which is
+ * directly read by the assembly generator, the text form below is only
+ * printed with --emit=tac.
  * The instruction set is:
  * <LABEL>:             # defines a label which can be referenced to jump to
  * JUMP <LABEL>         # unconditional jump
@@ -30,236 +34,508 @@
  * JUMP_GTE <LABEL>     # jump if greater than or equal
  * JUMP_NEQ <LABEL>     # jump if not equal
  * JUMP_EQ <LABEL>      # jump if equal
- * CALL <FUNCTION>      # call a function
  * PARAM <VAR>          # load a function parameter
+ * CALL <FUNCTION> <TMP/VARIABLE> # call a function, its result is stored in TMP
+ * RETURN [<VAR>]       # leaves the function
+ * ADD_STACK <SIZE>     # size of the stack frame of the function
  * LOAD_ARG <RELATIVE_POSITION> <VAR_NAME>   # load a positional argument
  * DECL_LOCAL <RELATIVE_POSITION> <VAR_NAME> # declare a local variable
- * COMPARE <TMP/DIRECT> <TMP/VARIABLE>       # compare two values
+ * COMPARE <TMP/VARIABLE> <TMP/DIRECT/VARIABLE> # compare two values
  * ASSIGN <TMP/DIRECT> <VARIABLE>            # assign a value to a local or argument
- * <TMP> = <OP1> <OPERATOR> <OP2>            # execute a binary operation
+ * <TMP/VARIABLE> = <OP1> <OPERATOR> <OP2>   # execute a binary operation
  * <TMP> = <OP1>                             # assign a value to a tmp var
+ * CMOV_<CMP> <TMP/DIRECT/VARIABLE> <TMP/VARIABLE> # assign if the last
+ *                                           # COMPARE gave <CMP>, see ifconv.c
+ *
+ * ADD_STACK, LOAD_ARG and DECL_LOCAL are not instructions of the array,
+ * they are printed from the slots of the function.
+ * A JUMP_<CMP> jumps if the first operand of the last COMPARE is <CMP> the
+ * second one: COMPARE a $1; JUMP_LT L0 jumps to L0 if a < 1
  */
 
-extern symbol_t *global_table;
+
+#define TAC_INITIAL_CAPACITY 64
+#define TAC_NO_LABEL -1
+
+void tac_condition (ast_t *ast, sym_table_t *table, tac_function_t *fn,
+    long iftrue, long iffalse, ast_binary_e parent_cond);
+void tac_statement (ast_t *ast, sym_table_t *table, tac_function_t *fn);
+tac_operand_t tac_expression (ast_t *ast, sym_table_t *table, tac_function_t *fn);
+
+extern sym_table_t *global_table;
 unsigned long label_number;
-unsigned long tmp_number;
-myqueue_t available_tmps = NULL;
+/* the tac_function_t is allocated with the body of the current function */
+arena_t *function_arena = NULL;
+
+/**
+ * Tail recursion of the current function, see tac_return
+ */
+typedef struct tac_tail_t {
+  long entry; // label at the start of the body, TAC_NO_LABEL without tail recursion
+  ast_binary_e op; // operator of the accumulator, AST_BIN_INVALID_OP without it
+  tac_operand_t accumulator;
+} tac_tail_t;
+
+static tac_tail_t tail;
+
+static const char *tac_opcode_names[TAC_OPCODE_COUNT] = {
+  [TAC_LABEL] = "LABEL",
+  [TAC_JUMP] = "JUMP",
+  [TAC_JUMP_LT] = "JUMP_LT",
+  [TAC_JUMP_LTE] = "JUMP_LTE",
+  [TAC_JUMP_GT] = "JUMP_GT",
+  [TAC_JUMP_GTE] = "JUMP_GTE",
+  [TAC_JUMP_NEQ] = "JUMP_NEQ",
+  [TAC_JUMP_EQ] = "JUMP_EQ",
+  [TAC_COMPARE] = "COMPARE",
+  [TAC_ASSIGN] = "ASSIGN",
+  [TAC_ADD] = "+",
+  [TAC_SUB] = "-",
+  [TAC_MUL] = "*",
+  [TAC_DIV] = "/",
+  [TAC_PARAM] = "PARAM",
+  [TAC_CALL] = "CALL",
+  [TAC_RETURN] = "RETURN",
+  [TAC_CMOV_LT] = "CMOV_LT",
+  [TAC_CMOV_LTE] = "CMOV_LTE",
+  [TAC_CMOV_GT] = "CMOV_GT",
+  [TAC_CMOV_GTE] = "CMOV_GTE",
+  [TAC_CMOV_NEQ] = "CMOV_NEQ",
+  [TAC_CMOV_EQ] = "CMOV_EQ"
+};
+
+const char *tac_opcode_name (tac_opcode_e op)
+{
+  assert(op < TAC_OPCODE_COUNT);
+  return tac_opcode_names[op];
+}
 
 /**
- * Calculates the string bytes necessary to represent an integer
+ * these functions are only convenience functions to build the operands
  */
-size_t integer_size (unsigned long integer_size)
+tac_operand_t tac_none ()
+{ return (tac_operand_t){ .kind = TAC_OPND_NONE }; }
+
+tac_operand_t tac_imm (long value)
+{ return (tac_operand_t){ .kind = TAC_OPND_IMM, .value = value }; }
+
+tac_operand_t tac_local (long slot)
+{ return (tac_operand_t){ .kind = TAC_OPND_LOCAL, .value = slot }; }
+
+tac_operand_t tac_tmp (long tmp)
+{ return (tac_operand_t){ .kind = TAC_OPND_TMP, .value = tmp }; }
+
+tac_operand_t tac_label (long label)
+{ return (tac_operand_t){ .kind = TAC_OPND_LABEL, .value = label }; }
+
+bool tac_operand_equals (tac_operand_t *a, tac_operand_t *b)
 {
-  return integer_size == 0 ? 1 : log10(integer_size) + 1;
+  if (a->kind != b->kind)
+    return false;
+  if (a->kind == TAC_OPND_FUNCTION)
+    return a->name == b->name;
+  return a->kind == TAC_OPND_NONE || a->value == b->value;
 }
 
 /**
- * prints a JUMP_* instruction to outfile
+ * Appends an instruction to the function, the array grows as needed
  */
-void tac_instr_jump (FILE *outfile, ast_binary_e comp, char *iffalse)
+tac_instr_t *tac_emit (tac_function_t *fn, tac_opcode_e op,
+    tac_operand_t dst, tac_operand_t src1, tac_operand_t src2)
 {
-  fprintf(outfile, "\tJUMP_%s %s\n", ast_cmp_to_string(comp), iffalse);
+  if (fn->count == fn->capacity) {
+    fn->capacity = fn->capacity ? fn->capacity * 2 : TAC_INITIAL_CAPACITY;
+    fn->instrs = realloc(fn->instrs, fn->capacity * sizeof(tac_instr_t));
+    assert(fn->instrs != NULL);
+  }
+  tac_instr_t *instr = &fn->instrs[fn->count++];
+  instr->op = op;
+  instr->dst = dst;
+  instr->src1 = src1;
+  instr->src2 = src2;
+  return instr;
 }
 
 /**
- * prints a COMPARE instruction to outfile
+ * Removes the instructions marked in removed (one flag per instruction),
+ * the other ones keep their order
  */
-void tac_instr_cmp (FILE *outfile, char *op1, char *op2)
+void tac_remove_instrs (tac_function_t *fn, bool *removed)
 {
-  fprintf(outfile, "\tCOMPARE %s %s\n", op1, op2);
+  size_t count = 0;
+  for (size_t i = 0; i < fn->count; i++)
+    if (!removed[i])
+      fn->instrs[count++] = fn->instrs[i];
+  fn->count = count;
 }
 
 /**
- * prints an ASSIGN instruction to outfile
+ * returns the jump taken in the opposite case
  */
-void tac_instr_assign (FILE *outfile, char *expr, ast_t *ast)
+tac_opcode_e tac_inv_jump (tac_opcode_e op)
 {
-  fprintf(outfile, "\tASSIGN %s %s\n", \
-      expr,
-      ast->declaration.lvalue->var.name);
+  switch (op) {
+    case TAC_JUMP_LT: return TAC_JUMP_GTE;
+    case TAC_JUMP_LTE: return TAC_JUMP_GT;
+    case TAC_JUMP_GT: return TAC_JUMP_LTE;
+    case TAC_JUMP_GTE: return TAC_JUMP_LT;
+    case TAC_JUMP_NEQ: return TAC_JUMP_EQ;
+    case TAC_JUMP_EQ: return TAC_JUMP_NEQ;
+    default:
+      printf("tac_inv_jump: Expected a conditional jump. exiting.\n");
+      exit(1);
+  }
 }
 
 /**
- * prints a label to file
+ * the JUMP_* instruction which corresponds to a comparison operator
  */
-void tac_instr_label (FILE *outfile, char *label)
+tac_opcode_e tac_cmp_to_jump (ast_binary_e comp)
 {
-  fprintf(outfile, "%s:\n", label);
+  switch (comp) {
+    case AST_BIN_LT: return TAC_JUMP_LT;
+    case AST_BIN_LTE: return TAC_JUMP_LTE;
+    case AST_BIN_GT: return TAC_JUMP_GT;
+    case AST_BIN_GTE: return TAC_JUMP_GTE;
+    case AST_BIN_DIFF: return TAC_JUMP_NEQ;
+    case AST_BIN_EQ: return TAC_JUMP_EQ;
+    default:
+      printf("tac: Expected a comparison operator. exiting.\n");
+      exit(1);
+  }
 }
 
 /**
- * Checks whether a string is actually a tmp variable (= register variable)
+ * the comparison giving the same result with its operands swapped:
+ * 1 < a is a > 1
  */
-bool tac_is_tmp (char *tmp)
+ast_binary_e tac_mirror_cmp (ast_binary_e comp)
 {
-  return strlen(tmp) > 3 && tmp[0] == 't' && tmp[1] == 'm' && tmp[2] == 'p';
+  switch (comp) {
+    case AST_BIN_LT: return AST_BIN_GT;
+    case AST_BIN_LTE: return AST_BIN_GTE;
+    case AST_BIN_GT: return AST_BIN_LT;
+    case AST_BIN_GTE: return AST_BIN_LTE;
+    default: return comp;
+  }
 }
 
 /**
- * Generates a temporary variable name
- * Reuses released tmps to avoid wasting registers
- * We only have a small amount of registers, so we need to reuse them
- * as much as possible
+ * Computes a comparison between two known values
  */
-char *tac_new_tmp ()
+bool tac_compare_values (ast_binary_e comp, long a, long b)
 {
-  if (!queue_isempty(available_tmps))
-    return queue_dequeue(&available_tmps);
+  switch (comp) {
+    case AST_BIN_LT: return a < b;
+    case AST_BIN_LTE: return a <= b;
+    case AST_BIN_GT: return a > b;
+    case AST_BIN_GTE: return a >= b;
+    case AST_BIN_DIFF: return a != b;
+    case AST_BIN_EQ: return a == b;
+    default:
+      printf("tac: Expected a comparison operator. exiting.\n");
+      exit(1);
+  }
+}
 
-  size_t size = integer_size(tmp_number) + sizeof("tmp");
-  char *tmp = malloc(sizeof(char) * size);
-  snprintf(tmp, size, "tmp%lu", tmp_number);
-  tmp_number++;
-  return tmp;
+/**
+ * Computes an operation on two known values, the result wraps around like
+ * in the processor. Returns false when the result is not known at compile
+ * time: the division by zero (or the overflowing one) is left to the program
+ */
+bool tac_fold_values (tac_opcode_e op, long a, long b, long *result)
+{
+  switch (op) {
+    case TAC_ADD: *result = (long)((unsigned long)a + (unsigned long)b); return true;
+    case TAC_SUB: *result = (long)((unsigned long)a - (unsigned long)b); return true;
+    case TAC_MUL: *result = (long)((unsigned long)a * (unsigned long)b); return true;
+    case TAC_DIV:
+      if (b == 0 || (a == LONG_MIN && b == -1))
+        return false;
+      *result = a / b;
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * Simplifies left <op> right when its result is already known:
+ *  - both operands are immediate values: 2 + 3 => $5
+ *  - identities: x + 0, 0 + x, x - 0, x * 1, 1 * x, x / 1 => x
+ *                x * 0, 0 * x, x - x => $0
+ * The operands are already computed, dropping one of them never drops a call
+ */
+bool tac_simplify (tac_opcode_e op, tac_operand_t *left, tac_operand_t *right,
+    tac_operand_t *result)
+{
+  long value;
+  bool left_imm = left->kind == TAC_OPND_IMM,
+       right_imm = right->kind == TAC_OPND_IMM;
+  if (left_imm && right_imm && tac_fold_values(op, left->value, right->value, &value)) {
+    *result = tac_imm(value);
+    return true;
+  }
+
+  if ((op == TAC_ADD || op == TAC_SUB) && right_imm && right->value == 0)
+    *result = *left;
+  else if (op == TAC_ADD && left_imm && left->value == 0)
+    *result = *right;
+  else if ((op == TAC_MUL || op == TAC_DIV) && right_imm && right->value == 1)
+    *result = *left;
+  else if (op == TAC_MUL && left_imm && left->value == 1)
+    *result = *right;
+  else if (op == TAC_MUL && ((left_imm && left->value == 0) ||
+                             (right_imm && right->value == 0)))
+    *result = tac_imm(0);
+  else if (op == TAC_SUB && tac_operand_equals(left, right))
+    *result = tac_imm(0);
+  else
+    return false;
+  return true;
+}
+
+/**
+ * Gives the value of an expression known at compile time: an integer, or
+ * an operation on known values
+ */
+bool tac_constant_expression (ast_t *ast, long *value)
+{
+  static const tac_opcode_e ops[] = {
+    [AST_BIN_PLUS] = TAC_ADD,
+    [AST_BIN_MINUS] = TAC_SUB,
+    [AST_BIN_MULT] = TAC_MUL,
+    [AST_BIN_DIV] = TAC_DIV
+  };
+  long left, right;
+  if (ast->type == AST_INTEGER) {
+    *value = ast->integer;
+    return true;
+  }
+  return ast->type == AST_BINARY && ast_is_arithmetic(ast->binary.op) &&
+         tac_constant_expression(ast->binary.left, &left) &&
+         tac_constant_expression(ast->binary.right, &right) &&
+         tac_fold_values(ops[ast->binary.op], left, right, value);
 }
 
 /**
- * Releases a tmp variable, but first checks if it's actually a tmp variable
- * it could also be a local variable or an argument
- * instead of freeing the tmp var, it puts it into a queue to reuse it as soon
- * as possible
+ * Gives the value of a condition known at compile time, like 1 == 1 or 1.
+ * a ET b is known to be false when a is, a OU b is known to be true when a
+ * is: b is not evaluated anyway
  */
-void tac_release_tmp (char *tmp)
+bool tac_constant_condition (ast_t *ast, bool *value)
 {
-  assert(tmp != NULL);
-  if (tac_is_tmp(tmp)) {
-    queue_enqueue(&available_tmps, tmp);
-  } else {
-    free(tmp);
+  long left, right;
+  if (ast->type == AST_INTEGER) {
+    *value = ast->integer != 0;
+    return true;
+  }
+  if (ast->type != AST_BINARY)
+    return false;
+
+  if (ast_is_cmp(ast->binary.op)) {
+    if (!tac_constant_expression(ast->binary.left, &left) ||
+        !tac_constant_expression(ast->binary.right, &right))
+      return false;
+    *value = tac_compare_values(ast->binary.op, left, right);
+    return true;
+  }
+
+  if (ast_is_bool(ast->binary.op)) {
+    bool known;
+    if (!tac_constant_condition(ast->binary.left, &known))
+      return false;
+    if (known == (ast->binary.op == AST_BIN_OR)) {
+      *value = known;
+      return true;
+    }
+    return tac_constant_condition(ast->binary.right, value);
   }
+  return false;
+}
+
+/**
+ * adds a JUMP_* instruction to the function
+ */
+void tac_instr_jump (tac_function_t *fn, tac_opcode_e jump, long label)
+{
+  tac_emit(fn, jump, tac_label(label), tac_none(), tac_none());
 }
 
 /**
- * When the TAC code generation has been done, we free everything left
+ * adds a COMPARE instruction to the function
  */
-void tac_free_tmps ()
+void tac_instr_cmp (tac_function_t *fn, tac_operand_t op1, tac_operand_t op2)
 {
-  while (available_tmps)
-    free(queue_dequeue(&available_tmps));
+  tac_emit(fn, TAC_COMPARE, tac_none(), op1, op2);
 }
 
 /**
- * Generates a new label name
- * labels are used for JUMP statements
+ * adds an ASSIGN instruction (or an assignment to a tmp) to the function
  */
-char *tac_new_label ()
+void tac_instr_assign (tac_function_t *fn, tac_operand_t dst, tac_operand_t src)
 {
-  size_t size = integer_size(label_number) + sizeof("L");
-  char *label = malloc(sizeof(char) * size);
-  snprintf(label, size, "L%lu", label_number);
-  label_number++;
-  return label;
+  tac_emit(fn, TAC_ASSIGN, dst, src, tac_none());
 }
 
 /**
- * generates the LOAD_ARG instructions
- * LOAD_ARG takes an immediate value as a parameter, specifying the 
- * relative address of the variable in the function's address space
+ * adds a label to the function
  */
-char * tac_gen_load_arg (char *name, size_t offset)
+void tac_instr_label (tac_function_t *fn, long label)
 {
-    size_t size = sizeof(char) * sizeof("\tLOAD_ARG  $") + \
-                  integer_size(offset) + \
-                  strlen(name) + 1;
-    char *instr = malloc(size);
-    assert(instr != NULL);
-    snprintf(instr, size, "\tLOAD_ARG $%zu %s\n", offset, name);
-    return instr;
+  tac_emit(fn, TAC_LABEL, tac_label(label), tac_none(), tac_none());
 }
 
 /**
- * generates the DECL_LOCAL instructions
- * DECL_LOCAL takes an immediate value as a parameter, specifying the 
- * relative address of the variable in the function's address space
+ * Generates a temporary variable
+ * Each value gets its own tmp: the tmps are only names, their registers
+ * are chosen afterwards by the register allocator (see regalloc.c), the
+ * shorter they live, the fewer registers they need
  */
-char * tac_gen_load_local (char *name, size_t offset)
+tac_operand_t tac_new_tmp (tac_function_t *fn)
 {
-    size_t size = sizeof(char) * sizeof("\tDECL_LOCAL  $") + \
-                  integer_size(offset) + \
-                  strlen(name) + 1;
-    char *instr = malloc(size);
-    assert(instr != NULL);
-    snprintf(instr, size, "\tDECL_LOCAL $%zu %s\n", offset, name);
-    return instr;
+  return tac_tmp(fn->tmp_count++);
+}
+
+/**
+ * Adds count local variables after the existing ones, named
+ * <prefix>.<name> after names. Returns the slot of the first one
+ */
+long tac_new_locals (tac_function_t *fn, char *prefix, char **names, size_t count)
+{
+  char **locals = arena_alloc(function_arena, (fn->local_count + count) * sizeof(char *));
+  memcpy(locals, fn->locals, fn->local_count * sizeof(char *));
+  for (size_t i = 0; i < count; i++) {
+    size_t length = strlen(prefix) + strlen(names[i]) + 2;
+    locals[fn->local_count + i] = arena_alloc(function_arena, length);
+    snprintf(locals[fn->local_count + i], length, "%s.%s", prefix, names[i]);
+  }
+  fn->locals = locals;
+  fn->local_count += count;
+  return fn->local_count - count;
+}
+
+/**
+ * Generates a new label number
+ * labels are used for JUMP statements, they are unique in the program
+ */
+long tac_new_label ()
+{
+  return label_number++;
+}
+
+/**
+ * Gives the lowest label of a function and the size of the range up to the
+ * highest one, -1 and 0 without labels. The labels of a function are
+ * created together, their numbers are close: the passes index them by their
+ * distance to the first one
+ */
+void tac_label_range (tac_function_t *fn, long *first, size_t *count)
+{
+  long last = -1;
+  *first = -1;
+  for (size_t i = 0; i < fn->count; i++) {
+    if (fn->instrs[i].op != TAC_LABEL)
+      continue;
+    if (*first == -1 || fn->instrs[i].dst.value < *first)
+      *first = fn->instrs[i].dst.value;
+    if (fn->instrs[i].dst.value > last)
+      last = fn->instrs[i].dst.value;
+  }
+  *count = *first == -1 ? 0 : last - *first + 1;
 }
 
 /**
  * based on the list of parameters of a function and number of local variables
- * we generate the minimal instructions necessary to specify a function
- * we have:
+ * we number the slots of the function, which are printed as:
  *  - ADD_STACK which specifies the number of bytes necessary
  *    to save all the local variables
  *  - LOAD_ARG to load the args from the registers to the stack
  *  - DECL_LOCAL to indicate where a local variable is stored
  *
- *  To calculate ADD_STACK we first need to go through all the locals and args
- *  of a function, hence why we store the LOAD_ARG and DECL_LOCAL in a queue
- *  before writing them to the file
+ *  The arguments get the first slots, in their order in the call
  */
-void tac_function_init (symbol_t *table, FILE *outfile)
+void tac_function_init (tac_function_t *fn, sym_table_t *table)
 {
-  myqueue_t queue = NULL;
-  size_t stack_size = 8; // stack starts at 8 because of saved stack pointer
-  symbol_t *curr = table;
-
-  while (curr) {
+  size_t count = 0;
+  for (symbol_t *curr = sym_first(table); curr; curr = curr->next) {
     ast_t *ast = curr->attributes;
     assert(ast->type == AST_VARIABLE);
-    curr->rel_pos = stack_size;
 
     if (ast->var.type != AST_INTEGER) {
       printf("tac: Unknown variable type. exiting.\n");
       exit(1);
     }
-
-    if (curr->type == SYM_PARAM)
-      queue_enqueue(&queue, tac_gen_load_arg(curr->name, stack_size));
-    else if (curr->type == SYM_VAR)
-      queue_enqueue(&queue, tac_gen_load_local(curr->name, stack_size));
-    else {
+    if (curr->type != SYM_PARAM && curr->type != SYM_VAR) {
       printf("tac: Unexpected symbol. exiting.\n");
       exit(1);
     }
-    stack_size += 8; // integer is 8 bytes (64 bits)
-    curr = curr->next;
+    if (curr->type == SYM_PARAM)
+      fn->param_count++;
+    count++;
   }
 
-  fprintf(outfile, "\tADD_STACK $%zu\n", stack_size);
-  while (queue) {
-    char *instr = queue_dequeue(&queue);
-    fprintf(outfile, "%s", instr);
-    free(instr);
+  fn->locals = arena_alloc(function_arena, count * sizeof(char *));
+  size_t param = 0, local = fn->param_count;
+  for (symbol_t *curr = sym_first(table); curr; curr = curr->next) {
+    curr->rel_pos = curr->type == SYM_PARAM ? param++ : local++;
+    fn->locals[curr->rel_pos] = curr->name;
   }
+  fn->local_count = count;
 }
 
 /**
  * A loop is a repeated sequence of instructions, with a condition to continue or stop
  * to go to a specific instruction, we create labels in the code we refer to
  * when we use JUMP instructions
- * our loops only work with typical while loops, (not do...while), so we need:
- *  - a label before the condition to jump to it after doing the loop instructions
+ * our loops are while loops, turned into a do...while guarded by a first
+ * test of the condition (loop rotation), so we need:
+ *  - a label after the first test, at the start of the loop instructions,
+ *    to jump back to it
  *  - a label after the instructions to jump to it if the loop has to be stopped
- *  - a label after the conditions but before the loop if we have nested
- *    conditions that need to refer to the start of the loop
- *      (a OR condition for example)
+ *  - a label after each test of the condition, as nested conditions need to
+ *    refer to the place where it is true (a OR condition for example)
+ * The test after the instructions jumps over the jump back when the
+ * condition is false, cfg_thread_jumps inverts it: each iteration then runs
+ * a single conditional jump, instead of the jump back and the test
+ *
+ *     COMPARE i n                   COMPARE i n
+ *     JUMP_GTE L2                   JUMP_GTE L2
+ *   L0:                           L0:
+ *     ...                 =>        ...
+ *     COMPARE i n                   COMPARE i n
+ *     JUMP_GTE L2                   JUMP_LT L0
+ *   L3:                           L2:
+ *     JUMP L0
+ *   L2:
+ *
+ * a loop whose condition is known to be false is dropped, a loop whose
+ * condition is known to be true does not test it
  */
-void tac_loop (ast_t *ast, symbol_t *table, FILE *outfile)
+void tac_loop (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
-  char *start = tac_new_label(),
-       *iftrue = tac_new_label(),
-       *iffalse = tac_new_label();
+  bool always;
+  bool known = tac_constant_condition(ast->loop.condition, &always);
+  if (known && !always)
+    return;
 
-  tac_instr_label(outfile, start);
-  tac_condition(ast->loop.condition, table, outfile, iftrue, iffalse, AST_BIN_AND);
+  long start = tac_new_label(),
+       iftrue = tac_new_label(),
+       iffalse = tac_new_label();
 
-  tac_instr_label(outfile, iftrue);
-  tac_statement(ast->loop.stmt, table, outfile);
-  fprintf(outfile, "\tJUMP %s\n", start);
+  if (!known)
+    tac_condition(ast->loop.condition, table, fn, iftrue, iffalse, AST_BIN_AND);
+  tac_instr_label(fn, iftrue);
+  tac_instr_label(fn, start);
+  tac_statement(ast->loop.stmt, table, fn);
 
-  tac_instr_label(outfile, iffalse);
-  free(start);
-  free(iftrue);
-  free(iffalse);
+  if (!known) {
+    long again = tac_new_label();
+    tac_condition(ast->loop.condition, table, fn, again, iffalse, AST_BIN_AND);
+    tac_instr_label(fn, again);
+  }
+  tac_instr_jump(fn, TAC_JUMP, start);
+  tac_instr_label(fn, iffalse);
 }
 
 /**
@@ -289,37 +565,49 @@ void tac_loop (ast_t *ast, symbol_t *table, FILE *outfile)
  *   }
  * L3:
  *   b = 4;
+ *
+ * a branch whose condition is known at compile time is either the only
+ * one generated (true), or not generated at all (false)
  */
-void tac_branch (ast_t *ast, symbol_t *table, FILE *outfile)
+void tac_branch (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
-  char *label_after = tac_new_label();
+  long label_after = tac_new_label();
   ast_t *curr = ast;
   for (;;) {
-    char *iftrue = tac_new_label();
-
     if (curr->type != AST_BRANCH) {
-      tac_statement(curr, table, outfile);
+      tac_statement(curr, table, fn);
       break;
     }
 
-    char *iffalse = curr->branch.invalid ? tac_new_label() : label_after;
+    bool always;
+    if (tac_constant_condition(curr->branch.condition, &always)) {
+      if (always) {
+        tac_statement(curr->branch.valid, table, fn);
+        break;
+      }
+      if (!curr->branch.invalid)
+        break;
+      curr = curr->branch.invalid;
+      continue;
+    }
+
+    long iftrue = tac_new_label();
 
-    tac_condition(curr->branch.condition, table, outfile, iftrue, iffalse, AST_BIN_AND);
-    tac_instr_label(outfile, iftrue);
-    free(iftrue);
-    tac_statement(curr->branch.valid, table, outfile);
+    long iffalse = curr->branch.invalid ? tac_new_label() : label_after;
+
+    tac_condition(curr->branch.condition, table, fn, iftrue, iffalse, AST_BIN_AND);
+    tac_instr_label(fn, iftrue);
+    tac_statement(curr->branch.valid, table, fn);
 
     if (!curr->branch.invalid)
       break;
 
     /* if we access this part, the if statement succeeded, so go to the end */
-    fprintf(outfile, "\tJUMP %s\n", label_after);
-    tac_instr_label(outfile, iffalse);
-    free(iffalse);
+    tac_instr_jump(fn, TAC_JUMP, label_after);
+    tac_instr_label(fn, iffalse);
     curr = curr->branch.invalid;
   }
-  tac_instr_label(outfile, label_after);
-  free(label_after);
+  tac_instr_label(fn, label_after);
 }
 
 /**
@@ -343,134 +631,126 @@ void tac_branch (ast_t *ast, symbol_t *table, FILE *outfile)
  * CALL myfunction tmp2
  * ASSIGN tmp2 d
  */
-char *tac_fncall (ast_t *ast, symbol_t *table, FILE *outfile)
+tac_operand_t tac_fncall (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
   // on doit charger les arguments
-  ast_list_t *curr = ast->call.args;
-  myqueue_t params = NULL;
-  while (curr) {
-    ast_t *arg = curr->elem;
-    queue_enqueue(&params, tac_expression(arg, table, outfile));
-    curr = curr->next;
-  }
+  size_t count = 0;
+  for (ast_list_t *curr = ast->call.args; curr; curr = curr->next)
+    count++;
+
+  tac_operand_t *params = malloc((count ? count : 1) * sizeof(tac_operand_t));
+  assert(params != NULL);
+  size_t i = 0;
+  for (ast_list_t *curr = ast->call.args; curr; curr = curr->next)
+    params[i++] = tac_expression(curr->elem, table, fn);
 
-  while (params) {
-    char *var = queue_dequeue(&params);
-    fprintf(outfile, "\tPARAM %s\n", var);
-    tac_release_tmp(var);
+  for (i = 0; i < count; i++) {
+    tac_emit(fn, TAC_PARAM, tac_none(), params[i], tac_none());
   }
-  char *tmp = tac_new_tmp();
-  fprintf(outfile, "\tCALL %s %s\n", ast->call.name, tmp);
+  free(params);
+
+  tac_operand_t tmp = tac_new_tmp(fn);
+  tac_operand_t function = { .kind = TAC_OPND_FUNCTION, .name = ast->call.name };
+  tac_emit(fn, TAC_CALL, tmp, function, tac_none());
   return tmp;
 }
 
 /**
- * It only copies the name of the variable to ensure there are no use-after-free
- * conditions
+ * variables are referenced by their slot, see tac_function_init
  */
-char *tac_variable (ast_t *ast, symbol_t *table, FILE *outfile)
+tac_operand_t tac_variable (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
-  return copy_name(ast->var.name);
+  symbol_t *symbol = sym_search(table, ast->var.name);
+  assert(symbol != NULL);
+  return tac_local(symbol->rel_pos);
 }
 
 /**
- * Generates a string representation of an integer
- * Integer values always start with the symbol $ to be easily recognizable
+ * Integer values are immediate operands, they are printed with a leading $
+ * to be easily recognizable
  */
-char *tac_integer (ast_t *ast, symbol_t *table, FILE *outfile)
+tac_operand_t tac_integer (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
-  size_t size = integer_size(ast->integer) + 2;
-  char *val = malloc(sizeof(char) * size);
-  snprintf(val, size, "$%ld", ast->integer);
-  return val;
+  return tac_imm(ast->integer);
 }
 
 /**
- * Transforms a binary operator into an assignment to a tmp variable
+ * Transforms a binary operator into an assignment to a tmp variable,
+ * or directly into its result when it is known, see tac_simplify
  */
-char *tac_binary (ast_t *ast, symbol_t *table, FILE *outfile)
+tac_operand_t tac_binary (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
-  char *left = tac_expression(ast->binary.left, table, outfile),
-       *right = tac_expression(ast->binary.right, table, outfile),
-       *op = ast_binary_to_string(ast->binary.op),
-       *var = tac_new_tmp();
-  fprintf(outfile, "\t%s = %s %s %s\n", var, left, op, right);
-  tac_release_tmp(left);
-  tac_release_tmp(right);
+  static const tac_opcode_e ops[] = {
+    [AST_BIN_PLUS] = TAC_ADD,
+    [AST_BIN_MINUS] = TAC_SUB,
+    [AST_BIN_MULT] = TAC_MUL,
+    [AST_BIN_DIV] = TAC_DIV
+  };
+  if (!ast_is_arithmetic(ast->binary.op)) {
+    printf("tac: Expected an arithmetic operator. exiting.\n");
+    exit(1);
+  }
+  tac_operand_t left = tac_expression(ast->binary.left, table, fn),
+                right = tac_expression(ast->binary.right, table, fn),
+                var;
+  if (tac_simplify(ops[ast->binary.op], &left, &right, &var))
+    return var;
+  var = tac_new_tmp(fn);
+  tac_emit(fn, ops[ast->binary.op], var, left, right);
   return var;
 }
 
-/**
- * simple check to know if a string represents an "immediate value" (= a number)
- */
-bool is_immediate (char *item)
-{
-  return item[0] == '$';
-}
-
 /**
  * The comparison instruction is constructed based on the limits of the x86 limitations
  *
  * the comparision looks like:
- * COMPARE $1 a
+ * COMPARE a $1
  * or
  * COMPARE tmp0 a
  * or
- * COMPARE tmp0 tmp1
+ * COMPARE a tmp0
  *
  * but you cannot compare directly two local/arg variables like
  * COMPARE a b // wrong
- * also, the immediate or register value MUST be the first argument
- * COMPARE a tmp0 // wrong
+ * also, the immediate value can only be the second argument
+ * COMPARE $1 a // wrong
+ * an immediate first operand is swapped with the second one, the comparison
+ * being mirrored (1 < a is a > 1), else the first operand is loaded into a
+ * tmp variable
  *
  * the comparison operator sets special flags in the CPU so that the JUMP instructions
  * can do the right move based on the result of the previous comparison
- *
+ * the operands stay in the order of the expression, so the jump uses the
+ * same operator
  */
-ast_binary_e tac_comparison (ast_t *ast, symbol_t *table, FILE *outfile)
-{
-  /* we jump in the inverse case of the comparison
-     so we get the opposite operator */
-  ast_binary_e op = ast->binary.op;
-  /* comparison is between two integers */
-  char *operand1 = tac_expression(ast->binary.left, table, outfile);
-  char *operand2 = tac_expression(ast->binary.right, table, outfile);
-
-  /* the op1 must be a immediate value or a register */
-  if (is_immediate(operand1) || !sym_search(table, operand1)) {
-    /* if the op2 is an immediate value, we first store it into a tmp variable */
-    if (is_immediate(operand2)) {
-      char *tmp = tac_new_tmp();
-      fprintf(outfile, "\t%s = %s\n", tmp, operand2);
-      tac_instr_cmp(outfile, operand1, tmp);
-      tac_release_tmp(tmp);
-    }
-    else
-      tac_instr_cmp(outfile, operand1, operand2);
-  }
-  /* if the op1 is a local variable and op2 is an immediate value or a tmp var
-   * we reverse the order of the operands in the cmp instruction */
-  else if (is_immediate(operand2) || !sym_search(table, operand2)) {
-    tac_instr_cmp(outfile, operand2, operand1);
-
-    /* because we inversed the order, we also need to reverse the operator
-     * Jump if greater than a b is transformed in Jump if lower or equal b a
-     * != and == are equivalent because if b == a, then a == b */
-    if (op != AST_BIN_DIFF && op != AST_BIN_EQ)
-      op = ast_inv_cmp(op);
-  }
-  else {
-    /* if none of the operands is a immediate/tmp var, we create a tmp var to store the value */
-    char *tmp = tac_new_tmp();
-    fprintf(outfile, "\t%s = %s\n", tmp, operand1);
-    tac_instr_cmp(outfile, tmp, operand2);
-    tac_release_tmp(tmp);
-  }
-  tac_release_tmp(operand1);
-  tac_release_tmp(operand2);
+ast_binary_e tac_comparison (tac_function_t *fn, ast_binary_e op,
+    tac_operand_t operand1, tac_operand_t operand2)
+{
+  if (operand1.kind == TAC_OPND_IMM && operand2.kind != TAC_OPND_IMM) {
+    tac_instr_cmp(fn, operand2, operand1);
+    return tac_mirror_cmp(op);
+  }
+  if (operand1.kind == TAC_OPND_IMM ||
+      (operand1.kind == TAC_OPND_LOCAL && operand2.kind == TAC_OPND_LOCAL)) {
+    tac_operand_t tmp = tac_new_tmp(fn);
+    tac_instr_assign(fn, tmp, operand1);
+    tac_instr_cmp(fn, tmp, operand2);
+  }
+  else
+    tac_instr_cmp(fn, operand1, operand2);
+
   return op;
 }
 
+/**
+ * Tells whether a part of a condition is a comparison, not an integer nor
+ * a boolean operator
+ */
+bool tac_is_comparison (ast_t *ast)
+{
+  return ast->type == AST_BINARY && ast_is_cmp(ast->binary.op);
+}
+
 /**
  * A condition is evaluated that way:
  *   * It is expected that the top-level expression is a boolean expression
@@ -499,9 +779,19 @@ ast_binary_e tac_comparison (ast_t *ast, symbol_t *table, FILE *outfile)
  *
  * It's a postfix depth-first operation
  */
-void tac_condition (ast_t *ast, symbol_t *table, FILE *outfile,
-    char *iftrue, char *iffalse, ast_binary_e parent_cond)
+void tac_condition (ast_t *ast, sym_table_t *table, tac_function_t *fn,
+    long iftrue, long iffalse, ast_binary_e parent_cond)
 {
+  /* an integer is true when it is not 0, see ast_check_types: the jump is
+   * either always taken or never */
+  if (ast->type == AST_INTEGER) {
+    if (ast->integer != 0 && iftrue != TAC_NO_LABEL)
+      tac_instr_jump(fn, TAC_JUMP, iftrue);
+    else if (ast->integer == 0 && iffalse != TAC_NO_LABEL)
+      tac_instr_jump(fn, TAC_JUMP, iffalse);
+    return;
+  }
+
   if (ast->type != AST_BINARY) {
     printf("tac_condition: Expected a binary operator. exiting.\n");
     exit(1);
@@ -510,14 +800,30 @@ void tac_condition (ast_t *ast, symbol_t *table, FILE *outfile,
   /* if it's a comparison operator (<, >, etc), it's straightforward
    * we create a jump instruction and stop here */
   if (ast_is_cmp(ast->binary.op)) {
-    ast_binary_e comp = tac_comparison(ast, table, outfile);
+    /* comparison is between two integers */
+    tac_operand_t left = tac_expression(ast->binary.left, table, fn),
+                  right = tac_expression(ast->binary.right, table, fn);
+
+    /* known values: the jump is either always taken or never */
+    if (left.kind == TAC_OPND_IMM && right.kind == TAC_OPND_IMM) {
+      bool result = tac_compare_values(ast->binary.op, left.value, right.value);
+      if (iffalse != TAC_NO_LABEL) {
+        if (!result)
+          tac_instr_jump(fn, TAC_JUMP, iffalse);
+      }
+      else if (iftrue != TAC_NO_LABEL && result)
+        tac_instr_jump(fn, TAC_JUMP, iftrue);
+      return;
+    }
+
+    ast_binary_e comp = tac_comparison(fn, ast->binary.op, left, right);
 
     /* if a iffalse label exists, then we put a jump instruction which is
      * the reversed condition (the 'else if' is the inverse of the 'if') */
-    if (iffalse)
-      tac_instr_jump(outfile, ast_inv_cmp(comp), iffalse);
-    else if (iftrue)
-      tac_instr_jump(outfile, comp, iftrue);
+    if (iffalse != TAC_NO_LABEL)
+      tac_instr_jump(fn, tac_inv_jump(tac_cmp_to_jump(comp)), iffalse);
+    else if (iftrue != TAC_NO_LABEL)
+      tac_instr_jump(fn, tac_cmp_to_jump(comp), iftrue);
     return;
   }
 
@@ -530,7 +836,7 @@ void tac_condition (ast_t *ast, symbol_t *table, FILE *outfile,
    *  but we need to go to the b part if 'a' is invalid
    */
   if (ast_is_bool(ast->binary.op)) {
-    char *between_label = tac_new_label();
+    long between_label = tac_new_label();
     ast_t *left = ast->binary.left,
           *right = ast->binary.right;
 
@@ -539,10 +845,10 @@ void tac_condition (ast_t *ast, symbol_t *table, FILE *outfile,
        * then it's a boolean operator, so it may need to jump to the second part of
        * the AND operator before ending all its operations
        * (think ((a OR b) AND c) where we may not need to evaluate 'b' to evaluate 'c'  */
-      if (ast_is_cmp(left->binary.op))
-        tac_condition(left, table, outfile, NULL, iffalse, -1);
+      if (tac_is_comparison(left))
+        tac_condition(left, table, fn, TAC_NO_LABEL, iffalse, -1);
       else
-        tac_condition(left, table, outfile, between_label, iffalse, AST_BIN_AND);
+        tac_condition(left, table, fn, between_label, iffalse, AST_BIN_AND);
     }
     else {
       /* if the right part of the OR operator is not a comparison operator,
@@ -550,24 +856,23 @@ void tac_condition (ast_t *ast, symbol_t *table, FILE *outfile,
        * before ending all its operations
        * (think ((a AND b) OR c) where we may not need to evaluate 'c' to evaluate
        * the whole condition */
-      if (ast_is_cmp(left->binary.op))
-        tac_condition(left, table, outfile, iftrue, NULL, -1);
+      if (tac_is_comparison(left))
+        tac_condition(left, table, fn, iftrue, TAC_NO_LABEL, -1);
       else
-        tac_condition(left, table, outfile, iftrue, between_label, AST_BIN_OR);
+        tac_condition(left, table, fn, iftrue, between_label, AST_BIN_OR);
     }
 
-    tac_instr_label(outfile, between_label);
+    tac_instr_label(fn, between_label);
 
-    if (ast_is_cmp(right->binary.op)) {
+    if (tac_is_comparison(right)) {
       if (parent_cond == AST_BIN_OR)
-        tac_condition(right, table, outfile, iftrue, NULL, -1);
+        tac_condition(right, table, fn, iftrue, TAC_NO_LABEL, -1);
       else
-        tac_condition(right, table, outfile, NULL, iffalse, -1);
+        tac_condition(right, table, fn, TAC_NO_LABEL, iffalse, -1);
     }
     else
-      tac_condition(right, table, outfile, iftrue, iffalse, parent_cond);
+      tac_condition(right, table, fn, iftrue, iffalse, parent_cond);
 
-    free(between_label);
     return;
   }
 
@@ -580,82 +885,277 @@ void tac_condition (ast_t *ast, symbol_t *table, FILE *outfile,
 /**
  * an expression can be either a binary operation, a simple integer,
  * a function call or a variable
- * this function returns the name of the tmp var in which the expression
- * result is stored
+ * this function returns the operand in which the expression result is
+ * stored: a tmp var, an immediate value or a variable
  */
-char *tac_expression (ast_t *ast, symbol_t *table, FILE *outfile)
+tac_operand_t tac_expression (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
   switch (ast->type) {
-  case AST_BINARY: return tac_binary(ast, table, outfile);
-  case AST_INTEGER: return tac_integer(ast, table, outfile);
-  case AST_FNCALL: return tac_fncall(ast, table, outfile);
-  case AST_VARIABLE: return tac_variable(ast, table, outfile);
+  case AST_BINARY: return tac_binary(ast, table, fn);
+  case AST_INTEGER: return tac_integer(ast, table, fn);
+  case AST_FNCALL: return tac_fncall(ast, table, fn);
+  case AST_VARIABLE: return tac_variable(ast, table, fn);
   default:
     printf("tac: Expected an expression. exiting.\n");
     exit(1);
   }
-  return NULL;
 }
 
 /**
  * a compound statement is simply a list of statements, so we parse
  * them one by one like a linked list
  */
-void tac_compound_statement (ast_t *ast, symbol_t *table, FILE *outfile)
+void tac_compound_statement (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
   ast_list_t *curr = ast->compound_stmt.stmts;
   while (curr) {
-    tac_statement(curr->elem, table, outfile);
+    tac_statement(curr->elem, table, fn);
     curr = curr->next;
   }
 }
 
 /**
  * an assignment is an expression saved into a variable
+ * a variable cannot be copied directly into another one, the value goes
+ * through a tmp variable
+ * an operation or a call computing the value directly stores it into the
+ * variable: x = a + b instead of tmp0 = a + b, then ASSIGN tmp0 x
  */
-void tac_assignment (ast_t *ast, symbol_t *table, FILE *outfile)
+void tac_assignment (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
-  char *expr = tac_expression(ast->assignment.rvalue, table, outfile);
-  tac_instr_assign(outfile, expr, ast);
-  tac_release_tmp(expr);
+  tac_operand_t expr = tac_expression(ast->assignment.rvalue, table, fn);
+  tac_operand_t var = tac_variable(ast->assignment.lvalue, table, fn);
+  tac_instr_t *last = fn->count > 0 ? &fn->instrs[fn->count - 1] : NULL;
+  /* x = x + 0 is simplified to x = x, nothing to do */
+  if (tac_operand_equals(&expr, &var))
+    return;
+  if (expr.kind == TAC_OPND_TMP && last && tac_operand_equals(&last->dst, &expr) &&
+      (TAC_IS_ARITHMETIC(last->op) || last->op == TAC_CALL)) {
+    last->dst = var;
+    return;
+  }
+  if (expr.kind == TAC_OPND_LOCAL) {
+    tac_operand_t tmp = tac_new_tmp(fn);
+    tac_instr_assign(fn, tmp, expr);
+    expr = tmp;
+  }
+  tac_instr_assign(fn, var, expr);
 }
 
 /* no need to store anything for empty declarations
    we could initialize the value to 0 if we'd like */
-void tac_declaration (ast_t *ast, symbol_t *table, FILE *outfile)
+void tac_declaration (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
   if (ast->declaration.rvalue)
-    tac_assignment(ast, table, outfile);
+    tac_assignment(ast, table, fn);
 }
   
+/**
+ * Gives the call of an expression if it calls the current function
+ */
+static
+ast_t *tac_self_call (ast_t *ast, tac_function_t *fn)
+{
+  size_t count = 0;
+  if (ast->type != AST_FNCALL || ast->call.name != fn->name)
+    return NULL;
+  for (ast_list_t *curr = ast->call.args; curr; curr = curr->next)
+    count++;
+  return count == fn->param_count ? ast : NULL;
+}
+
+/**
+ * Finds the call of the current function in an expression of the form
+ * other + f(...) or other * f(...) (either order), see tac_return.
+ * Gives the operator, or AST_BIN_INVALID_OP when there is no such call
+ */
+static
+ast_binary_e tac_accumulated_call (ast_t *ast, tac_function_t *fn, ast_t **call, ast_t **other)
+{
+  if (ast->type != AST_BINARY ||
+      (ast->binary.op != AST_BIN_PLUS && ast->binary.op != AST_BIN_MULT))
+    return AST_BIN_INVALID_OP;
+  *call = tac_self_call(ast->binary.right, fn);
+  *other = ast->binary.left;
+  if (!*call) {
+    *call = tac_self_call(ast->binary.left, fn);
+    *other = ast->binary.right;
+  }
+  return *call ? ast->binary.op : AST_BIN_INVALID_OP;
+}
+
+/**
+ * Looks for the returns of a statement calling the current function: found
+ * is set for any of them, op gets the operator of the accumulated ones, and
+ * mixed is set when they don't all use the same one
+ */
+static
+void tac_tail_scan (ast_t *ast, tac_function_t *fn, bool *found, ast_binary_e *op, bool *mixed)
+{
+  ast_t *call, *other;
+  ast_binary_e accumulated;
+  switch (ast->type) {
+  case AST_RETURN:
+    if (!ast->ret.expr)
+      return;
+    if (tac_self_call(ast->ret.expr, fn))
+      *found = true;
+    else if ((accumulated = tac_accumulated_call(ast->ret.expr, fn, &call, &other)) !=
+             AST_BIN_INVALID_OP) {
+      *found = true;
+      if (*op == AST_BIN_INVALID_OP)
+        *op = accumulated;
+      else if (*op != accumulated)
+        *mixed = true;
+    }
+    return;
+  case AST_BRANCH:
+    tac_tail_scan(ast->branch.valid, fn, found, op, mixed);
+    if (ast->branch.invalid)
+      tac_tail_scan(ast->branch.invalid, fn, found, op, mixed);
+    return;
+  case AST_LOOP:
+    tac_tail_scan(ast->loop.stmt, fn, found, op, mixed);
+    return;
+  case AST_COMPOUND_STATEMENT:
+    for (ast_list_t *curr = ast->compound_stmt.stmts; curr; curr = curr->next)
+      tac_tail_scan(curr->elem, fn, found, op, mixed);
+    return;
+  default:
+    return;
+  }
+}
+
+/**
+ * Prepares the tail recursion of a function, see tac_return: the label its
+ * tail calls jump to, after the accumulator gets its initial value
+ */
+static
+void tac_tail_init (ast_t *ast, tac_function_t *fn)
+{
+  bool found = false, mixed = false;
+  tail = (tac_tail_t){ .entry = TAC_NO_LABEL, .op = AST_BIN_INVALID_OP };
+  for (ast_list_t *curr = ast->function.stmts; curr; curr = curr->next)
+    tac_tail_scan(curr->elem, fn, &found, &tail.op, &mixed);
+  if (!found)
+    return;
+
+  if (mixed)
+    tail.op = AST_BIN_INVALID_OP;
+  if (tail.op != AST_BIN_INVALID_OP) {
+    char *name = "accumulator";
+    tail.accumulator = tac_local(tac_new_locals(fn, fn->name, &name, 1));
+    tac_instr_assign(fn, tail.accumulator, tac_imm(tail.op == AST_BIN_PLUS ? 0 : 1));
+  }
+  tail.entry = tac_new_label();
+  tac_instr_label(fn, tail.entry);
+}
+
+/**
+ * A tail call to the current function: the arguments are written in their
+ * slots and the body starts again. An argument read from another argument
+ * slot is copied first, the slots being written one after the other
+ */
+static
+void tac_tail_jump (ast_t *call, sym_table_t *table, tac_function_t *fn)
+{
+  size_t count = fn->param_count;
+  tac_operand_t *args = malloc((count ? count : 1) * sizeof(tac_operand_t));
+  assert(args != NULL);
+  size_t i = 0;
+  for (ast_list_t *curr = call->call.args; curr; curr = curr->next)
+    args[i++] = tac_expression(curr->elem, table, fn);
+
+  for (i = 0; i < count; i++) {
+    if (args[i].kind == TAC_OPND_LOCAL && (size_t)args[i].value < count &&
+        (size_t)args[i].value != i) {
+      tac_operand_t tmp = tac_new_tmp(fn);
+      tac_instr_assign(fn, tmp, args[i]);
+      args[i] = tmp;
+    }
+  }
+  for (i = 0; i < count; i++) {
+    tac_operand_t slot = tac_local(i);
+    if (!tac_operand_equals(&args[i], &slot))
+      tac_instr_assign(fn, slot, args[i]);
+  }
+  free(args);
+  tac_instr_jump(fn, TAC_JUMP, tail.entry);
+}
+
 /**
  * a return statement simply ends a function, with an optional
  * return value
+ *
+ * Returning the value of a call to the function itself (tail recursion)
+ * does not need a call: the arguments are replaced, and the function
+ * starts again, see tac_tail_jump. The stack does not grow any more:
+ *   retourner pgcd(b, a - (a / b) * b); =>  tmp3 = b
+ *                                           a = tmp3
+ *                                           b = tmp2
+ *                                           JUMP L0
+ * A return of the form x + f(...) or x * f(...) only adds x to the result
+ * (or multiplies it), this goes to an accumulator initialized to 0 (or 1)
+ * and the other returns give their value combined with it:
+ *   retourner n * fact(n - 1);          =>  fact.accumulator = fact.accumulator * n
+ *                                           n = tmp1
+ *                                           JUMP L0
+ *   retourner 1;                        =>  RETURN fact.accumulator
+ * The integer operations wrap around, they are associative and commutative:
+ * the result is the same in any order. The calls to other functions in a
+ * tail position become jumps in asm.c, see asm_tail_call
  */
-void tac_return (ast_t *ast, symbol_t *table, FILE *outfile)
+void tac_return (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
-  if (ast->ret.expr) {
-    char *expr = tac_expression(ast->ret.expr, table, outfile);
-    fprintf(outfile, "\tRETURN %s\n", expr);
-    tac_release_tmp(expr);
-  } else {
-    fprintf(outfile, "\tRETURN\n");
+  static const tac_opcode_e ops[] = {
+    [AST_BIN_PLUS] = TAC_ADD,
+    [AST_BIN_MULT] = TAC_MUL
+  };
+  ast_t *call, *other;
+  if (!ast->ret.expr) {
+    tac_emit(fn, TAC_RETURN, tac_none(), tac_none(), tac_none());
+    return;
+  }
+
+  if (tail.entry != TAC_NO_LABEL && (call = tac_self_call(ast->ret.expr, fn))) {
+    tac_tail_jump(call, table, fn);
+    return;
+  }
+  if (tail.op != AST_BIN_INVALID_OP &&
+      tac_accumulated_call(ast->ret.expr, fn, &call, &other) != AST_BIN_INVALID_OP) {
+    tac_operand_t value = tac_expression(other, table, fn);
+    tac_emit(fn, ops[tail.op], tail.accumulator, tail.accumulator, value);
+    tac_tail_jump(call, table, fn);
+    return;
+  }
+
+  tac_operand_t expr = tac_expression(ast->ret.expr, table, fn);
+  if (tail.op != AST_BIN_INVALID_OP) {
+    tac_operand_t result;
+    if (!tac_simplify(ops[tail.op], &tail.accumulator, &expr, &result)) {
+      result = tac_new_tmp(fn);
+      tac_emit(fn, ops[tail.op], result, tail.accumulator, expr);
+    }
+    expr = result;
   }
+  tac_emit(fn, TAC_RETURN, tac_none(), expr, tac_none());
 }
 
 /**
  * A statement can be a declaration, an assigment, a return, a branch, a loop,
  * or a list of statements (compound statements)
  */
-void tac_statement (ast_t *ast, symbol_t *table, FILE *outfile)
+void tac_statement (ast_t *ast, sym_table_t *table, tac_function_t *fn)
 {
   switch(ast->type){
-  case AST_DECLARATION: return tac_declaration(ast, table, outfile);
-  case AST_ASSIGNMENT: return tac_assignment(ast, table, outfile);
-  case AST_RETURN: return tac_return(ast, table, outfile);
-  case AST_BRANCH: return tac_branch(ast, table, outfile);
-  case AST_LOOP: return tac_loop(ast, table, outfile);
-  case AST_COMPOUND_STATEMENT: return tac_compound_statement(ast, table, outfile);
+  case AST_DECLARATION: return tac_declaration(ast, table, fn);
+  case AST_ASSIGNMENT: return tac_assignment(ast, table, fn);
+  case AST_RETURN: return tac_return(ast, table, fn);
+  case AST_BRANCH: return tac_branch(ast, table, fn);
+  case AST_LOOP: return tac_loop(ast, table, fn);
+  case AST_COMPOUND_STATEMENT: return tac_compound_statement(ast, table, fn);
+  /* a call can be a statement, its result is not used */
+  case AST_FNCALL: tac_fncall(ast, table, fn); return;
   default:
     printf("tac_statement: Expected either a declaration, an assignment "
         "or a return statement. exiting.\n");
@@ -671,33 +1171,161 @@ void tac_statement (ast_t *ast, symbol_t *table, FILE *outfile)
  * - ses instructions
  * - son instruction de retour
  */
-void tac_function (ast_t *ast, symbol_t *table, FILE *outfile)
+tac_function_t *tac_function (ast_t *ast, sym_table_t *table)
 {
-  fprintf(outfile, "%s:\n", ast->function.name);
-  tac_function_init(table, outfile);
+  function_arena = ast->function.arena ? ast->function.arena : arena_current;
+  tac_function_t *fn = arena_alloc(function_arena, sizeof(tac_function_t));
+  memset(fn, 0, sizeof(tac_function_t));
+  fn->name = ast->function.name;
+
+  tac_function_init(fn, table);
+  tac_tail_init(ast, fn);
   ast_list_t *curr = ast->function.stmts;
   while (curr) {
-    tac_statement(curr->elem, table, outfile);
+    tac_statement(curr->elem, table, fn);
     curr = curr->next;
   }
+  optimize_function(fn);
+  /* the function is complete, its array does not grow anymore */
+  if (fn->count > 0 && fn->count < fn->capacity) {
+    fn->instrs = realloc(fn->instrs, fn->count * sizeof(tac_instr_t));
+    fn->capacity = fn->count;
+  }
+  return fn;
 }
 
 /**
- * Generates the three address codes (tac)
+ * The labels are numbered from the start of the program
  */
-void tac_generator (ast_list_t *functions, FILE *outfile)
+void tac_init ()
 {
   label_number = 0;
-  tmp_number = 0;
-  available_tmps = NULL;
+}
+
+/**
+ * Generates the three address codes (tac) of one function
+ */
+tac_function_t *tac_generate_function (ast_t *ast)
+{
+  symbol_t *sym = sym_search(global_table, ast->function.name);
+  assert(sym != NULL);
+  return tac_function(ast, sym->function_table);
+}
+
+/**
+ * Generates the three address codes (tac), one tac_function_t per function
+ */
+tac_function_t *tac_generator (ast_list_t *functions)
+{
+  tac_function_t *first = NULL, **last = &first;
+  tac_init();
 
   while (functions) {
-    ast_t *ast = functions->elem;
-    symbol_t *table = sym_search(global_table, ast->function.name);
-    assert(table != NULL);
-    tac_function(ast, table->function_table, outfile);
+    *last = tac_generate_function(functions->elem);
+    last = &(*last)->next;
     functions = functions->next;
   }
 
-  tac_free_tmps();
+  return first;
+}
+
+/**
+ * prints an operand in its text form:
+ * $1 (immediate value), a (variable), tmp0, L0 or a function name
+ */
+void tac_print_operand (tac_function_t *fn, tac_operand_t *operand, FILE *outfile)
+{
+  switch (operand->kind) {
+  case TAC_OPND_IMM: fprintf(outfile, "$%ld", operand->value); break;
+  case TAC_OPND_LOCAL:
+    if ((size_t)operand->value < fn->local_count)
+      fprintf(outfile, "%s", fn->locals[operand->value]);
+    else
+      fprintf(outfile, "slot%ld", operand->value);
+    break;
+  case TAC_OPND_TMP: fprintf(outfile, "tmp%ld", operand->value); break;
+  case TAC_OPND_LABEL: fprintf(outfile, "L%ld", operand->value); break;
+  case TAC_OPND_FUNCTION: fprintf(outfile, "%s", operand->name); break;
+  case TAC_OPND_REG: fprintf(outfile, "%s", reg_names[operand->value]); break;
+  case TAC_OPND_NONE: break;
+  }
+}
+
+/**
+ * prints one instruction in its text form, see the instruction set above
+ */
+void tac_print_instr (tac_function_t *fn, tac_instr_t *instr, FILE *outfile)
+{
+  if (instr->op == TAC_LABEL) {
+    tac_print_operand(fn, &instr->dst, outfile);
+    fprintf(outfile, ":\n");
+    return;
+  }
+
+  fprintf(outfile, "\t");
+  /* assignments and operations to a tmp are printed as tmp = ... */
+  if ((instr->op == TAC_ASSIGN && instr->dst.kind == TAC_OPND_TMP) ||
+      TAC_IS_ARITHMETIC(instr->op)) {
+    tac_print_operand(fn, &instr->dst, outfile);
+    fprintf(outfile, " = ");
+    tac_print_operand(fn, &instr->src1, outfile);
+    if (TAC_IS_ARITHMETIC(instr->op)) {
+      fprintf(outfile, " %s ", tac_opcode_name(instr->op));
+      tac_print_operand(fn, &instr->src2, outfile);
+    }
+    fprintf(outfile, "\n");
+    return;
+  }
+
+  fprintf(outfile, "%s", tac_opcode_name(instr->op));
+  tac_operand_t *operands[] = { &instr->src1, &instr->src2, &instr->dst };
+  for (size_t i = 0; i < sizeof(operands) / sizeof(operands[0]); i++) {
+    if (operands[i]->kind == TAC_OPND_NONE)
+      continue;
+    fprintf(outfile, " ");
+    tac_print_operand(fn, operands[i], outfile);
+  }
+  fprintf(outfile, "\n");
+}
+
+/**
+ * prints the text form of a function, as written to the .interm file
+ * the slot n is stored at -8 * (n + 1)(%rbp), the stack starts at 8 because
+ * of the saved base pointer
+ */
+void tac_print_function (tac_function_t *fn, FILE *outfile)
+{
+  fprintf(outfile, "%s:\n", fn->name);
+  fprintf(outfile, "\tADD_STACK $%zu\n", 8 * (fn->local_count + 1));
+  for (size_t slot = 0; slot < fn->local_count; slot++)
+    fprintf(outfile, "\t%s $%zu %s\n",
+        slot < fn->param_count ? "LOAD_ARG" : "DECL_LOCAL",
+        8 * (slot + 1), fn->locals[slot]);
+
+  for (size_t i = 0; i < fn->count; i++)
+    tac_print_instr(fn, &fn->instrs[i], outfile);
+}
+
+void tac_print (tac_function_t *functions, FILE *outfile)
+{
+  for (tac_function_t *fn = functions; fn; fn = fn->next)
+    tac_print_function(fn, outfile);
+}
+
+/**
+ * the tac_function_t itself is released with the body of its function
+ */
+void tac_release_function (tac_function_t *fn)
+{
+  free(fn->instrs);
+  free(fn->places);
+  fn->instrs = NULL;
+  fn->places = NULL;
+  fn->count = fn->capacity = 0;
+}
+
+void tac_release (tac_function_t *functions)
+{
+  for (tac_function_t *fn = functions; fn; fn = fn->next)
+    tac_release_function(fn);
 }
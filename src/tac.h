@@ -1,11 +1,122 @@
 #ifndef TAC_H
 #define TAC_H
 #include <stdio.h>
+#include <stdbool.h>
+#include "symbol.h"
 
-void tac_condition (ast_t *ast, symbol_t *table, FILE *outfile,
-    char *iftrue, char *iffalse, ast_binary_e parent_cond);
-void tac_statement (ast_t *ast, symbol_t *table, FILE *outfile);
-char *tac_expression (ast_t *ast, symbol_t *table, FILE *outfile);
-void tac_generator (ast_list_t *functions, FILE *outfile);
+/**
+ * Operations of the three address code, see tac.c for their meaning
+ */
+typedef enum {
+  TAC_LABEL,    // dst:
+  TAC_JUMP,     // JUMP dst
+  TAC_JUMP_LT,  // JUMP_LT dst, jumps if src1 < src2 in the last COMPARE
+  TAC_JUMP_LTE,
+  TAC_JUMP_GT,
+  TAC_JUMP_GTE,
+  TAC_JUMP_NEQ,
+  TAC_JUMP_EQ,
+  TAC_COMPARE,  // COMPARE src1 src2
+  TAC_ASSIGN,   // dst = src1
+  TAC_ADD,      // dst = src1 + src2
+  TAC_SUB,
+  TAC_MUL,
+  TAC_DIV,
+  TAC_PARAM,    // PARAM src1, next argument of the following CALL
+  TAC_CALL,     // dst = CALL src1, dst is optional
+  TAC_RETURN,   // RETURN src1, src1 is optional
+  TAC_CMOV_LT,  // CMOV_LT dst = src1 if src1 < src2 in the last COMPARE,
+  TAC_CMOV_LTE, // dst keeps its value otherwise, see ifconv.c
+  TAC_CMOV_GT,
+  TAC_CMOV_GTE,
+  TAC_CMOV_NEQ,
+  TAC_CMOV_EQ,
+  TAC_OPCODE_COUNT
+} tac_opcode_e;
+
+typedef enum {
+  TAC_OPND_NONE,
+  TAC_OPND_IMM,      // immediate value
+  TAC_OPND_LOCAL,    // slot of an argument or a local variable
+  TAC_OPND_TMP,      // temporary variable, stored in a register
+  TAC_OPND_LABEL,    // label number, unique in the program
+  TAC_OPND_FUNCTION, // name of a called function
+  TAC_OPND_REG       // machine register, set by the register allocator
+} tac_operand_kind_e;
+
+typedef struct tac_operand_t {
+  tac_operand_kind_e kind;
+  union {
+    long value; // immediate value, slot, tmp, label or register number
+    char *name; // interned
+  };
+} tac_operand_t;
+
+typedef struct tac_instr_t {
+  tac_opcode_e op;
+  tac_operand_t dst;
+  tac_operand_t src1;
+  tac_operand_t src2;
+} tac_instr_t;
+
+/**
+ * The code of a function, an array of instructions.
+ * The arguments are the first param_count slots, the local variables follow,
+ * then the spill_count tmps spilled by the register allocator (no name).
+ * With --promote-locals, only the variables left in memory keep a slot of the
+ * frame: the register allocator renumbers the slots, see regalloc_function.
+ * The structure is allocated with the body of the function, the
+ * instructions are released by tac_release_function
+ */
+typedef struct tac_function_t {
+  char *name; // interned
+  char **locals; // name of each slot, except the spilled tmps
+  size_t local_count;
+  size_t spill_count;
+  size_t slot_count; // slots of the frame after the register allocation
+  size_t param_count;
+  size_t tmp_count; // tmps are numbered from 0
+  unsigned saved_regs; // callee-saved registers used, see regalloc.c
+  tac_operand_t *places; // register or slot of each variable, see regalloc.c
+  tac_instr_t *instrs;
+  size_t count;
+  size_t capacity;
+  struct tac_function_t *next;
+} tac_function_t;
+
+#define TAC_IS_JUMP(op) ((op) >= TAC_JUMP && (op) <= TAC_JUMP_EQ)
+#define TAC_IS_COND_JUMP(op) ((op) > TAC_JUMP && (op) <= TAC_JUMP_EQ)
+#define TAC_IS_ARITHMETIC(op) ((op) >= TAC_ADD && (op) <= TAC_DIV)
+#define TAC_IS_CMOV(op) ((op) >= TAC_CMOV_LT && (op) <= TAC_CMOV_EQ)
+/* the CMOV_* with the condition of a conditional JUMP_* */
+#define TAC_JUMP_TO_CMOV(op) ((op) - TAC_JUMP_LT + TAC_CMOV_LT)
+
+tac_operand_t tac_none ();
+tac_operand_t tac_imm (long value);
+tac_operand_t tac_local (long slot);
+tac_operand_t tac_tmp (long tmp);
+tac_operand_t tac_label (long label);
+bool tac_operand_equals (tac_operand_t *a, tac_operand_t *b);
+
+tac_instr_t *tac_emit (tac_function_t *fn, tac_opcode_e op,
+    tac_operand_t dst, tac_operand_t src1, tac_operand_t src2);
+void tac_remove_instrs (tac_function_t *fn, bool *removed);
+const char *tac_opcode_name (tac_opcode_e op);
+tac_opcode_e tac_inv_jump (tac_opcode_e op);
+long tac_new_label ();
+void tac_label_range (tac_function_t *fn, long *first, size_t *count);
+tac_operand_t tac_new_tmp (tac_function_t *fn);
+long tac_new_locals (tac_function_t *fn, char *prefix, char **names, size_t count);
+
+tac_function_t *tac_generator (ast_list_t *functions);
+/** tac_generator in steps, for one function at a time **/
+void tac_init ();
+tac_function_t *tac_generate_function (ast_t *ast);
+
+void tac_print_instr (tac_function_t *fn, tac_instr_t *instr, FILE *outfile);
+void tac_print_function (tac_function_t *fn, FILE *outfile);
+void tac_print (tac_function_t *functions, FILE *outfile);
+void tac_release_function (tac_function_t *fn);
+void tac_release (tac_function_t *functions);
 
 #endif /* ifndef TAC_H */
@@ -5,14 +5,6 @@
 #include <execinfo.h>
 #endif
 
-char *copy_name (char *name)
-{
-  size_t len = strlen(name) + 1;
-  char *out = malloc(sizeof(char) * len);
-  strncpy(out, name, len);
-  return out;
-}
-
 void print_backtrace ()
 {
 #ifndef WIN32
@@ -14,7 +14,6 @@
 
 #define STREQUAL 0
 
-char *copy_name (char *name);
 void print_backtrace ();
 
 #endif /* ifndef UTILS_H */